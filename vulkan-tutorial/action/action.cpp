@@ -6,6 +6,20 @@
 #include "../position.h"
 #include "../map_view.h"
 #include "../util.h"
+#include "../tile_codec.h"
+#include "../graphics/compression.h"
+#include "history_codec.h"
+
+namespace
+{
+  // Compressing a batch should not make the editor stutter
+  constexpr int CompressionLevel = 0;
+
+  size_t getTileMemoryUsage(const Tile &tile)
+  {
+    return sizeof(Tile) + tile.getItems().capacity() * sizeof(Item) + (tile.getGround() ? sizeof(Item) : 0);
+  }
+} // namespace
 
 MapAction::MapAction(MapView &mapView, MapActionType actionType)
     : committed(false),
@@ -54,21 +68,29 @@ void MapAction::commit()
                      {
                        for (const auto pos : data.positions)
                        {
-                         mapView.getTile(pos)->deselectAll();
+                         mapView.getMutableTile(pos)->deselectAll();
                        }
                        mapView.selection.deselect(data.positions);
+                       for (const auto &area : data.areas)
+                       {
+                         mapView.selection.removeArea(area);
+                       }
                      }
                      else
                      {
                        for (const auto pos : data.positions)
                        {
-                         mapView.getTile(pos)->selectAll();
+                         mapView.getMutableTile(pos)->selectAll();
                        }
                        mapView.selection.merge(data.positions);
+                       for (const auto &area : data.areas)
+                       {
+                         mapView.selection.addArea(area);
+                       }
                      }
                    },
                    [this, &change](Change::SelectionData &data) {
-                     Tile *tile = mapView.getTile(data.position);
+                     Tile *tile = mapView.getMutableTile(data.position);
                      for (const auto i : data.indices)
                      {
                        if (data.select)
@@ -82,7 +104,10 @@ void MapAction::commit()
                      }
                      if (data.includesGround)
                      {
-                       tile->selectGround();
+                       if (data.select)
+                         tile->selectGround();
+                       else
+                         tile->deselectGround();
                      }
 
                      if (tile->hasSelection())
@@ -96,6 +121,15 @@ void MapAction::commit()
 
                      data.select = !data.select;
                    },
+                   [&map](Change::ItemReplacementData &data) {
+                     map.applyItemReplacement(data);
+                   },
+                   [this](Change::SelectionMoveData &data) {
+                     mapView.applySelectionMove(data);
+                   },
+                   [this](Change::TileEditData &data) {
+                     mapView.applyTileEdit(data);
+                   },
                    [](auto &arg) {
                      ABORT_PROGRAM("Unknown change!");
                    }},
@@ -139,21 +173,29 @@ void MapAction::undo()
                      {
                        for (const auto pos : data.positions)
                        {
-                         mapView.getTile(pos)->selectAll();
+                         mapView.getMutableTile(pos)->selectAll();
                        }
                        mapView.selection.merge(data.positions);
+                       for (const auto &area : data.areas)
+                       {
+                         mapView.selection.addArea(area);
+                       }
                      }
                      else
                      {
                        for (const auto pos : data.positions)
                        {
-                         mapView.getTile(pos)->deselectAll();
+                         mapView.getMutableTile(pos)->deselectAll();
                        }
                        mapView.selection.deselect(data.positions);
+                       for (const auto &area : data.areas)
+                       {
+                         mapView.selection.removeArea(area);
+                       }
                      }
                    },
                    [this, &change](Change::SelectionData &data) {
-                     Tile *tile = mapView.getTile(data.position);
+                     Tile *tile = mapView.getMutableTile(data.position);
                      for (const auto i : data.indices)
                      {
                        if (data.select)
@@ -167,7 +209,10 @@ void MapAction::undo()
                      }
                      if (data.includesGround)
                      {
-                       tile->deselectGround();
+                       if (data.select)
+                         tile->selectGround();
+                       else
+                         tile->deselectGround();
                      }
 
                      if (tile->hasSelection())
@@ -181,6 +226,15 @@ void MapAction::undo()
 
                      data.select = !data.select;
                    },
+                   [this](Change::ItemReplacementData &data) {
+                     mapView.getMap()->applyItemReplacement(data);
+                   },
+                   [this](Change::SelectionMoveData &data) {
+                     mapView.applySelectionMove(data);
+                   },
+                   [this](Change::TileEditData &data) {
+                     mapView.applyTileEdit(data);
+                   },
                    [](auto &arg) {
                      ABORT_PROGRAM("Unknown change!");
                    }},
@@ -194,6 +248,83 @@ void MapAction::redo()
   commit();
 }
 
+size_t MapAction::getMemoryUsage() const
+{
+  size_t bytes = sizeof(MapAction) + (changes.capacity() - changes.size()) * sizeof(Change);
+  for (const Change &change : changes)
+  {
+    bytes += change.getMemoryUsage();
+  }
+
+  return bytes;
+}
+
+void MapAction::addChangedPositions(PositionBitmap &positions) const
+{
+  for (const Change &change : changes)
+  {
+    change.addChangedPositions(positions);
+  }
+}
+
+void Change::addChangedPositions(PositionBitmap &positions) const
+{
+  std::visit(util::overloaded{
+                 [&positions](const TileData &tile) {
+                   positions.insert(tile.getPosition());
+                 },
+                 [&positions](const RemovedTileData &removed) {
+                   if (std::holds_alternative<Tile>(removed.data))
+                     positions.insert(std::get<Tile>(removed.data).getPosition());
+                   else
+                     positions.insert(std::get<Position>(removed.data));
+                 },
+                 [&positions](const ItemReplacementData &data) {
+                   for (const ItemReplacement::TileChange &tile : data.tiles)
+                   {
+                     positions.insert(tile.position);
+                   }
+                 },
+                 [&positions](const SelectionMoveData &data) {
+                   positions.insert(data.positions);
+                   positions.insert(data.positions.translated(data.delta));
+                 },
+                 [&positions](const TileEditData &edit) {
+                   positions.insert(edit.position);
+                 },
+                 [](const auto &) {
+                   // Selection changes
+                 }},
+             data);
+}
+
+size_t Change::getMemoryUsage() const
+{
+  size_t bytes = sizeof(Change);
+  std::visit(util::overloaded{
+                 [](const std::monostate &) {},
+                 [&bytes](const TileData &tile) {
+                   bytes += getTileMemoryUsage(tile) - sizeof(Tile);
+                 },
+                 [&bytes](const RemovedTileData &removed) {
+                   if (std::holds_alternative<Tile>(removed.data))
+                     bytes += getTileMemoryUsage(std::get<Tile>(removed.data)) - sizeof(Tile);
+                 },
+                 [&bytes](const SelectionData &data) {
+                   bytes += data.indices.capacity() * sizeof(uint16_t);
+                 },
+                 [&bytes](const FullSelectionData &data) {
+                   bytes += data.positions.getMemoryUsage() + data.areas.capacity() * sizeof(SelectionArea);
+                 },
+                 [&bytes](const auto &data) {
+                   // ItemReplacement, SelectionMove and TileEdit
+                   bytes += data.getMemoryUsage();
+                 }},
+             data);
+
+  return bytes;
+}
+
 Change::Change()
     : data({})
 {
@@ -211,6 +342,13 @@ Change Change::setTile(Tile &&tile)
   return change;
 }
 
+Change Change::editTile(TileEdit &&edit)
+{
+  Change change;
+  change.data = std::move(edit);
+  return change;
+}
+
 Change Change::selection(const Tile &tile)
 {
   Change change;
@@ -234,32 +372,85 @@ Change Change::selection(const Tile &tile)
   return change;
 }
 
-Change Change::selection(std::unordered_set<Position, PositionHash> positions)
+std::optional<Change> Change::selectItems(const Position &position, const Tile &tile, uint16_t serverId)
+{
+  Change::SelectionData data{};
+  data.position = position;
+  data.select = true;
+
+  Item *ground = tile.getGround();
+  data.includesGround = ground && ground->getId() == serverId && !ground->selected;
+
+  auto &items = tile.getItems();
+  for (size_t i = 0; i < items.size(); ++i)
+  {
+    const Item &item = items.at(i);
+    if (item.getId() == serverId && !item.selected)
+    {
+      data.indices.emplace_back(static_cast<uint16_t>(i));
+    }
+  }
+
+  if (!data.includesGround && data.indices.empty())
+    return {};
+
+  Change change;
+  change.data = data;
+  return change;
+}
+
+Change Change::replaceItems(ItemReplacement &&replacement)
+{
+  Change change;
+  change.data = std::move(replacement);
+  return change;
+}
+
+Change Change::moveSelection(SelectionMove &&move)
+{
+  Change change;
+  change.data = std::move(move);
+  return change;
+}
+
+Change Change::selection(PositionBitmap positions)
 {
   Change change;
   FullSelectionData data;
-  data.positions = positions;
+  data.positions = std::move(positions);
   data.isDeselect = false;
 
-  change.data = data;
+  change.data = std::move(data);
   return change;
 }
 
-Change Change::deselection(std::unordered_set<Position, PositionHash> positions)
+Change Change::deselection(PositionBitmap positions, std::vector<SelectionArea> areas)
 {
   Change change;
   FullSelectionData data;
-  data.positions = positions;
+  data.positions = std::move(positions);
+  data.areas = std::move(areas);
   data.isDeselect = true;
 
-  change.data = data;
+  change.data = std::move(data);
+  return change;
+}
+
+Change Change::selection(const SelectionArea &area)
+{
+  Change change;
+  FullSelectionData data;
+  data.areas.emplace_back(area);
+  data.isDeselect = false;
+
+  change.data = std::move(data);
   return change;
 }
 
-Change Change::selectTopItem(Tile &tile)
+Change Change::selectTopItem(const Position &position, const Tile &tile)
 {
   Change::SelectionData data{};
-  data.position = tile.getPosition();
+  data.position = position;
   data.select = true;
 
   if (tile.getTopItem() == tile.getGround())
@@ -277,9 +468,9 @@ Change Change::selectTopItem(Tile &tile)
   return change;
 }
 
-Change Change::deselectTopItem(Tile &tile)
+Change Change::deselectTopItem(const Position &position, const Tile &tile)
 {
-  Change change = selectTopItem(tile);
+  Change change = selectTopItem(position, tile);
   std::get<Change::SelectionData>(change.data).select = false;
   return change;
 }
@@ -321,6 +512,22 @@ void MapActionGroup::undo()
   }
 }
 
+size_t MapActionGroup::getMemoryUsage() const
+{
+  size_t bytes = sizeof(MapActionGroup) + (actions.capacity() - actions.size()) * sizeof(MapAction);
+  for (const MapAction &action : actions)
+  {
+    bytes += action.getMemoryUsage();
+  }
+
+  return bytes;
+}
+
+EditorHistory::EditorHistory(MapView &mapView)
+    : mapView(mapView)
+{
+}
+
 MapAction *EditorHistory::getLatestAction()
 {
   if (!currentGroup.has_value() || currentGroup.value().actions.empty())
@@ -342,6 +549,8 @@ void EditorHistory::commit(MapAction &&action)
     action.commit();
   }
 
+  journal(action);
+
   MapAction *currentAction = getLatestAction();
   if (currentAction && currentAction->getType() == action.getType())
   {
@@ -375,8 +584,13 @@ void EditorHistory::endGroup(ActionGroupType groupType)
   DEBUG_ASSERT(currentGroup.value().groupType == groupType, s.str());
   Logger::debug() << "endGroup " << groupType << std::endl;
 
-  actionGroups.emplace(std::move(currentGroup.value()));
+  MapActionGroup &group = currentGroup.value();
+  size_t memoryUsage = group.getMemoryUsage();
+  hotGroups.push_back({std::move(group), memoryUsage});
+  hotMemoryUsage += memoryUsage;
   currentGroup.reset();
+
+  compressOldGroups();
 }
 
 void EditorHistory::undoLast()
@@ -386,14 +600,131 @@ void EditorHistory::undoLast()
     endGroup(currentGroup.value().groupType);
   }
 
-  if (!actionGroups.empty())
+  if (hotGroups.empty() && !coldBatches.empty())
+  {
+    decompressLastBatch();
+  }
+
+  if (!hotGroups.empty())
   {
-    actionGroups.top().undo();
-    actionGroups.pop();
+    HotGroup &last = hotGroups.back();
+    last.group.undo();
+    journal(last.group);
+    hotMemoryUsage -= last.memoryUsage;
+    hotGroups.pop_back();
   }
 }
 
 bool EditorHistory::hasCurrentGroup() const
 {
   return currentGroup.has_value();
-}
\ No newline at end of file
+}
+
+void EditorHistory::setMemoryBudget(size_t bytes)
+{
+  memoryBudget = bytes;
+  compressOldGroups();
+}
+
+bool EditorHistory::usePageFile(const std::filesystem::path &path)
+{
+  auto file = std::make_unique<PageFile>();
+  if (!file->open(path))
+    return false;
+
+  pageFile = std::move(file);
+  return true;
+}
+
+size_t EditorHistory::getMemoryUsage() const
+{
+  size_t bytes = hotMemoryUsage + coldBatches.capacity() * sizeof(ColdBatch);
+  for (const ColdBatch &batch : coldBatches)
+  {
+    bytes += batch.data.capacity();
+  }
+
+  return bytes;
+}
+
+void EditorHistory::journal(const MapAction &action)
+{
+  if (!mapView.journal.isOpen())
+    return;
+
+  PositionBitmap positions;
+  action.addChangedPositions(positions);
+  mapView.journal.append(*mapView.getMap(), positions);
+}
+
+void EditorHistory::journal(const MapActionGroup &group)
+{
+  if (!mapView.journal.isOpen())
+    return;
+
+  PositionBitmap positions;
+  for (const MapAction &action : group.actions)
+  {
+    action.addChangedPositions(positions);
+  }
+  mapView.journal.append(*mapView.getMap(), positions);
+}
+
+void EditorHistory::compressOldGroups()
+{
+  if (hotMemoryUsage <= memoryBudget || hotGroups.size() < HotGroupCount + MinBatchGroupCount)
+    return;
+
+  BinaryWriter writer;
+  uint32_t groupCount = 0;
+  while (hotGroups.size() > HotGroupCount && (groupCount < MinBatchGroupCount || hotMemoryUsage > memoryBudget / 2))
+  {
+    HotGroup &oldest = hotGroups.front();
+    HistoryCodec::write(writer, oldest.group);
+    hotMemoryUsage -= oldest.memoryUsage;
+    hotGroups.pop_front();
+    ++groupCount;
+  }
+
+  ColdBatch batch;
+  batch.groupCount = groupCount;
+  batch.size = static_cast<uint32_t>(writer.data.size());
+
+  std::string data = LZMA::compress(std::string(writer.data.begin(), writer.data.end()), CompressionLevel);
+  if (pageFile)
+  {
+    batch.page = pageFile->write(data);
+    batch.inPageFile = true;
+  }
+  else
+  {
+    batch.data = std::move(data);
+  }
+
+  coldBatches.emplace_back(std::move(batch));
+}
+
+void EditorHistory::decompressLastBatch()
+{
+  ColdBatch &batch = coldBatches.back();
+
+  std::string data = LZMA::decompress(batch.inPageFile ? pageFile->read(batch.page) : batch.data, batch.size);
+  std::vector<uint8_t> bytes(data.begin(), data.end());
+  BinaryReader reader(bytes);
+
+  for (uint32_t i = 0; i < batch.groupCount; ++i)
+  {
+    MapActionGroup group = HistoryCodec::read(reader, mapView);
+    size_t memoryUsage = group.getMemoryUsage();
+    hotGroups.push_back({std::move(group), memoryUsage});
+    hotMemoryUsage += memoryUsage;
+  }
+
+  DEBUG_ASSERT(reader.ok() && reader.atEnd(), "A compressed history batch is corrupt.");
+
+  if (batch.inPageFile)
+  {
+    pageFile->release(batch.page);
+  }
+  coldBatches.pop_back();
+}
@@ -1,12 +1,21 @@
 #pragma once
 
 #include <vector>
-#include <stack>
+#include <deque>
 #include <unordered_map>
+#include <optional>
+#include <filesystem>
+#include <memory>
 
 #include "../tile_location.h"
 #include "../ecs/item_animation.h"
 #include "../position.h"
+#include "../item_replacement.h"
+#include "../selection_move.h"
+#include "../tile_edit.h"
+#include "../position_bitmap.h"
+#include "../selection.h"
+#include "../page_file.h"
 
 class Change;
 class MapView;
@@ -16,7 +25,9 @@ enum class ActionGroupType
 {
   Selection,
   AddMapItem,
-  RemoveMapItem
+  RemoveMapItem,
+  ReplaceItems,
+  MoveItems
 };
 
 enum class MapActionType
@@ -27,7 +38,8 @@ enum class MapActionType
   Move,
   RemoveTile,
   CutTile,
-  PasteTile
+  PasteTile,
+  ReplaceItems
 };
 
 class MapAction
@@ -64,8 +76,12 @@ public:
     return actionType;
   }
 
+  size_t getMemoryUsage() const;
+  void addChangedPositions(PositionBitmap &positions) const;
+
 private:
   friend class EditorHistory;
+  friend class HistoryCodec;
   bool committed;
 
   MapActionType actionType;
@@ -92,10 +108,13 @@ public:
   void commit();
   void undo();
 
+  size_t getMemoryUsage() const;
+
   ActionGroupType groupType;
 
 private:
   friend class EditorHistory;
+  friend class HistoryCodec;
   std::vector<MapAction> actions;
 };
 
@@ -113,11 +132,16 @@ class Change
 public:
   struct FullSelectionData
   {
-    std::unordered_set<Position, PositionHash> positions;
+    PositionBitmap positions;
+    // Areas whose tiles have not been selected yet (see Selection::addArea)
+    std::vector<SelectionArea> areas;
     bool isDeselect;
   };
   using TileData = Tile;
   using RemovedTileData = RemovedTile;
+  using ItemReplacementData = ItemReplacement;
+  using SelectionMoveData = SelectionMove;
+  using TileEditData = TileEdit;
 
   struct SelectionData
   {
@@ -131,14 +155,47 @@ public:
 
   static Change removeTile(const Position pos);
   static Change setTile(Tile &&tile);
-  static Change selection(std::unordered_set<Position, PositionHash> positions);
-  static Change deselection(std::unordered_set<Position, PositionHash> positions);
+  /*
+    A change of part of a tile. Unlike setTile, only the items that are added
+    or removed are stored (see TileEdit).
+  */
+  static Change editTile(TileEdit &&edit);
+  static Change selection(PositionBitmap positions);
+  static Change deselection(PositionBitmap positions, std::vector<SelectionArea> areas = {});
+  /*
+    Select the non-empty tiles of the area without touching them. They are
+    selected when the selection is materialized (see Selection::materialize).
+  */
+  static Change selection(const SelectionArea &area);
 
-  static Change selectTopItem(Tile &tile);
-  static Change deselectTopItem(Tile &tile);
+  /*
+    The tile can be shared (see TilePool), so the position is passed separately.
+  */
+  static Change selectTopItem(const Position &position, const Tile &tile);
+  static Change deselectTopItem(const Position &position, const Tile &tile);
 
   static Change selection(const Tile &tile);
 
+  /*
+    Select the items (ground included) with the server id that are not already
+    selected. Returns nothing if there are no such items on the tile. Like
+    selectTopItem, the position is passed separately from the tile.
+  */
+  static std::optional<Change> selectItems(const Position &position, const Tile &tile, uint16_t serverId);
+
+  /*
+    A map-wide item replacement (see Map::replaceItems). The replacement has
+    already been applied, so the change must be added to an action that is
+    marked as committed.
+  */
+  static Change replaceItems(ItemReplacement &&replacement);
+
+  /*
+    A move of the selected items (see Map::moveSelection). Like an item
+    replacement, the move has already been applied.
+  */
+  static Change moveSelection(SelectionMove &&move);
+
   Change(const Change &other) = delete;
   Change &operator=(const Change &other) = delete;
 
@@ -158,7 +215,7 @@ public:
     If the change has been committed, this member contains the old data, i.e.
     the data necessary to undo the change.
   */
-  std::variant<std::monostate, TileData, RemovedTileData, SelectionData, FullSelectionData> data;
+  std::variant<std::monostate, TileData, RemovedTileData, SelectionData, FullSelectionData, ItemReplacementData, SelectionMoveData, TileEditData> data;
 
   template <typename T>
   bool ofType() const
@@ -166,13 +223,36 @@ public:
     return std::holds_alternative<T>(data);
   }
 
+  size_t getMemoryUsage() const;
+
+  /*
+    Add the positions of the tiles whose contents the change modifies (selection
+    changes modify none).
+  */
+  void addChangedPositions(PositionBitmap &positions) const;
+
 private:
+  friend class HistoryCodec;
   Change();
 };
 
+/*
+  The undo history. The most recent groups are kept as they are ("hot"). When
+  the hot groups use more memory than the budget, the oldest of them are
+  serialized (see HistoryCodec) and LZMA compressed in batches, optionally into a
+  page file. A batch is restored when undo reaches it.
+*/
 class EditorHistory
 {
 public:
+  // The number of most recent groups that are never compressed
+  static constexpr size_t HotGroupCount = 64;
+  // Fewer groups than this are not worth a compressed batch of their own
+  static constexpr size_t MinBatchGroupCount = 16;
+  static constexpr size_t DefaultMemoryBudget = 64 * 1024 * 1024;
+
+  EditorHistory(MapView &mapView);
+
   void commit(MapAction &&action);
   void undoLast();
 
@@ -182,11 +262,68 @@ public:
   bool hasCurrentGroup() const;
   bool currentGroupType(ActionGroupType groupType) const;
 
+  /*
+    Memory that the hot groups may use before the oldest of them are compressed.
+  */
+  void setMemoryBudget(size_t bytes);
+
+  /*
+    Store new compressed batches in a page file instead of in memory. Returns
+    false if the file can not be created.
+  */
+  bool usePageFile(const std::filesystem::path &path);
+
+  /*
+    Memory used by the hot groups and by the compressed batches that are kept in memory.
+  */
+  size_t getMemoryUsage() const;
+
 private:
+  struct HotGroup
+  {
+    MapActionGroup group;
+    size_t memoryUsage;
+  };
+
+  struct ColdBatch
+  {
+    uint32_t groupCount;
+    // Size of the serialized groups before compression
+    uint32_t size;
+    // The compressed data, unless it is stored in the page file
+    std::string data;
+    PageFile::Page page{};
+    bool inPageFile = false;
+  };
+
+  MapView &mapView;
+
   std::optional<MapActionGroup> currentGroup;
-  std::stack<MapActionGroup> actionGroups;
+  // Oldest first
+  std::deque<HotGroup> hotGroups;
+  // Oldest first. All of them are older than the hot groups.
+  std::vector<ColdBatch> coldBatches;
+
+  size_t hotMemoryUsage = 0;
+  size_t memoryBudget = DefaultMemoryBudget;
+
+  std::unique_ptr<PageFile> pageFile;
 
   MapAction *getLatestAction();
+
+  /*
+    Record the new contents of the changed tiles in the edit journal, if there is one.
+  */
+  void journal(const MapAction &action);
+  void journal(const MapActionGroup &group);
+
+  /*
+    Compress the oldest hot groups (but never the HotGroupCount most recent ones)
+    until the hot groups use at most half of the budget, so that each batch is
+    large enough to compress well. A batch has at least MinBatchGroupCount groups.
+  */
+  void compressOldGroups();
+  void decompressLastBatch();
 };
 
 inline std::ostream &operator<<(std::ostream &os, ActionGroupType type)
@@ -202,6 +339,12 @@ inline std::ostream &operator<<(std::ostream &os, ActionGroupType type)
   case ActionGroupType::RemoveMapItem:
     os << "ActionGroupType::RemoveMapItem";
     break;
+  case ActionGroupType::ReplaceItems:
+    os << "ActionGroupType::ReplaceItems";
+    break;
+  case ActionGroupType::MoveItems:
+    os << "ActionGroupType::MoveItems";
+    break;
   default:
     os << "Unknown ActionGroupType: " << to_underlying(type);
     break;
@@ -0,0 +1,410 @@
+#include "history_codec.h"
+
+#include "action.h"
+#include "../tile_codec.h"
+#include "../tile.h"
+#include "../debug.h"
+#include "../util.h"
+
+void HistoryCodec::write(BinaryWriter &writer, const MapActionGroup &group)
+{
+  writer.writeU8(static_cast<uint8_t>(to_underlying(group.groupType)));
+  writer.writeU32(static_cast<uint32_t>(group.actions.size()));
+
+  for (const MapAction &action : group.actions)
+  {
+    writer.writeU8(static_cast<uint8_t>(to_underlying(action.actionType)));
+    writer.writeU8(action.committed ? 1 : 0);
+    writer.writeU32(static_cast<uint32_t>(action.changes.size()));
+
+    for (const Change &change : action.changes)
+    {
+      writer.writeU8(static_cast<uint8_t>(change.data.index()));
+
+      std::visit(util::overloaded{
+                     [](const std::monostate &) {},
+                     [&writer](const Change::TileData &tile) {
+                       writeTile(writer, tile);
+                     },
+                     [&writer](const Change::RemovedTileData &removed) {
+                       if (std::holds_alternative<Tile>(removed.data))
+                       {
+                         writer.writeU8(1);
+                         writeTile(writer, std::get<Tile>(removed.data));
+                       }
+                       else
+                       {
+                         writer.writeU8(0);
+                         writePosition(writer, std::get<Position>(removed.data));
+                       }
+                     },
+                     [&writer](const Change::SelectionData &data) {
+                       writePosition(writer, data.position);
+                       writer.writeU16(static_cast<uint16_t>(data.indices.size()));
+                       for (uint16_t index : data.indices)
+                       {
+                         writer.writeU16(index);
+                       }
+                       writer.writeU8(data.includesGround ? 1 : 0);
+                       writer.writeU8(data.select ? 1 : 0);
+                     },
+                     [&writer](const Change::FullSelectionData &data) {
+                       writePositions(writer, data.positions);
+                       writer.writeU32(static_cast<uint32_t>(data.areas.size()));
+                       for (const SelectionArea &area : data.areas)
+                       {
+                         writePosition(writer, area.from);
+                         writePosition(writer, area.to);
+                       }
+                       writer.writeU8(data.isDeselect ? 1 : 0);
+                     },
+                     [&writer](const Change::ItemReplacementData &data) {
+                       writer.writeU32(static_cast<uint32_t>(data.tiles.size()));
+                       for (const ItemReplacement::TileChange &tile : data.tiles)
+                       {
+                         writePosition(writer, tile.position);
+                         writer.writeU32(tile.firstItem);
+                         writer.writeU16(tile.itemCount);
+                         writer.writeU16(tile.orderCount);
+                         writer.writeU32(tile.firstOrder);
+                       }
+
+                       writer.writeU32(static_cast<uint32_t>(data.items.size()));
+                       for (const ItemReplacement::ItemChange &item : data.items)
+                       {
+                         writer.writeU16(item.index);
+                         writer.writeU16(item.serverId);
+                       }
+
+                       writer.writeU32(static_cast<uint32_t>(data.order.size()));
+                       for (uint16_t index : data.order)
+                       {
+                         writer.writeU16(index);
+                       }
+                     },
+                     [&writer](const Change::SelectionMoveData &data) {
+                       writePosition(writer, data.delta);
+                       writePositions(writer, data.positions);
+                       writePositions(writer, data.wholeTiles);
+
+                       writer.writeU32(static_cast<uint32_t>(data.replaced.size()));
+                       for (const auto &[position, tile] : data.replaced)
+                       {
+                         writePosition(writer, position);
+                         writer.writeU8(tile ? 1 : 0);
+                         if (tile)
+                           writeTile(writer, *tile);
+                       }
+
+                       writer.writeU8(data.applied ? 1 : 0);
+                     },
+                     [&writer](const Change::TileEditData &edit) {
+                       writePosition(writer, edit.position);
+                       writer.writeU32(static_cast<uint32_t>(edit.steps.size()));
+                       for (const TileEdit::Step &step : edit.steps)
+                       {
+                         writer.writeU8(static_cast<uint8_t>(to_underlying(step.operation)));
+                         writer.writeU16(step.index);
+                         writer.writeU32(step.flags);
+                         writer.writeU8(step.item ? 1 : 0);
+                         if (step.item)
+                           writeItem(writer, *step.item);
+                       }
+                     }},
+                 change.data);
+    }
+  }
+}
+
+MapActionGroup HistoryCodec::read(BinaryReader &reader, MapView &mapView)
+{
+  MapActionGroup group(static_cast<ActionGroupType>(reader.readU8()));
+
+  uint32_t actionCount = reader.readU32();
+  for (uint32_t i = 0; i < actionCount && reader.ok(); ++i)
+  {
+    MapAction action(mapView, static_cast<MapActionType>(reader.readU8()));
+    if (reader.readU8() != 0)
+      action.markAsCommitted();
+
+    uint32_t changeCount = reader.readU32();
+    for (uint32_t j = 0; j < changeCount && reader.ok(); ++j)
+    {
+      Change change;
+      switch (reader.readU8())
+      {
+      case 0:
+        break;
+      case 1:
+        change.data = readTile(reader);
+        break;
+      case 2:
+      {
+        RemovedTile removed{Position{}};
+        if (reader.readU8() != 0)
+          removed.data = readTile(reader);
+        else
+          removed.data = readPosition(reader);
+
+        change.data = std::move(removed);
+        break;
+      }
+      case 3:
+      {
+        Change::SelectionData data{};
+        data.position = readPosition(reader);
+        uint16_t indexCount = reader.readU16();
+        for (uint16_t k = 0; k < indexCount && reader.ok(); ++k)
+        {
+          data.indices.emplace_back(reader.readU16());
+        }
+        data.includesGround = reader.readU8() != 0;
+        data.select = reader.readU8() != 0;
+
+        change.data = std::move(data);
+        break;
+      }
+      case 4:
+      {
+        Change::FullSelectionData data;
+        data.positions = readPositions(reader);
+        uint32_t areaCount = reader.readU32();
+        for (uint32_t k = 0; k < areaCount && reader.ok(); ++k)
+        {
+          Position from = readPosition(reader);
+          Position to = readPosition(reader);
+          data.areas.emplace_back(from, to);
+        }
+        data.isDeselect = reader.readU8() != 0;
+
+        change.data = std::move(data);
+        break;
+      }
+      case 5:
+      {
+        ItemReplacement data;
+        uint32_t tileCount = reader.readU32();
+        for (uint32_t k = 0; k < tileCount && reader.ok(); ++k)
+        {
+          ItemReplacement::TileChange tile{};
+          tile.position = readPosition(reader);
+          tile.firstItem = reader.readU32();
+          tile.itemCount = reader.readU16();
+          tile.orderCount = reader.readU16();
+          tile.firstOrder = reader.readU32();
+          data.tiles.emplace_back(tile);
+        }
+
+        uint32_t itemCount = reader.readU32();
+        for (uint32_t k = 0; k < itemCount && reader.ok(); ++k)
+        {
+          uint16_t index = reader.readU16();
+          uint16_t serverId = reader.readU16();
+          data.items.push_back({index, serverId});
+        }
+
+        uint32_t orderCount = reader.readU32();
+        for (uint32_t k = 0; k < orderCount && reader.ok(); ++k)
+        {
+          data.order.emplace_back(reader.readU16());
+        }
+
+        change.data = std::move(data);
+        break;
+      }
+      case 6:
+      {
+        SelectionMove data;
+        data.delta = readPosition(reader);
+        data.positions = readPositions(reader);
+        data.wholeTiles = readPositions(reader);
+
+        uint32_t replacedCount = reader.readU32();
+        for (uint32_t k = 0; k < replacedCount && reader.ok(); ++k)
+        {
+          Position position = readPosition(reader);
+          std::unique_ptr<Tile> tile;
+          if (reader.readU8() != 0)
+            tile = std::make_unique<Tile>(readTile(reader));
+
+          data.replaced.emplace_back(position, std::move(tile));
+        }
+        data.applied = reader.readU8() != 0;
+
+        change.data = std::move(data);
+        break;
+      }
+      case 7:
+      {
+        TileEdit edit(readPosition(reader));
+        uint32_t stepCount = reader.readU32();
+        for (uint32_t k = 0; k < stepCount && reader.ok(); ++k)
+        {
+          TileEdit::Step step{};
+          step.operation = static_cast<TileEdit::Operation>(reader.readU8());
+          step.index = reader.readU16();
+          step.flags = reader.readU32();
+          if (reader.readU8() != 0)
+            step.item = std::make_unique<Item>(readItem(reader));
+
+          edit.steps.emplace_back(std::move(step));
+        }
+
+        change.data = std::move(edit);
+        break;
+      }
+      default:
+        ABORT_PROGRAM("A compressed history group is corrupt.");
+      }
+
+      action.addChange(std::move(change));
+    }
+
+    group.addAction(std::move(action));
+  }
+
+  if (!reader.ok())
+  {
+    ABORT_PROGRAM("A compressed history group is corrupt.");
+  }
+
+  return group;
+}
+
+/*
+  Tile: position, tile (see TileCodec), u8 hasSelection, [u8 selected for the
+  ground (if any) and each item]
+*/
+void HistoryCodec::writeTile(BinaryWriter &writer, const Tile &tile)
+{
+  writePosition(writer, tile.position);
+  TileCodec::write(writer, tile);
+
+  writer.writeU8(tile.hasSelection() ? 1 : 0);
+  if (tile.hasSelection())
+  {
+    if (tile.ground)
+      writer.writeU8(tile.ground->selected ? 1 : 0);
+
+    for (const Item &item : tile.items)
+    {
+      writer.writeU8(item.selected ? 1 : 0);
+    }
+  }
+}
+
+Tile HistoryCodec::readTile(BinaryReader &reader)
+{
+  Position position = readPosition(reader);
+  std::optional<TileCodec::TileData> data = TileCodec::read(reader);
+  if (!data)
+  {
+    ABORT_PROGRAM("A compressed history group is corrupt.");
+  }
+
+  Tile tile = TileCodec::createTile(position, data.value());
+
+  if (reader.readU8() != 0)
+  {
+    if (tile.ground && reader.readU8() != 0)
+      tile.selectGround();
+
+    for (size_t i = 0; i < tile.items.size(); ++i)
+    {
+      if (reader.readU8() != 0)
+        tile.selectItemAtIndex(i);
+    }
+  }
+
+  return tile;
+}
+
+/*
+  Item: item (see TileCodec), u8 selected
+*/
+void HistoryCodec::writeItem(BinaryWriter &writer, const Item &item)
+{
+  TileCodec::writeItem(writer, item);
+  writer.writeU8(item.selected ? 1 : 0);
+}
+
+Item HistoryCodec::readItem(BinaryReader &reader)
+{
+  std::optional<TileCodec::ItemData> data = TileCodec::readItem(reader);
+  if (!data)
+  {
+    ABORT_PROGRAM("A compressed history group is corrupt.");
+  }
+
+  Item item = TileCodec::createItem(data.value());
+  item.selected = reader.readU8() != 0;
+
+  return item;
+}
+
+/*
+  Position: u32 x, u32 y, u8 z. Deltas can be negative, so x and y are stored
+  as two's complement.
+*/
+void HistoryCodec::writePosition(BinaryWriter &writer, const Position &position)
+{
+  writer.writeU32(static_cast<uint32_t>(position.x));
+  writer.writeU32(static_cast<uint32_t>(position.y));
+  writer.writeU8(static_cast<uint8_t>(position.z));
+}
+
+Position HistoryCodec::readPosition(BinaryReader &reader)
+{
+  Position position;
+  position.x = static_cast<int32_t>(reader.readU32());
+  position.y = static_cast<int32_t>(reader.readU32());
+  position.z = static_cast<int8_t>(reader.readU8());
+
+  return position;
+}
+
+/*
+  Positions: u32 chunk count, chunks
+  Chunk: u32 chunk key, u16 floor mask, u16 tile mask per floor in the floor mask
+*/
+void HistoryCodec::writePositions(BinaryWriter &writer, const PositionBitmap &positions)
+{
+  writer.writeU32(static_cast<uint32_t>(positions.getChunks().size()));
+  for (const auto &[key, chunk] : positions.getChunks())
+  {
+    writer.writeU32(key);
+
+    uint16_t floorMask = 0;
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (chunk.floors[z] != 0)
+        floorMask |= 1 << z;
+    }
+    writer.writeU16(floorMask);
+
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (chunk.floors[z] != 0)
+        writer.writeU16(chunk.floors[z]);
+    }
+  }
+}
+
+PositionBitmap HistoryCodec::readPositions(BinaryReader &reader)
+{
+  PositionBitmap positions;
+
+  uint32_t chunkCount = reader.readU32();
+  for (uint32_t i = 0; i < chunkCount && reader.ok(); ++i)
+  {
+    auto [x, y] = ChunkKey::position(reader.readU32());
+    uint16_t floorMask = reader.readU16();
+    for (int z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (floorMask & (1 << z))
+        positions.insertMask(x, y, z, reader.readU16());
+    }
+  }
+
+  return positions;
+}
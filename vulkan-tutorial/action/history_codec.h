@@ -0,0 +1,48 @@
+#pragma once
+
+#include "../position.h"
+
+class BinaryWriter;
+class BinaryReader;
+class MapActionGroup;
+class MapView;
+class PositionBitmap;
+class Tile;
+class Item;
+
+/*
+  Binary encoding of action groups, used for the compressed part of the editor
+  history (see EditorHistory). Unlike TileCodec, the selection state of the
+  items is stored. ECS entities are not stored; items with animations get new
+  entities when a group is read.
+
+  Group:
+    u8 group type, u32 action count, actions
+  Action:
+    u8 action type, u8 committed, u32 change count, changes
+  Change:
+    u8 variant index of Change::data, followed by the data of that alternative
+*/
+class HistoryCodec
+{
+public:
+  static void write(BinaryWriter &writer, const MapActionGroup &group);
+
+  /*
+    The data must have been written by write; malformed data aborts the program.
+  */
+  static MapActionGroup read(BinaryReader &reader, MapView &mapView);
+
+private:
+  static void writeTile(BinaryWriter &writer, const Tile &tile);
+  static Tile readTile(BinaryReader &reader);
+
+  static void writeItem(BinaryWriter &writer, const Item &item);
+  static Item readItem(BinaryReader &reader);
+
+  static void writePosition(BinaryWriter &writer, const Position &position);
+  static Position readPosition(BinaryReader &reader);
+
+  static void writePositions(BinaryWriter &writer, const PositionBitmap &positions);
+  static PositionBitmap readPositions(BinaryReader &reader);
+};
@@ -0,0 +1,346 @@
+#include "auto_border.h"
+
+#include <algorithm>
+#include <pugixml.hpp>
+
+#include "map.h"
+#include "position_bitmap.h"
+#include "tile.h"
+#include "item.h"
+#include "ecs/ecs.h"
+#include "ecs/item_animation.h"
+#include "graphics/appearances.h"
+#include "logger.h"
+#include "time.h"
+#include "util.h"
+
+namespace
+{
+  using Edge = AutoBorder::Edge;
+
+  // Bits of the mask of the neighbours of a tile
+  enum Neighbour : uint8_t
+  {
+    NorthWest = 1 << 0,
+    North = 1 << 1,
+    NorthEast = 1 << 2,
+    West = 1 << 3,
+    East = 1 << 4,
+    SouthWest = 1 << 5,
+    South = 1 << 6,
+    SouthEast = 1 << 7
+  };
+
+  constexpr std::pair<const char *, Edge> EdgeNames[] = {
+      {"n", Edge::North},
+      {"e", Edge::East},
+      {"s", Edge::South},
+      {"w", Edge::West},
+      {"cnw", Edge::NorthWestCorner},
+      {"cne", Edge::NorthEastCorner},
+      {"csw", Edge::SouthWestCorner},
+      {"cse", Edge::SouthEastCorner},
+      {"dnw", Edge::NorthWestDiagonal},
+      {"dne", Edge::NorthEastDiagonal},
+      {"dsw", Edge::SouthWestDiagonal},
+      {"dse", Edge::SouthEastDiagonal}};
+
+  /*
+    The edges of the border around a tile whose neighbours in the mask have the
+    ground. Two sides that meet make an inner corner, a side on its own is a
+    side, and a diagonal neighbour whose sides are both free makes an outer
+    corner.
+  */
+  std::vector<Edge> edgesForMask(uint8_t mask)
+  {
+    bool n = mask & North;
+    bool e = mask & East;
+    bool s = mask & South;
+    bool w = mask & West;
+
+    std::vector<Edge> edges;
+    if (n && w)
+      edges.emplace_back(Edge::NorthWestDiagonal);
+    if (n && e)
+      edges.emplace_back(Edge::NorthEastDiagonal);
+    if (s && w)
+      edges.emplace_back(Edge::SouthWestDiagonal);
+    if (s && e)
+      edges.emplace_back(Edge::SouthEastDiagonal);
+
+    if (n && !w && !e)
+      edges.emplace_back(Edge::North);
+    if (e && !n && !s)
+      edges.emplace_back(Edge::East);
+    if (s && !w && !e)
+      edges.emplace_back(Edge::South);
+    if (w && !n && !s)
+      edges.emplace_back(Edge::West);
+
+    if ((mask & NorthWest) && !n && !w)
+      edges.emplace_back(Edge::NorthWestCorner);
+    if ((mask & NorthEast) && !n && !e)
+      edges.emplace_back(Edge::NorthEastCorner);
+    if ((mask & SouthWest) && !s && !w)
+      edges.emplace_back(Edge::SouthWestCorner);
+    if ((mask & SouthEast) && !s && !e)
+      edges.emplace_back(Edge::SouthEastCorner);
+
+    return edges;
+  }
+
+  Item createBorderItem(uint16_t serverId)
+  {
+    Item item(serverId);
+
+    const SpriteInfo &spriteInfo = item.itemType->appearance->getSpriteInfo();
+    if (spriteInfo.hasAnimation())
+    {
+      ecs::EntityId entityId = item.assignNewEntityId();
+      g_ecs.addComponent(entityId, ItemAnimationComponent(spriteInfo.getAnimation()));
+    }
+
+    return item;
+  }
+
+  // A chunk and the tiles around it
+  constexpr int WindowSize = 6;
+
+  // PositionBitmap can not hold larger coordinates
+  constexpr int MaxCoordinate = UINT16_MAX;
+} // namespace
+
+void AutoBorder::addFamily(const std::string &name, const std::vector<uint16_t> &grounds, const BorderItems &borderItems)
+{
+  if (families.size() == UINT8_MAX)
+  {
+    Logger::error() << "Too many border families; \"" << name << "\" is ignored." << std::endl;
+    return;
+  }
+
+  Family &family = families.emplace_back();
+  family.name = name;
+  uint8_t familyId = static_cast<uint8_t>(families.size());
+
+  for (uint32_t mask = 0; mask < family.itemsByMask.size(); ++mask)
+  {
+    size_t count = 0;
+    for (Edge edge : edgesForMask(static_cast<uint8_t>(mask)))
+    {
+      uint16_t serverId = borderItems[static_cast<size_t>(edge)];
+      if (serverId != 0)
+        family.itemsByMask[mask][count++] = serverId;
+    }
+  }
+
+  auto setFamily = [familyId](std::vector<uint8_t> &table, uint16_t serverId) {
+    if (table.size() <= serverId)
+      table.resize(static_cast<size_t>(serverId) + 1, 0);
+    table[serverId] = familyId;
+  };
+
+  for (uint16_t ground : grounds)
+    setFamily(groundFamily, ground);
+
+  for (uint16_t serverId : borderItems)
+  {
+    if (serverId != 0)
+      setFamily(borderFamily, serverId);
+  }
+}
+
+bool AutoBorder::loadFromXml(const std::filesystem::path &path)
+{
+  TimePoint start;
+
+  pugi::xml_document doc;
+  pugi::xml_parse_result result = doc.load_file(path.c_str());
+  if (!result)
+  {
+    Logger::error() << "Could not load " << path.string() << ": " << result.description() << std::endl;
+    return false;
+  }
+
+  pugi::xml_node root = doc.child("borders");
+  if (!root)
+  {
+    Logger::error() << path.string() << ": invalid root node." << std::endl;
+    return false;
+  }
+
+  for (pugi::xml_node borderNode = root.child("border"); borderNode; borderNode = borderNode.next_sibling("border"))
+  {
+    std::string name = borderNode.attribute("name").as_string();
+    std::vector<uint16_t> grounds;
+    BorderItems borderItems{};
+
+    for (pugi::xml_node groundNode = borderNode.child("ground"); groundNode; groundNode = groundNode.next_sibling("ground"))
+    {
+      uint32_t fromId = groundNode.attribute("fromid").as_uint();
+      uint32_t toId = groundNode.attribute("toid").as_uint();
+      if (pugi::xml_attribute attribute = groundNode.attribute("id"))
+      {
+        fromId = toId = attribute.as_uint();
+      }
+
+      for (uint32_t id = fromId; id != 0 && id <= toId && id <= UINT16_MAX; ++id)
+        grounds.emplace_back(static_cast<uint16_t>(id));
+    }
+
+    for (pugi::xml_node itemNode = borderNode.child("item"); itemNode; itemNode = itemNode.next_sibling("item"))
+    {
+      std::string edgeName = as_lower_str(itemNode.attribute("edge").as_string());
+      auto edge = std::find_if(std::begin(EdgeNames), std::end(EdgeNames), [&edgeName](const auto &entry) { return edgeName == entry.first; });
+      if (edge == std::end(EdgeNames))
+      {
+        Logger::error() << path.string() << ": unknown edge \"" << edgeName << "\" in border \"" << name << "\"." << std::endl;
+        continue;
+      }
+
+      borderItems[static_cast<size_t>(edge->second)] = static_cast<uint16_t>(itemNode.attribute("id").as_uint());
+    }
+
+    addFamily(name, grounds, borderItems);
+  }
+
+  Logger::info() << "Loaded " << families.size() << " border families in " << start.elapsedMillis() << " ms." << std::endl;
+  return true;
+}
+
+uint8_t AutoBorder::familyOfGround(uint16_t serverId) const
+{
+  return serverId < groundFamily.size() ? groundFamily[serverId] : 0;
+}
+
+bool AutoBorder::isFamilyBorder(uint16_t serverId) const
+{
+  return serverId < borderFamily.size() && borderFamily[serverId] != 0;
+}
+
+std::vector<TileEdit> AutoBorder::update(const Map &map, const PositionBitmap &changed) const
+{
+  std::vector<TileEdit> edits;
+  if (families.empty())
+    return edits;
+
+  // The borders of a tile depend on its neighbours, so the tiles around the changed chunks are included
+  PositionBitmap affected;
+  for (const auto &[key, chunk] : changed.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    for (int z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (chunk.floors[z] != 0)
+        affected.insertRectangle(Position{std::max(x - 1, 0), std::max(y - 1, 0), z}, Position{std::min(x + 4, MaxCoordinate), std::min(y + 4, MaxCoordinate), z});
+    }
+  }
+
+  // The tiles of the chunk being updated and of the tiles around it, and the families of their grounds
+  std::array<const Tile *, WindowSize * WindowSize> tiles;
+  std::array<uint8_t, WindowSize * WindowSize> tileFamilies;
+  // Stack indices of the border items of the families on a tile
+  std::vector<size_t> currentIndices;
+
+  for (const auto &[key, chunk] : affected.getChunks())
+  {
+    auto [chunkX, chunkY] = ChunkKey::position(key);
+    for (int z = 0; z < MAP_LAYERS; ++z)
+    {
+      uint16_t mask = chunk.floors[z];
+      if (mask == 0)
+        continue;
+
+      for (int dy = -1; dy < WindowSize - 1; ++dy)
+      {
+        for (int dx = -1; dx < WindowSize - 1; ++dx)
+        {
+          int x = chunkX + dx;
+          int y = chunkY + dy;
+          const Tile *tile = x >= 0 && y >= 0 ? map.getTile(Position{x, y, z}) : nullptr;
+          const Item *ground = tile ? tile->getGround() : nullptr;
+
+          size_t index = (dy + 1) * WindowSize + (dx + 1);
+          tiles[index] = tile;
+          tileFamilies[index] = ground ? familyOfGround(static_cast<uint16_t>(ground->getId())) : 0;
+        }
+      }
+
+      for (int bit = 0; bit < MAP_TREE_CHILDREN_COUNT; ++bit)
+      {
+        if (!(mask & (1 << bit)))
+          continue;
+
+        // Position of the tile in the window (see PositionBitmap::Chunk for the bits)
+        int wx = (bit >> 2) + 1;
+        int wy = (bit & 3) + 1;
+
+        const Tile *tile = tiles[wy * WindowSize + wx];
+        if (!tile || !tile->getGround())
+          continue;
+
+        auto familyAt = [&tileFamilies, wx, wy](int dx, int dy) { return tileFamilies[(wy + dy) * WindowSize + (wx + dx)]; };
+        std::array<uint8_t, 8> neighbours = {
+            familyAt(-1, -1), familyAt(0, -1), familyAt(1, -1),
+            familyAt(-1, 0), familyAt(1, 0),
+            familyAt(-1, 1), familyAt(0, 1), familyAt(1, 1)};
+
+        uint8_t ownFamily = familyAt(0, 0);
+
+        // The families that border the tile, in the order of their borders
+        std::array<uint8_t, 8> borderingFamilies = neighbours;
+        std::sort(borderingFamilies.begin(), borderingFamilies.end());
+        auto borderingEnd = std::unique(borderingFamilies.begin(), borderingFamilies.end());
+
+        std::array<uint16_t, 8 * MaxBordersPerFamily> borders;
+        size_t borderCount = 0;
+        for (auto it = borderingFamilies.begin(); it != borderingEnd; ++it)
+        {
+          uint8_t family = *it;
+          if (family <= ownFamily)
+            continue;
+
+          uint8_t neighbourMask = 0;
+          for (size_t i = 0; i < neighbours.size(); ++i)
+          {
+            if (neighbours[i] == family)
+              neighbourMask |= 1 << i;
+          }
+
+          for (uint16_t serverId : families[family - 1].itemsByMask[neighbourMask])
+          {
+            if (serverId == 0)
+              break;
+            borders[borderCount++] = serverId;
+          }
+        }
+
+        bool unchanged = true;
+        currentIndices.clear();
+        const std::vector<Item> &items = tile->getItems();
+        for (size_t i = 0; i < items.size(); ++i)
+        {
+          uint16_t serverId = static_cast<uint16_t>(items[i].getId());
+          if (!isFamilyBorder(serverId))
+            continue;
+
+          size_t current = currentIndices.size();
+          unchanged = unchanged && current < borderCount && borders[current] == serverId;
+          currentIndices.emplace_back(i);
+        }
+
+        if (unchanged && currentIndices.size() == borderCount)
+          continue;
+
+        TileEdit &edit = edits.emplace_back(Position{chunkX + wx - 1, chunkY + wy - 1, z});
+        // Remove from the top, so that the indices of the remaining items stay the same
+        for (auto it = currentIndices.rbegin(); it != currentIndices.rend(); ++it)
+          edit.removeItem(*it);
+
+        for (size_t i = 0; i < borderCount; ++i)
+          edit.insertItem(i, createBorderItem(borders[i]));
+      }
+    }
+  }
+
+  return edits;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <filesystem>
+#include <string>
+#include <vector>
+
+#include "tile_edit.h"
+
+class Map;
+class PositionBitmap;
+
+/*
+	Places ground borders automatically. A border family is a set of grounds
+	(for example the grass grounds) together with the border items that go on the
+	tiles around them. A tile gets the borders of each family that its 8
+	neighbours have a ground of, unless its own ground is of that family or of a
+	later one: families border over the families registered before them, and
+	those borders are below theirs in the stack.
+
+	For each family, a lookup table from the mask of the neighbours that have its
+	ground to the border items is built when the family is added, so updating a
+	tile is a table lookup per family around it. Only tiles with a ground get
+	borders, and only the border items of a family are touched; border items that
+	no family knows of stay where they are.
+
+	Borders file (see loadFromXml):
+		<borders>
+			<border name="grass">
+				<ground id="4526"/>
+				<ground fromid="4527" toid="4541"/>
+				<item edge="n" id="4542"/>
+				...
+			</border>
+		</borders>
+	Edges: n, e, s, w (a side), cnw, cne, csw, cse (an outer corner: only the
+	diagonal neighbour has the ground) and dnw, dne, dsw, dse (an inner corner:
+	both sides have the ground).
+*/
+class AutoBorder
+{
+public:
+	enum class Edge : uint8_t
+	{
+		North,
+		East,
+		South,
+		West,
+		NorthWestCorner,
+		NorthEastCorner,
+		SouthWestCorner,
+		SouthEastCorner,
+		NorthWestDiagonal,
+		NorthEastDiagonal,
+		SouthWestDiagonal,
+		SouthEastDiagonal,
+		Count
+	};
+
+	static constexpr size_t EdgeCount = static_cast<size_t>(Edge::Count);
+	// A mask of the neighbours gives at most this many border items per family
+	static constexpr size_t MaxBordersPerFamily = 4;
+
+	/*
+		Border items by edge; an id of 0 means that the family has no item for the edge.
+	*/
+	using BorderItems = std::array<uint16_t, EdgeCount>;
+
+	void addFamily(const std::string &name, const std::vector<uint16_t> &grounds, const BorderItems &borderItems);
+
+	/*
+		Add the families of a borders file. Returns false if the file can not be read.
+	*/
+	bool loadFromXml(const std::filesystem::path &path);
+
+	bool empty() const
+	{
+		return families.empty();
+	}
+
+	/*
+		The edits that bring the borders of the tiles around the changed positions
+		up to date with the grounds of their neighbours. The tiles are processed a
+		chunk at a time. Tiles that already have the right borders get no edit.
+	*/
+	std::vector<TileEdit> update(const Map &map, const PositionBitmap &changed) const;
+
+private:
+	struct Family
+	{
+		std::string name;
+		// Border items by the mask of the neighbours that have a ground of the family (bottom first, 0 terminated)
+		std::array<std::array<uint16_t, MaxBordersPerFamily>, 256> itemsByMask{};
+	};
+
+	std::vector<Family> families;
+
+	// Family index + 1 by server id, 0 for items of no family
+	std::vector<uint8_t> groundFamily;
+	std::vector<uint8_t> borderFamily;
+
+	uint8_t familyOfGround(uint16_t serverId) const;
+	bool isFamilyBorder(uint16_t serverId) const;
+};
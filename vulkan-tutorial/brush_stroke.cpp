@@ -0,0 +1,196 @@
+#include "brush_stroke.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <random>
+
+#include "util.h"
+
+namespace
+{
+  // PositionBitmap can not hold larger coordinates, and no map is larger
+  constexpr long MaxCoordinate = UINT16_MAX;
+
+  // The tiles (x, y) of a chunk where x + y is even. The corner of a chunk is always even.
+  constexpr uint16_t CheckerboardMask = 0xA5A5;
+
+  /*
+    Half of the width of row dy of a circle with the radius. A tile is in the
+    circle if its center is closer than radius + 0.5 to the center of the circle
+    (with a small margin, so that a radius of 1 is a cross rather than a square).
+  */
+  int circleHalfWidth(int radius, int dy)
+  {
+    int squared = radius * radius + radius - 1 - dy * dy;
+    if (squared < 0)
+      return 0;
+
+    int halfWidth = static_cast<int>(std::sqrt(static_cast<double>(squared)));
+    while (halfWidth * halfWidth > squared)
+      --halfWidth;
+    while ((halfWidth + 1) * (halfWidth + 1) <= squared)
+      ++halfWidth;
+
+    return halfWidth;
+  }
+} // namespace
+
+BrushStroke::BrushStroke(const Position &start, const BrushSettings &settings)
+    : settings(settings), seed(std::random_device{}()), last(start)
+{
+  int radius = std::max(settings.radius, 0);
+  this->settings.radius = radius;
+
+  rowHalfWidths.reserve(2 * static_cast<size_t>(radius) + 1);
+  for (int dy = -radius; dy <= radius; ++dy)
+  {
+    if (settings.shape == BrushShape::Circle && radius > 0)
+      rowHalfWidths.emplace_back(circleHalfWidth(radius, dy));
+    else
+      rowHalfWidths.emplace_back(radius);
+  }
+
+  paint({start});
+}
+
+void BrushStroke::addSample(const Position &position)
+{
+  if (position == last)
+    return;
+
+  if (position.z != last.z)
+  {
+    paint({position});
+  }
+  else
+  {
+    std::vector<Position> centers;
+    forEachLinePosition(last, position, [&centers](const Position &pos) { centers.emplace_back(pos); });
+    paint(centers);
+  }
+
+  last = position;
+}
+
+void BrushStroke::paint(const std::vector<Position> &centers)
+{
+  int radius = settings.radius;
+  int z = centers.front().z;
+
+  long minY = LONG_MAX;
+  long maxY = LONG_MIN;
+  for (const Position &center : centers)
+  {
+    minY = std::min(minY, center.y);
+    maxY = std::max(maxY, center.y);
+  }
+
+  /*
+    The footprint swept along a line is convex, so each row of it is a single
+    span: the union of the rows of the footprint at each center.
+  */
+  long top = minY - radius;
+  std::vector<std::pair<long, long>> spans(static_cast<size_t>(maxY + radius - top + 1), {LONG_MAX, LONG_MIN});
+  for (const Position &center : centers)
+  {
+    for (int dy = -radius; dy <= radius; ++dy)
+    {
+      auto &span = spans[center.y + dy - top];
+      int halfWidth = rowHalfWidths[dy + radius];
+      span.first = std::min(span.first, center.x - halfWidth);
+      span.second = std::max(span.second, center.x + halfWidth);
+    }
+  }
+
+  PositionBitmap footprint;
+  for (size_t i = 0; i < spans.size(); ++i)
+  {
+    // The cursor can be outside of the map
+    long y = top + static_cast<long>(i);
+    long x1 = std::max(spans[i].first, 0L);
+    long x2 = std::min(spans[i].second, MaxCoordinate);
+    if (y < 0 || y > MaxCoordinate || x1 > x2)
+      continue;
+
+    footprint.insertRectangle(Position{x1, y, z}, Position{x2, y, z});
+  }
+
+  if (settings.pattern != BrushPattern::Solid)
+  {
+    footprint = applyPattern(footprint);
+  }
+
+  footprint.erase(painted);
+  painted.insert(footprint);
+  pending.insert(footprint);
+}
+
+PositionBitmap BrushStroke::applyPattern(const PositionBitmap &footprint) const
+{
+  // Out of 16
+  uint64_t threshold = static_cast<uint64_t>(std::clamp(std::lround(settings.density * 16), 0L, 16L));
+
+  PositionBitmap result;
+  for (const auto &[key, chunk] : footprint.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    for (int z = 0; z < MAP_LAYERS; ++z)
+    {
+      uint16_t mask = chunk.floors[z];
+      if (mask == 0)
+        continue;
+
+      if (settings.pattern == BrushPattern::Checkerboard)
+      {
+        mask &= CheckerboardMask;
+      }
+      else
+      {
+        // 4 random bits for each tile of the chunk
+        uint64_t hash = seed;
+        util::combineHash64(hash, key);
+        util::combineHash64(hash, static_cast<uint64_t>(z));
+
+        uint16_t scatterMask = 0;
+        for (int i = 0; i < 16; ++i)
+        {
+          if (((hash >> (i * 4)) & 15) < threshold)
+            scatterMask |= 1 << i;
+        }
+        mask &= scatterMask;
+      }
+
+      if (mask != 0)
+        result.insertMask(x, y, z, mask);
+    }
+  }
+
+  return result;
+}
+
+PositionBitmap BrushStroke::takePending(size_t maxCount)
+{
+  PositionBitmap result;
+  if (pending.size() <= maxCount)
+  {
+    result = std::move(pending);
+    return result;
+  }
+
+  for (const auto &[key, chunk] : pending.getChunks())
+  {
+    if (result.size() >= maxCount)
+      break;
+
+    auto [x, y] = ChunkKey::position(key);
+    for (int z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (chunk.floors[z] != 0)
+        result.insertMask(x, y, z, chunk.floors[z]);
+    }
+  }
+
+  pending.erase(result);
+  return result;
+}
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "position.h"
+#include "position_bitmap.h"
+
+enum class BrushShape
+{
+	Square,
+	Circle
+};
+
+/*
+	Which tiles of the footprint of the brush are painted.
+*/
+enum class BrushPattern
+{
+	Solid,
+	// Every other tile, as on a chess board
+	Checkerboard,
+	// A random part of the tiles (see BrushSettings::density)
+	Scatter
+};
+
+struct BrushSettings
+{
+	BrushShape shape = BrushShape::Square;
+	// A radius of 0 paints a single tile
+	int radius = 0;
+
+	BrushPattern pattern = BrushPattern::Solid;
+	// The part of the tiles that a Scatter pattern paints, in steps of 1/16
+	float density = 0.5f;
+};
+
+/*
+	The tiles of one brush stroke. The cursor is only sampled once per frame, so
+	a fast stroke can move several tiles between two samples; the footprint of
+	the brush is swept along a line (Bresenham) between them. Each tile is
+	painted at most once per stroke.
+
+	The footprint is rasterized into chunk masks (see PositionBitmap), and the
+	pattern and the tiles already painted are removed a whole mask at a time, so
+	the cost of a sample depends on the number of chunks it covers rather than on
+	the number of tiles.
+
+	The tiles are collected until they are taken (see takePending), so that the
+	tiles of a frame can be painted as one change.
+*/
+class BrushStroke
+{
+public:
+	BrushStroke(const Position &start, const BrushSettings &settings = {});
+
+	/*
+		Continue the stroke to the position. Samples on another floor than the
+		previous one are not connected to it.
+	*/
+	void addSample(const Position &position);
+
+	/*
+		At most (about) maxCount of the tiles that have been added to the stroke
+		and not yet taken, a whole chunk at a time. A large brush can cover more
+		tiles in a frame than can be painted without a visible stall, so the rest
+		is left for the next frames.
+	*/
+	PositionBitmap takePending(size_t maxCount = SIZE_MAX);
+
+	bool hasPending() const
+	{
+		return !pending.empty();
+	}
+
+	/*
+		Call f for each position on the line from 'from' to 'to' (both included),
+		on the floor of 'from'.
+	*/
+	template <typename F>
+	static void forEachLinePosition(const Position &from, const Position &to, F f);
+
+private:
+	BrushSettings settings;
+	// Seed of the Scatter pattern, so that the pattern is fixed within a stroke
+	uint64_t seed;
+	// Half of the width of each row of the footprint, from the top row to the bottom row
+	std::vector<int> rowHalfWidths;
+
+	Position last;
+	PositionBitmap painted;
+	PositionBitmap pending;
+
+	/*
+		Paint the footprint of the brush at each of the centers, which must be on
+		the same floor and form a line.
+	*/
+	void paint(const std::vector<Position> &centers);
+
+	/*
+		The positions of the footprint that the pattern paints.
+	*/
+	PositionBitmap applyPattern(const PositionBitmap &footprint) const;
+};
+
+template <typename F>
+inline void BrushStroke::forEachLinePosition(const Position &from, const Position &to, F f)
+{
+	long dx = labs(to.x - from.x);
+	long dy = -labs(to.y - from.y);
+	int stepX = from.x < to.x ? 1 : -1;
+	int stepY = from.y < to.y ? 1 : -1;
+	long error = dx + dy;
+
+	Position pos = from;
+	while (true)
+	{
+		f(pos);
+		if (pos.x == to.x && pos.y == to.y)
+			break;
+
+		long doubleError = 2 * error;
+		if (doubleError >= dy)
+		{
+			error += dy;
+			pos.x += stepX;
+		}
+		if (doubleError <= dx)
+		{
+			error += dx;
+			pos.y += stepY;
+		}
+	}
+}
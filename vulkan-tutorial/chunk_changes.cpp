@@ -0,0 +1,56 @@
+#include "chunk_changes.h"
+
+#include <algorithm>
+
+#include "position.h"
+
+ChunkChangeBus::SubscriptionId ChunkChangeBus::subscribe(Callback callback)
+{
+  SubscriptionId id = nextId++;
+  subscribers.emplace_back(id, std::move(callback));
+  return id;
+}
+
+void ChunkChangeBus::unsubscribe(SubscriptionId id)
+{
+  subscribers.erase(
+      std::remove_if(subscribers.begin(), subscribers.end(), [id](const auto &subscriber) { return subscriber.first == id; }),
+      subscribers.end());
+}
+
+void ChunkChangeBus::markChanged(int x, int y)
+{
+  if (pending.all)
+    return;
+
+  uint32_t key = ChunkKey::of(x, y);
+  if (pendingKeys.emplace(key).second)
+  {
+    pending.chunks.emplace_back(x & ~3, y & ~3);
+  }
+}
+
+void ChunkChangeBus::markAllChanged()
+{
+  pending.chunks.clear();
+  pendingKeys.clear();
+  pending.all = true;
+}
+
+void ChunkChangeBus::deliver()
+{
+  if (pending.empty())
+    return;
+
+  // A subscriber can edit the map, which starts the next batch
+  ChunkChanges changes = std::move(pending);
+  pending = ChunkChanges{};
+  pendingKeys.clear();
+
+  // Subscribers may (un)subscribe from their callbacks
+  auto current = subscribers;
+  for (const auto &[id, callback] : current)
+  {
+    callback(changes);
+  }
+}
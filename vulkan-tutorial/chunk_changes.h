@@ -0,0 +1,61 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/*
+	The chunks that changed between two deliveries (see ChunkChangeBus).
+*/
+struct ChunkChanges
+{
+	// Position of the top-left tile of each changed chunk, without duplicates
+	std::vector<std::pair<int, int>> chunks;
+	// True if any chunk may have changed (e.g. the map was cleared). 'chunks' is then empty.
+	bool all = false;
+
+	bool empty() const
+	{
+		return chunks.empty() && !all;
+	}
+};
+
+/*
+	Lets derived data (caches, indexes, vertex buffers, save state) react to map
+	edits without recomputing everything. The map reports every modified chunk
+	(see Map::markDirty); the changes are collected and delivered to the
+	subscribers in one batch, once per frame (see Engine::nextFrame). However many
+	tiles of a chunk are modified in between, the chunk is reported once.
+*/
+class ChunkChangeBus
+{
+public:
+	using Callback = std::function<void(const ChunkChanges &changes)>;
+	using SubscriptionId = uint32_t;
+
+	SubscriptionId subscribe(Callback callback);
+	void unsubscribe(SubscriptionId id);
+
+	void markChanged(int x, int y);
+	void markAllChanged();
+
+	/*
+		Pass the changes since the previous delivery to the subscribers. Does nothing
+		if there are no changes.
+	*/
+	void deliver();
+
+	bool hasChanges() const
+	{
+		return !pending.empty();
+	}
+
+private:
+	ChunkChanges pending;
+	std::unordered_set<uint32_t> pendingKeys;
+
+	std::vector<std::pair<SubscriptionId, Callback>> subscribers;
+	SubscriptionId nextId = 1;
+};
@@ -0,0 +1,48 @@
+#include "chunk_summary.h"
+
+#include <algorithm>
+
+#include "tile.h"
+#include "item.h"
+#include "graphics/appearances.h"
+
+void ChunkSummary::addTile(const Tile &tile)
+{
+  mapFlags |= tile.getMapFlags();
+  statFlags |= tile.getStatFlags();
+
+  auto addItem = [this](const Item &item) {
+    const SpriteInfo &spriteInfo = item.itemType->appearance->getSpriteInfo();
+    hasAnimations |= spriteInfo.hasAnimation();
+    hasLargeSprites |= spriteInfo.boundingSquare > 32;
+  };
+
+  uint32_t stackHeight = static_cast<uint32_t>(tile.getItemCount());
+  if (const Item *ground = tile.getGround())
+  {
+    addItem(*ground);
+    ++stackHeight;
+  }
+
+  for (const Item &item : tile.getItems())
+  {
+    addItem(item);
+  }
+
+  ++tileCount;
+  itemCount += stackHeight;
+  maxStackHeight = static_cast<uint16_t>(std::max<uint32_t>(maxStackHeight, stackHeight));
+  maxElevation = static_cast<uint16_t>(std::max(static_cast<int>(maxElevation), tile.getTopElevation()));
+}
+
+void ChunkSummary::add(const ChunkSummary &other)
+{
+  mapFlags |= other.mapFlags;
+  statFlags |= other.statFlags;
+  maxStackHeight = std::max(maxStackHeight, other.maxStackHeight);
+  maxElevation = std::max(maxElevation, other.maxElevation);
+  tileCount += other.tileCount;
+  itemCount += other.itemCount;
+  hasAnimations |= other.hasAnimations;
+  hasLargeSprites |= other.hasLargeSprites;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdint.h>
+
+class Tile;
+
+/*
+	Aggregate facts about the tiles of a chunk (or of a whole subtree), so that
+	code that walks the map can skip or specialize its work per chunk instead of
+	looking at every item. See quadtree::Node::getSummary.
+*/
+struct ChunkSummary
+{
+	// OR of the flags of the tiles
+	uint16_t mapFlags = 0;
+	uint16_t statFlags = 0;
+	// Most items on a single tile (ground included)
+	uint16_t maxStackHeight = 0;
+	// Highest elevation of a tile (see Tile::getTopElevation)
+	uint16_t maxElevation = 0;
+	uint32_t tileCount = 0;
+	// Items, ground included
+	uint32_t itemCount = 0;
+	bool hasAnimations = false;
+	// Items with sprites larger than 32x32, which are drawn outside of their tile
+	bool hasLargeSprites = false;
+
+	void addTile(const Tile &tile);
+	void add(const ChunkSummary &other);
+};
@@ -0,0 +1,305 @@
+#include "compressed_chunks.h"
+
+#include "quad_tree.h"
+#include "tile.h"
+#include "tile_codec.h"
+#include "tile_pool.h"
+#include "debug.h"
+#include "graphics/compression.h"
+
+namespace
+{
+  // Chunks are cold, so favour speed. The groups are far smaller than the dictionary anyway.
+  constexpr int CompressionLevel = 0;
+
+  /*
+    Leaf: u16 floor mask, floors
+    Floor: u16 tile mask, u16 shared mask, tiles (see TileCodec)
+  */
+  void writeLeaf(BinaryWriter &writer, const quadtree::Node &leaf)
+  {
+    uint16_t floorMask = 0;
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (leaf.getFloor(z))
+        floorMask |= 1 << z;
+    }
+    writer.writeU16(floorMask);
+
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      Floor *floor = leaf.getFloor(z);
+      if (!floor)
+        continue;
+
+      uint16_t tileMask = 0;
+      uint16_t sharedMask = 0;
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const TileLocation &location = floor->getTileLocation(i);
+        if (location.hasTile())
+          tileMask |= 1 << i;
+        if (location.isShared())
+          sharedMask |= 1 << i;
+      }
+      writer.writeU16(tileMask);
+      writer.writeU16(sharedMask);
+
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const Tile *tile = floor->getTileLocation(i).getTile();
+        if (tile)
+          TileCodec::write(writer, *tile);
+      }
+    }
+  }
+
+  void readLeaf(BinaryReader &reader, quadtree::Node &leaf, TilePool &tilePool)
+  {
+    uint16_t floorMask = reader.readU16();
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      if (!(floorMask & (1 << z)))
+        continue;
+
+      Floor &floor = leaf.getOrCreateFloor(leaf.getX(), leaf.getY(), z);
+      uint16_t tileMask = reader.readU16();
+      uint16_t sharedMask = reader.readU16();
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        if (!(tileMask & (1 << i)))
+          continue;
+
+        std::optional<TileCodec::TileData> data = TileCodec::read(reader);
+        if (!data)
+        {
+          ABORT_PROGRAM("A compressed chunk is corrupt.");
+        }
+
+        TileLocation &location = floor.getTileLocation(i);
+        std::unique_ptr<Tile> tile = TileCodec::createTile(location, data.value());
+
+        // Tiles that were shared before the compression are shared again, so that compressing does not undo Map::shareIdenticalTiles
+        if ((sharedMask & (1 << i)) && TilePool::canShare(*tile))
+          location.setSharedTile(tilePool.intern(*tile));
+        else
+          location.setTile(std::move(tile));
+      }
+    }
+  }
+} // namespace
+
+bool CompressedChunks::canCompress(const quadtree::Node &leaf)
+{
+  if (leaf.isEmpty())
+    return false;
+
+  for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+  {
+    Floor *floor = leaf.getFloor(z);
+    if (!floor)
+      continue;
+
+    for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+    {
+      const Tile *tile = floor->getTileLocation(i).getTile();
+      if (tile && tile->hasSelection())
+        return false;
+    }
+  }
+
+  return true;
+}
+
+bool CompressedChunks::usePageFile(const std::filesystem::path &path)
+{
+  auto file = std::make_unique<PageFile>();
+  if (!file->open(path))
+    return false;
+
+  pageFile = std::move(file);
+  return true;
+}
+
+void CompressedChunks::compress(const std::vector<quadtree::Node *> &leaves)
+{
+  if (leaves.empty())
+    return;
+
+  BinaryWriter writer;
+  for (quadtree::Node *leaf : leaves)
+  {
+    DEBUG_ASSERT(canCompress(*leaf), "The leaf can not be compressed.");
+    DEBUG_ASSERT(!hasGroup(*leaf), "The leaf is already part of a group.");
+    writeLeaf(writer, *leaf);
+  }
+
+  uint32_t id = nextGroupId++;
+  Group &group = groups[id];
+  group.leaves = leaves;
+  group.size = static_cast<uint32_t>(writer.data.size());
+
+  std::string data = LZMA::compress(std::string(writer.data.begin(), writer.data.end()), CompressionLevel);
+  if (pageFile)
+  {
+    group.page = pageFile->write(data);
+    group.inPageFile = true;
+  }
+  else
+  {
+    group.data = std::move(data);
+  }
+
+  group.hashes.reserve(leaves.size());
+  for (quadtree::Node *leaf : leaves)
+  {
+    // The content does not change, so the hash is computed now and kept while compressed
+    group.hashes.emplace_back(leaf->getHash());
+    releaseFloors(*leaf);
+    groupOf.emplace(leaf, id);
+  }
+
+  compressedLeaves += leaves.size();
+}
+
+void CompressedChunks::decompress(quadtree::Node &leaf, TilePool &tilePool)
+{
+  auto found = groupOf.find(&leaf);
+  DEBUG_ASSERT(found != groupOf.end(), "The leaf is not compressed.");
+
+  Group &group = groups.at(found->second);
+  DEBUG_ASSERT(!group.decompressed, "The group is already decompressed.");
+
+  std::string data = LZMA::decompress(group.inPageFile ? pageFile->read(group.page) : group.data, group.size);
+  std::vector<uint8_t> bytes(data.begin(), data.end());
+  BinaryReader reader(bytes);
+
+  for (quadtree::Node *groupLeaf : group.leaves)
+  {
+    groupLeaf->compressed = false;
+    readLeaf(reader, *groupLeaf, tilePool);
+  }
+
+  DEBUG_ASSERT(reader.ok() && reader.atEnd(), "A compressed chunk is corrupt.");
+
+  group.decompressed = true;
+  compressedLeaves -= group.leaves.size();
+}
+
+bool CompressedChunks::hasGroup(const quadtree::Node &leaf) const
+{
+  return groupOf.find(&leaf) != groupOf.end();
+}
+
+size_t CompressedChunks::evict(const quadtree::Node &leaf, const std::function<bool(const quadtree::Node &)> &isInactive)
+{
+  auto found = groupOf.find(&leaf);
+  if (found == groupOf.end())
+    return 0;
+
+  auto groupIt = groups.find(found->second);
+  Group &group = groupIt->second;
+  DEBUG_ASSERT(group.decompressed, "The group is already compressed.");
+
+  for (size_t i = 0; i < group.leaves.size(); ++i)
+  {
+    if (group.leaves[i]->getHash() != group.hashes[i])
+    {
+      erase(groupIt);
+      return 0;
+    }
+  }
+
+  for (const quadtree::Node *groupLeaf : group.leaves)
+  {
+    if (!isInactive(*groupLeaf))
+      return 0;
+  }
+
+  // The stored data is still up to date, so there is nothing to write back
+  for (quadtree::Node *groupLeaf : group.leaves)
+  {
+    releaseFloors(*groupLeaf);
+  }
+
+  group.decompressed = false;
+  compressedLeaves += group.leaves.size();
+
+  return group.leaves.size();
+}
+
+void CompressedChunks::discard(const quadtree::Node &leaf)
+{
+  auto found = groupOf.find(&leaf);
+  if (found == groupOf.end())
+    return;
+
+  auto groupIt = groups.find(found->second);
+  DEBUG_ASSERT(groupIt->second.decompressed, "A compressed group can not be discarded.");
+  erase(groupIt);
+}
+
+void CompressedChunks::releaseFloors(quadtree::Node &leaf)
+{
+  for (auto &floor : leaf.children)
+  {
+    floor.reset();
+  }
+
+  leaf.compressed = true;
+}
+
+void CompressedChunks::erase(std::unordered_map<uint32_t, Group>::iterator groupIt)
+{
+  Group &group = groupIt->second;
+  for (const quadtree::Node *leaf : group.leaves)
+  {
+    groupOf.erase(leaf);
+  }
+
+  if (group.inPageFile)
+  {
+    pageFile->release(group.page);
+  }
+
+  groups.erase(groupIt);
+}
+
+size_t CompressedChunks::size() const
+{
+  return compressedLeaves;
+}
+
+size_t CompressedChunks::getMemoryUsage() const
+{
+  using GroupEntry = std::pair<const uint32_t, Group>;
+  using LeafEntry = std::pair<const quadtree::Node *const, uint32_t>;
+
+  size_t bytes = groups.bucket_count() * sizeof(void *) + groups.size() * (sizeof(GroupEntry) + sizeof(void *));
+  bytes += groupOf.bucket_count() * sizeof(void *) + groupOf.size() * (sizeof(LeafEntry) + sizeof(void *));
+
+  for (const auto &[id, group] : groups)
+  {
+    bytes += group.leaves.capacity() * sizeof(quadtree::Node *) + group.hashes.capacity() * sizeof(uint64_t) + group.data.capacity();
+  }
+
+  return bytes;
+}
+
+uint64_t CompressedChunks::getPageFileSize() const
+{
+  return pageFile ? pageFile->getSize() : 0;
+}
+
+void CompressedChunks::clear()
+{
+  for (auto &[id, group] : groups)
+  {
+    if (group.inPageFile)
+      pageFile->release(group.page);
+  }
+
+  groups.clear();
+  groupOf.clear();
+  compressedLeaves = 0;
+}
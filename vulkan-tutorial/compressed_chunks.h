@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "page_file.h"
+
+namespace quadtree
+{
+	class Node;
+}
+class TilePool;
+
+/*
+	LZMA compressed contents of the chunks that are not in use (see
+	Map::compressInactiveChunks). A compressed leaf stays in the map storage with
+	its content hash intact, but its floors are released and stored here until the
+	leaf is accessed again.
+
+	Leaves are compressed in groups. A single chunk is too small for LZMA to do
+	well, and setting up the encoder costs more than compressing a few hundred bytes.
+	Decompressing a leaf restores the whole group.
+
+	The compressed data of a group is kept after it is decompressed, so a group
+	that is evicted again without having been modified does not have to be
+	compressed (or written to the page file) again.
+
+	With a page file (see usePageFile), only the compressed data leaves memory.
+	The leaves themselves and their entries in 'groupOf' and Group::leaves stay.
+*/
+class CompressedChunks
+{
+public:
+	// Preferred number of leaves per group
+	static constexpr size_t GroupSize = 64;
+
+	/*
+		Store the compressed data of new groups in a page file instead of in memory.
+		Returns false if the file can not be created.
+	*/
+	bool usePageFile(const std::filesystem::path &path);
+
+	/*
+		True if the leaf has content and no selected items.
+	*/
+	static bool canCompress(const quadtree::Node &leaf);
+
+	/*
+		Compress and release the floors of the leaves. All leaves must satisfy
+		canCompress and not already be part of a group (see hasGroup).
+	*/
+	void compress(const std::vector<quadtree::Node *> &leaves);
+
+	/*
+		Restore the floors of a compressed leaf, and of the other leaves in its group.
+		The tiles that were shared when the leaves were compressed are interned in
+		the pool again.
+	*/
+	void decompress(quadtree::Node &leaf, TilePool &tilePool);
+
+	/*
+		True if the leaf is part of a group, i.e. is compressed or has been
+		decompressed and not modified since.
+	*/
+	bool hasGroup(const quadtree::Node &leaf) const;
+
+	/*
+		Release the floors of the decompressed group that contains the leaf, if all
+		leaves in the group are inactive. Returns the number of leaves that were
+		released. If any leaf in the group has been modified, the compressed data is
+		outdated; it is dropped and the leaves are no longer part of a group.
+	*/
+	size_t evict(const quadtree::Node &leaf, const std::function<bool(const quadtree::Node &)> &isInactive);
+
+	/*
+		Drop the group that contains the leaf. Must be called before a leaf that is
+		part of a decompressed group is released.
+	*/
+	void discard(const quadtree::Node &leaf);
+
+	/*
+		Number of compressed leaves.
+	*/
+	size_t size() const;
+	size_t getMemoryUsage() const;
+	uint64_t getPageFileSize() const;
+
+	/*
+		Drop all compressed chunks. Only for when the leaves are released as well.
+	*/
+	void clear();
+
+private:
+	struct Group
+	{
+		std::vector<quadtree::Node *> leaves;
+		// Content hashes of the leaves when they were compressed
+		std::vector<uint64_t> hashes;
+		// Size of the serialized leaves before compression
+		uint32_t size;
+		// The compressed data, unless it is stored in the page file
+		std::string data;
+		PageFile::Page page{};
+		bool inPageFile = false;
+		// True if the leaves currently have their floors
+		bool decompressed = false;
+	};
+
+	std::unordered_map<uint32_t, Group> groups;
+	std::unordered_map<const quadtree::Node *, uint32_t> groupOf;
+	uint32_t nextGroupId = 0;
+	size_t compressedLeaves = 0;
+
+	std::unique_ptr<PageFile> pageFile;
+
+	static void releaseFloors(quadtree::Node &leaf);
+	void erase(std::unordered_map<uint32_t, Group>::iterator groupIt);
+};
@@ -7,6 +7,10 @@
 constexpr uint16_t MAP_TREE_CHILDREN_COUNT = 16;
 constexpr uint16_t MAP_LAYERS = 16;
 
+constexpr uint16_t MAP_DEFAULT_SIZE = 2048;
+// OTBM stores map coordinates as uint16
+constexpr uint16_t MAP_MAX_SIZE = 65535;
+
 constexpr int MapTileSize = 32;
 
 enum class SpriteLayout
@@ -0,0 +1,491 @@
+#include "edit_journal.h"
+
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <tuple>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+#include "map.h"
+#include "position_bitmap.h"
+#include "tile_codec.h"
+#include "util.h"
+#include "debug.h"
+#include "logger.h"
+
+namespace
+{
+  constexpr char Magic[] = {'V', 'M', 'E', 'J'};
+  // u32 body size, u64 body checksum
+  constexpr size_t RecordHeaderSize = 4 + 8;
+
+  struct JournalTile
+  {
+    Position position;
+    // Empty if the tile was removed
+    std::optional<TileCodec::TileData> tile;
+  };
+
+  void writeHeader(BinaryWriter &writer, uint64_t snapshotHash)
+  {
+    writer.writeBytes(Magic, sizeof(Magic));
+    writer.writeU16(EditJournal::Version);
+    writer.writeU64(snapshotHash);
+  }
+
+  /*
+    Returns the snapshot hash, or nothing if the data is not a journal.
+  */
+  std::optional<uint64_t> readHeader(BinaryReader &reader)
+  {
+    char magic[sizeof(Magic)];
+    if (!reader.readBytes(magic, sizeof(magic)) || std::memcmp(magic, Magic, sizeof(Magic)) != 0)
+    {
+      Logger::error() << "The file is not an edit journal." << std::endl;
+      return {};
+    }
+
+    uint16_t version = reader.readU16();
+    if (version != EditJournal::Version)
+    {
+      Logger::error() << "Unsupported edit journal version: " << version << std::endl;
+      return {};
+    }
+
+    uint64_t snapshotHash = reader.readU64();
+    if (!reader.ok())
+      return {};
+
+    return snapshotHash;
+  }
+
+  void writeRecord(std::vector<uint8_t> &out, const std::vector<uint8_t> &body)
+  {
+    BinaryWriter writer;
+    writer.writeU32(static_cast<uint32_t>(body.size()));
+    writer.writeU64(util::hashBytes(body.data(), body.size()));
+
+    out.insert(out.end(), writer.data.begin(), writer.data.end());
+    out.insert(out.end(), body.begin(), body.end());
+  }
+
+  /*
+    Read the next complete record that matches its checksum. Returns false at the
+    end of the data or at a damaged record.
+  */
+  bool readRecord(BinaryReader &reader, std::vector<uint8_t> &body)
+  {
+    if (reader.remaining() < RecordHeaderSize)
+      return false;
+
+    uint32_t size = reader.readU32();
+    uint64_t checksum = reader.readU64();
+    if (size > reader.remaining())
+      return false;
+
+    body.resize(size);
+    reader.readBytes(body.data(), size);
+
+    return util::hashBytes(body.data(), body.size()) == checksum;
+  }
+
+  /*
+    Tile: u16 x, u16 y, u8 z, u8 hasTile, [tile (see TileCodec)]
+  */
+  std::optional<JournalTile> readTile(BinaryReader &reader)
+  {
+    JournalTile tile;
+    tile.position.x = reader.readU16();
+    tile.position.y = reader.readU16();
+    tile.position.z = reader.readU8();
+
+    if (reader.readU8() != 0)
+    {
+      tile.tile = TileCodec::read(reader);
+      if (!tile.tile)
+        return {};
+    }
+
+    if (!reader.ok())
+      return {};
+
+    return tile;
+  }
+
+  size_t offset(const BinaryReader &reader, const std::vector<uint8_t> &data)
+  {
+    return data.size() - reader.remaining();
+  }
+
+  std::FILE *openFile(const std::filesystem::path &path, bool append)
+  {
+#ifdef _WIN32
+    return _wfopen(path.c_str(), append ? L"ab" : L"wb");
+#else
+    return std::fopen(path.c_str(), append ? "ab" : "wb");
+#endif
+  }
+
+  /*
+    Write the data and flush it to the disk, not only to the OS.
+  */
+  bool writeToDisk(std::FILE *file, const std::vector<uint8_t> &data)
+  {
+    if (std::fwrite(data.data(), 1, data.size(), file) != data.size() || std::fflush(file) != 0)
+      return false;
+
+#ifdef _WIN32
+    return _commit(_fileno(file)) == 0;
+#else
+    return fsync(fileno(file)) == 0;
+#endif
+  }
+
+  std::vector<uint8_t> readFile(const std::filesystem::path &path)
+  {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    if (!file)
+      return {};
+
+    std::vector<uint8_t> data(static_cast<size_t>(file.tellg()));
+    file.seekg(0);
+    file.read(reinterpret_cast<char *>(data.data()), data.size());
+
+    return data;
+  }
+} // namespace
+
+EditJournal::~EditJournal()
+{
+  close();
+}
+
+bool EditJournal::open(const std::filesystem::path &path, const Map &map)
+{
+  DEBUG_ASSERT(!isOpen(), "The edit journal is already open.");
+
+  this->path = path;
+  if (!startFile(map.getHash()))
+  {
+    closeFile();
+    Logger::error() << "Could not create the edit journal " << path.string() << std::endl;
+    return false;
+  }
+
+  startWriter();
+  return true;
+}
+
+bool EditJournal::recover(const std::filesystem::path &path, Map &map)
+{
+  DEBUG_ASSERT(!isOpen(), "The edit journal is already open.");
+
+  std::error_code error;
+  if (!std::filesystem::exists(path, error))
+    return open(path, map);
+
+  size_t validSize = 0;
+  std::optional<size_t> applied = replay(readFile(path), map, validSize);
+  if (!applied)
+  {
+    std::filesystem::path oldPath = path;
+    oldPath += ".old";
+    std::filesystem::rename(path, oldPath, error);
+    Logger::info() << "The edit journal " << path.string() << " is not a journal of the map; it was moved to " << oldPath.string() << std::endl;
+    return open(path, map);
+  }
+
+  // Records appended after a damaged one would never be replayed
+  std::filesystem::resize_file(path, validSize, error);
+  this->path = path;
+  file = openFile(path, true);
+  if (error || !file)
+  {
+    closeFile();
+    Logger::error() << "Could not continue the edit journal " << path.string() << std::endl;
+    return false;
+  }
+
+  fileSize = validSize;
+  compactedSize = 0;
+
+  Logger::info() << "Recovered " << applied.value() << " records of the edit journal " << path.string() << std::endl;
+  startWriter();
+  return true;
+}
+
+bool EditJournal::isOpen() const
+{
+  return writer.joinable();
+}
+
+void EditJournal::close()
+{
+  if (!isOpen())
+    return;
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  wakeWriter.notify_one();
+  writer.join();
+
+  closeFile();
+}
+
+void EditJournal::append(const Map &map, const PositionBitmap &positions)
+{
+  if (positions.empty())
+    return;
+
+  BinaryWriter body;
+  body.writeU32(static_cast<uint32_t>(positions.size()));
+  for (const Position position : positions)
+  {
+    body.writeU16(static_cast<uint16_t>(position.x));
+    body.writeU16(static_cast<uint16_t>(position.y));
+    body.writeU8(static_cast<uint8_t>(position.z));
+
+    // An empty tile is the same as no tile (see Tile::contentHash)
+    const Tile *tile = map.getTile(position);
+    bool hasTile = tile && tile->contentHash() != 0;
+    body.writeU8(hasTile ? 1 : 0);
+    if (hasTile)
+    {
+      TileCodec::write(body, *tile);
+    }
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    writeRecord(pending, body.data);
+  }
+  wakeWriter.notify_one();
+}
+
+void EditJournal::restart(const Map &map)
+{
+  uint64_t snapshotHash = map.getHash();
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.clear();
+    pendingRestart = snapshotHash;
+  }
+  wakeWriter.notify_one();
+}
+
+void EditJournal::sync()
+{
+  std::unique_lock<std::mutex> lock(mutex);
+  writtenAll.wait(lock, [this] { return pending.empty() && !pendingRestart && !writing; });
+}
+
+void EditJournal::startWriter()
+{
+  stopping = false;
+  writer = std::thread(&EditJournal::run, this);
+}
+
+void EditJournal::run()
+{
+  std::vector<uint8_t> data;
+  while (true)
+  {
+    std::optional<uint64_t> restartHash;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      wakeWriter.wait(lock, [this] { return stopping || !pending.empty() || pendingRestart; });
+      if (pending.empty() && !pendingRestart)
+        break;
+
+      data.swap(pending);
+      restartHash = pendingRestart;
+      pendingRestart.reset();
+      writing = true;
+    }
+
+    bool ok = !restartHash || startFile(restartHash.value());
+    if (!ok || !file || !writeToDisk(file, data))
+    {
+      Logger::error() << "Could not write to the edit journal " << path.string() << std::endl;
+    }
+
+    fileSize += data.size();
+    data.clear();
+
+    if (fileSize > CompactionSize && fileSize > 2 * compactedSize)
+    {
+      compact();
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      writing = false;
+    }
+    writtenAll.notify_all();
+  }
+}
+
+bool EditJournal::startFile(uint64_t snapshotHash)
+{
+  closeFile();
+  file = openFile(path, false);
+  if (!file)
+    return false;
+
+  BinaryWriter writer;
+  writeHeader(writer, snapshotHash);
+
+  fileSize = writer.data.size();
+  compactedSize = 0;
+
+  return writeToDisk(file, writer.data);
+}
+
+void EditJournal::closeFile()
+{
+  if (file)
+  {
+    std::fclose(file);
+    file = nullptr;
+  }
+}
+
+void EditJournal::compact()
+{
+  closeFile();
+  std::vector<uint8_t> data = readFile(path);
+
+  BinaryReader reader(data);
+  std::optional<uint64_t> snapshotHash = readHeader(reader);
+  DEBUG_ASSERT(snapshotHash.has_value(), "The edit journal is corrupt.");
+
+  // The encoded tile of the latest record of each position, as a range in 'data'
+  std::map<std::tuple<int, long, long>, std::pair<size_t, size_t>> latest;
+  std::vector<uint8_t> body;
+  while (readRecord(reader, body))
+  {
+    // The body was just read from 'data', so its tiles can be found in 'data' as well
+    size_t bodyStart = offset(reader, data) - body.size();
+    BinaryReader bodyReader(body);
+    uint32_t count = bodyReader.readU32();
+    for (uint32_t i = 0; i < count; ++i)
+    {
+      size_t start = offset(bodyReader, body);
+      std::optional<JournalTile> tile = readTile(bodyReader);
+      DEBUG_ASSERT(tile.has_value(), "The edit journal is corrupt.");
+
+      const Position &pos = tile->position;
+      latest[{pos.z, pos.x, pos.y}] = {bodyStart + start, offset(bodyReader, body) - start};
+    }
+  }
+
+  BinaryWriter compacted;
+  compacted.writeU32(static_cast<uint32_t>(latest.size()));
+  for (const auto &[position, range] : latest)
+  {
+    compacted.writeBytes(data.data() + range.first, range.second);
+  }
+
+  BinaryWriter header;
+  writeHeader(header, snapshotHash.value());
+  std::vector<uint8_t> out = std::move(header.data);
+  writeRecord(out, compacted.data);
+
+  // Replace the journal atomically, so that a crash during compaction leaves a valid journal
+  std::filesystem::path compactedPath = path;
+  compactedPath += ".compact";
+  std::error_code error;
+  std::FILE *compactedFile = openFile(compactedPath, false);
+  bool written = compactedFile && writeToDisk(compactedFile, out);
+  if (compactedFile)
+    std::fclose(compactedFile);
+
+  if (!written)
+  {
+    Logger::error() << "Could not write the compacted edit journal " << compactedPath.string() << std::endl;
+  }
+  else
+  {
+    std::filesystem::rename(compactedPath, path, error);
+    if (error)
+    {
+      Logger::error() << "Could not compact the edit journal " << path.string() << ": " << error.message() << std::endl;
+    }
+  }
+
+  file = openFile(path, true);
+  fileSize = std::filesystem::file_size(path, error);
+  compactedSize = fileSize;
+}
+
+std::optional<size_t> EditJournal::replay(const std::filesystem::path &path, Map &map)
+{
+  size_t validSize;
+  return replay(readFile(path), map, validSize);
+}
+
+std::optional<size_t> EditJournal::replay(const std::vector<uint8_t> &data, Map &map, size_t &validSize)
+{
+  BinaryReader reader(data);
+
+  std::optional<uint64_t> snapshotHash = readHeader(reader);
+  if (!snapshotHash)
+    return {};
+
+  if (snapshotHash.value() != map.getHash())
+  {
+    Logger::error() << "The edit journal was started from another revision of the map." << std::endl;
+    return {};
+  }
+
+  validSize = offset(reader, data);
+
+  size_t applied = 0;
+  std::vector<uint8_t> body;
+  std::vector<JournalTile> tiles;
+  while (readRecord(reader, body))
+  {
+    // Read the whole record before touching the map, so that a damaged record is not applied partially
+    BinaryReader bodyReader(body);
+    uint32_t count = bodyReader.readU32();
+    tiles.clear();
+    bool valid = true;
+    for (uint32_t i = 0; i < count && valid; ++i)
+    {
+      std::optional<JournalTile> tile = readTile(bodyReader);
+      valid = tile && map.isInBounds(tile->position);
+      if (valid)
+        tiles.emplace_back(std::move(tile.value()));
+    }
+
+    if (!valid || !bodyReader.atEnd())
+    {
+      Logger::error() << "The edit journal has a malformed record; the edits after it are lost." << std::endl;
+      break;
+    }
+
+    for (const JournalTile &tile : tiles)
+    {
+      if (!tile.tile)
+      {
+        map.removeTile(tile.position);
+        continue;
+      }
+
+      TileLocation &location = map.getOrCreateTileLocation(tile.position);
+      location.setTile(TileCodec::createTile(location, tile.tile.value()));
+    }
+
+    ++applied;
+    validSize = offset(reader, data);
+  }
+
+  return applied;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <cstdio>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <thread>
+#include <vector>
+
+class Map;
+class PositionBitmap;
+
+/*
+	Append-only log of the edits of a map, for crash recovery. Every committed
+	(or undone) action appends a record with the new contents of the tiles that
+	it changed. Records are encoded on the calling thread and written to disk by
+	a background thread, so editing never waits for the disk.
+
+	The journal starts from a snapshot of the map, identified by its hash (for
+	example, the map as it was last saved). After a crash, loading the snapshot
+	and replaying the journal (see replay) restores the edits. Because the
+	records hold tile contents rather than operations, only the latest record of
+	each position matters; when the file has grown enough, the background thread
+	compacts it into a single record with the latest contents of every position.
+
+	Format (all integers little endian):
+		"VMEJ", u16 version, u64 snapshot hash, records
+	Record:
+		u32 body size, u64 body checksum (util::hashBytes), body
+	Body:
+		u32 tile count, tiles (as in MapPatch)
+
+	A crash can leave the last record incomplete. Replaying stops at the first
+	record that is incomplete or does not match its checksum.
+
+	The writer thread flushes each write to the disk (fsync), so the records
+	that have been written survive a crash of the system as well.
+*/
+class EditJournal
+{
+public:
+	static constexpr uint16_t Version = 1;
+	// The journal is compacted once it is larger than this, and twice as large as after the previous compaction
+	static constexpr uint64_t CompactionSize = 64 * 1024 * 1024;
+
+	~EditJournal();
+
+	/*
+		Start a journal for the map in its current state. An existing file at the
+		path is replaced. Returns false if the file can not be created.
+	*/
+	bool open(const std::filesystem::path &path, const Map &map);
+
+	/*
+		Replay the journal at the path if it is a journal of the map (see replay)
+		and continue it, so that the recovered edits stay recoverable until the map
+		is saved. A damaged end of the journal is cut off. Otherwise, an existing
+		journal is moved aside to <path>.old and a new one is started.
+	*/
+	bool recover(const std::filesystem::path &path, Map &map);
+
+	bool isOpen() const;
+
+	/*
+		Write the remaining records and close the file.
+	*/
+	void close();
+
+	/*
+		Record the current contents of the tiles at the positions.
+	*/
+	void append(const Map &map, const PositionBitmap &positions);
+
+	/*
+		Start over from the current state of the map, for example after it has been
+		saved. The records so far are dropped.
+	*/
+	void restart(const Map &map);
+
+	/*
+		Wait until all records have been written and flushed. This is all that an
+		autosave needs to do.
+	*/
+	void sync();
+
+	/*
+		Apply the journal at the path to the map, which must be the snapshot that the
+		journal started from. Returns the number of records that were applied, or
+		nothing if the file is not a journal of the map.
+	*/
+	static std::optional<size_t> replay(const std::filesystem::path &path, Map &map);
+
+private:
+	std::filesystem::path path;
+
+	std::thread writer;
+	std::mutex mutex;
+	std::condition_variable wakeWriter;
+	std::condition_variable writtenAll;
+
+	// The following are guarded by 'mutex'
+	std::vector<uint8_t> pending;
+	std::optional<uint64_t> pendingRestart;
+	// True while the writer thread writes what it took from 'pending'
+	bool writing = false;
+	bool stopping = false;
+
+	// Only used by the writer thread
+	std::FILE *file = nullptr;
+	uint64_t fileSize = 0;
+	uint64_t compactedSize = 0;
+
+	void startWriter();
+	void run();
+	bool startFile(uint64_t snapshotHash);
+	void closeFile();
+	void compact();
+
+	/*
+		Apply the records of the journal data to the map. 'validSize' is set to the
+		size of the data up to the end of the last applied record.
+	*/
+	static std::optional<size_t> replay(const std::vector<uint8_t> &data, Map &map, size_t &validSize);
+};
@@ -96,6 +96,25 @@ std::string LZMA::compress(const std::string &in, int level)
     return result;
 }
 
+std::string LZMA::decompress(const std::string &in, size_t size)
+{
+    static const size_t kMemLimit = 1 << 30; // 1 GB.
+    uint64_t memLimit = kMemLimit;
+
+    std::string result;
+    result.resize(size);
+    size_t in_pos = 0;
+    size_t out_pos = 0;
+    if (LZMA_OK != lzma_stream_buffer_decode(
+                       &memLimit, 0, NULL,
+                       reinterpret_cast<const uint8_t *>(in.data()), &in_pos, in.size(),
+                       reinterpret_cast<uint8_t *>(&result[0]), &out_pos, result.size()))
+        abort();
+    if (out_pos != size)
+        abort();
+    return result;
+}
+
 std::vector<uint8_t> LZMA::decompressRaw(const std::vector<uint8_t> &in, lzma_options_lzma &options)
 {
     static const size_t kMemLimit = 1 << 30; // 1 GB.
@@ -12,7 +12,10 @@ struct LZMA
   static std::vector<uint8_t> decompress(const std::vector<uint8_t> &buffer);
 
   // Level is between 0 (no compression), 9 (slow compression, small output).
-  std::string compress(const std::string &in, int level);
+  static std::string compress(const std::string &in, int level);
+
+  // Decompress the output of compress. 'size' is the size of the uncompressed data.
+  static std::string decompress(const std::string &in, size_t size);
 
 private:
   static std::vector<uint8_t> decompressRaw(const std::vector<uint8_t> &in, lzma_options_lzma &options);
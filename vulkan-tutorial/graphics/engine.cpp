@@ -20,6 +20,12 @@
 
 constexpr uint32_t TILE_SIZE = 32;
 
+constexpr TimePoint::time_t INACTIVE_CHUNK_CHECK_INTERVAL_MS = 1000;
+// Chunks that have not been accessed for this long are compressed
+constexpr uint32_t INACTIVE_CHUNK_SECONDS = 5 * 60;
+// Compressing 256 chunks takes a few milliseconds
+constexpr size_t INACTIVE_CHUNKS_PER_CHECK = 256;
+
 Engine *g_engine;
 
 namespace engine
@@ -97,6 +103,7 @@ void Engine::initialize(GLFWwindow *window)
   swapChain.initialize();
   createCommandPool();
   mapRenderer->initialize();
+  mapRenderer->subscribe(mapView->getMap()->getChangeBus());
   gui.initialize();
 
   createSyncObjects();
@@ -416,10 +423,17 @@ FrameResult Engine::nextFrame()
 
   currentTime = TimePoint::now();
   mapView->updateViewport();
+  mapView->getMap()->getChangeBus().deliver();
 
   mapRenderer->recordFrame(currentFrameIndex, *mapView);
   gui.recordFrame(currentFrameIndex);
 
+  if (inactiveChunksChecked.elapsedMillis() > INACTIVE_CHUNK_CHECK_INTERVAL_MS)
+  {
+    mapView->getMap()->compressInactiveChunks(INACTIVE_CHUNK_SECONDS, INACTIVE_CHUNKS_PER_CHECK);
+    inactiveChunksChecked = TimePoint::now();
+  }
+
   VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
 
   std::array<VkCommandBuffer, 2> submitCommandBuffers = {
@@ -264,6 +264,11 @@ public:
 		return gui.brushServerId;
 	}
 
+	const BrushSettings &getBrushSettings() const
+	{
+		return gui.brushSettings;
+	}
+
 	bool hasBrush() const
 	{
 		return gui.brushServerId.has_value();
@@ -317,6 +322,9 @@ private:
 	std::unique_ptr<MapView> mapView;
 	std::unique_ptr<MapRenderer> mapRenderer;
 
+	// Last time the map was checked for inactive chunks (see Map::compressInactiveChunks)
+	TimePoint inactiveChunksChecked;
+
 	VkDebugUtilsMessengerEXT debugMessenger;
 
 	bool framebufferResized = false;
@@ -16,12 +16,15 @@
 #include "../graphics/texture.h"
 
 #include "../item.h"
+#include "../const.h"
+#include "../logger.h"
 
 #include <stack>
 
 #include <algorithm>
 
 constexpr float DEFAULT_PADDING = 4.0f;
+constexpr TimePoint::time_t MAP_STATS_INTERVAL_MS = 2000;
 
 void GUI::renderItem(ItemType *itemType)
 {
@@ -176,13 +179,18 @@ void GUI::createTopMenuBar()
       ImGui::Separator();
       if (ImGui::MenuItem("Save", "Ctrl+S"))
       {
-        MapIO::saveMap(*g_engine->getMapView()->getMap());
+        MapView &mapView = *g_engine->getMapView();
+        MapIO::saveMap(*mapView.getMap());
+
+        // The saved map is the new snapshot of the edit journal
+        if (mapView.journal.isOpen())
+          mapView.journal.restart(*mapView.getMap());
       }
       ImGui::EndMenu();
     }
     if (ImGui::BeginMenu("Edit"))
     {
-      ImGui::MenuItem("Nothing here yet.");
+      createEditMenu();
       ImGui::EndMenu();
     }
 
@@ -193,6 +201,8 @@ void GUI::createTopMenuBar()
         inputServerId = 100;
     }
 
+    createBrushSettings();
+
     ImGui::EndMenuBar();
 
     renderN(10);
@@ -205,6 +215,75 @@ void GUI::createTopMenuBar()
   }
 }
 
+void GUI::createEditMenu()
+{
+  MapView &mapView = *g_engine->getMapView();
+  Map &map = *mapView.getMap();
+  uint16_t serverId = static_cast<uint16_t>(inputServerId);
+
+  std::ostringstream countString;
+  countString << "Items with id " << serverId << ": " << map.countItems(serverId);
+  ImGui::TextDisabled(countString.str().c_str());
+  ImGui::Separator();
+
+  if (ImGui::MenuItem("Find next"))
+  {
+    // Continue from the last found item, or from the top left corner of the viewport
+    Position after = foundPosition.value_or(Position{static_cast<long>(mapView.getX() / MapTileSize), static_cast<long>(mapView.getY() / MapTileSize), static_cast<int>(mapView.getZ())});
+    foundPosition = map.findNextItem(serverId, after);
+    if (foundPosition)
+      mapView.centerCamera(foundPosition.value());
+  }
+
+  if (ImGui::MenuItem("Select all"))
+  {
+    mapView.selectItems(serverId);
+  }
+
+  ImGui::Separator();
+  ImGui::SetNextItemWidth(90.0f);
+  if (ImGui::InputInt("Replace with", (int *)&replaceServerId, 1, 20))
+  {
+    if (replaceServerId < 100)
+      replaceServerId = 100;
+  }
+
+  if (ImGui::MenuItem("Replace all"))
+  {
+    size_t count = mapView.replaceItems({{serverId, static_cast<uint16_t>(replaceServerId)}});
+    Logger::info() << "Replaced " << count << " items." << std::endl;
+  }
+}
+
+void GUI::createBrushSettings()
+{
+  const char *shapes[] = {"Square", "Circle"};
+  const char *patterns[] = {"Solid", "Checkerboard", "Scatter"};
+
+  ImGui::SetNextItemWidth(90.0f);
+  int shape = static_cast<int>(brushSettings.shape);
+  if (ImGui::Combo("Shape", &shape, shapes, IM_ARRAYSIZE(shapes)))
+  {
+    brushSettings.shape = static_cast<BrushShape>(shape);
+  }
+
+  ImGui::SetNextItemWidth(90.0f);
+  ImGui::SliderInt("Radius", &brushSettings.radius, 0, 50);
+
+  ImGui::SetNextItemWidth(120.0f);
+  int pattern = static_cast<int>(brushSettings.pattern);
+  if (ImGui::Combo("Pattern", &pattern, patterns, IM_ARRAYSIZE(patterns)))
+  {
+    brushSettings.pattern = static_cast<BrushPattern>(pattern);
+  }
+
+  if (brushSettings.pattern == BrushPattern::Scatter)
+  {
+    ImGui::SetNextItemWidth(90.0f);
+    ImGui::SliderFloat("Density", &brushSettings.density, 0.0f, 1.0f, "%.2f");
+  }
+}
+
 void GUI::renderN(uint32_t n)
 {
   for (uint32_t i = 0; i < n; ++i)
@@ -278,11 +357,11 @@ void GUI::createBottomBar()
   ImGui::EndChild();
 
   ImGui::SameLine();
-  ImGui::BeginChild("Bottom3", ImVec2{viewport->GetWorkSize().x / 2, bottomBarHeight + padding * 2}, ImGuiWindowFlags_NoResize);
+  ImGui::BeginChild("Bottom3", bottomSubAreaSize, ImGuiWindowFlags_NoResize);
   {
     Position cursorMapPos = g_engine->getCursorPos().worldPos(mapView).mapPos().floor(mapView.getZ());
 
-    Tile *tile = mapView.getMap()->getTile(cursorMapPos);
+    const Tile *tile = mapView.getMap()->getTile(cursorMapPos);
     std::ostringstream tileInfoString;
     if (tile && tile->hasTopItem())
     {
@@ -298,6 +377,30 @@ void GUI::createBottomBar()
   }
   ImGui::EndChild();
 
+  ImGui::SameLine();
+  ImGui::BeginChild("Bottom4", bottomSubAreaSize, ImGuiWindowFlags_NoResize);
+  {
+    MapStorage::Totals totals = mapView.getMap()->getTotals();
+
+    std::ostringstream statsString;
+    statsString << "Tiles: " << totals.tiles << " Items: " << totals.items;
+    ImGui::Text(statsString.str().c_str());
+
+    if (ImGui::IsItemHovered())
+    {
+      if (!mapStats || mapStatsUpdated.elapsedMillis() > MAP_STATS_INTERVAL_MS)
+      {
+        mapStats = mapView.getMap()->stats();
+        mapStatsUpdated = TimePoint::now();
+      }
+
+      ImGui::BeginTooltip();
+      ImGui::TextUnformatted(mapStats->toString().c_str());
+      ImGui::EndTooltip();
+    }
+  }
+  ImGui::EndChild();
+
   ImGui::End();
 }
 
@@ -5,6 +5,9 @@
 #include <optional>
 
 #include "../items.h"
+#include "../map_stats.h"
+#include "../time.h"
+#include "../brush_stroke.h"
 
 class GUI
 {
@@ -19,6 +22,11 @@ public:
 	/* Data */
 	uint32_t inputServerId = 4632;
 	std::optional<uint16_t> brushServerId;
+	BrushSettings brushSettings;
+	// Server id that the items with inputServerId are replaced by (Edit menu)
+	uint32_t replaceServerId = 100;
+	// The last item found with Edit > Find next
+	std::optional<Position> foundPosition;
 
 	uint16_t hoveredId = 0;
 	uint16_t nextHoveredId = 0;
@@ -42,6 +50,12 @@ public:
 private:
 	void createTopMenuBar();
 	void createBottomBar();
+	void createEditMenu();
+	void createBrushSettings();
+
+	// Map::stats() walks the whole map, so it is only computed while its tooltip is shown, and then only periodically.
+	std::optional<MapStats> mapStats;
+	TimePoint mapStatsUpdated;
 
 	// TODO Replace with actual item list
 	void renderN(uint32_t n);
@@ -60,24 +60,30 @@ void handleBrush(Input *input, Position &pos)
     {
       mapView.history.startGroup(ActionGroupType::AddMapItem);
     }
-    mapView.addItem(pos, selectedId.value());
+    mapView.startBrushStroke(pos, g_engine->getBrushSettings());
+    mapView.paintBrushStroke(selectedId.value());
   }
   else if (input->leftMouseDown()) // Mouse down event (fast)
   {
-    MapPosition oldMapPos = g_engine->getPrevCursorPos().worldPos(mapView).mapPos();
-    MapPosition mapPos = g_engine->getCursorPos().worldPos(mapView).mapPos();
-    if (mapPos != oldMapPos)
+    if (!mapView.history.hasCurrentGroup())
     {
-      if (!mapView.history.hasCurrentGroup())
-      {
-        mapView.history.startGroup(ActionGroupType::AddMapItem);
-      }
-      mapView.addItem(pos, selectedId.value());
+      mapView.history.startGroup(ActionGroupType::AddMapItem);
+    }
+    // The tiles that the cursor skipped over since the previous frame are painted as well
+    if (mapView.hasBrushStroke())
+    {
+      mapView.continueBrushStroke(pos);
+    }
+    else
+    {
+      mapView.startBrushStroke(pos, g_engine->getBrushSettings());
     }
+    mapView.paintBrushStroke(selectedId.value());
   }
   else if (input->leftMouseEvent() == GLFW_RELEASE) // Mouse release event
   {
     Logger::debug("handleBrush GLFW_RELEASE");
+    mapView.endBrushStroke(selectedId.value());
 
     if (mapView.history.hasCurrentGroup())
     {
@@ -105,10 +111,12 @@ void handleSelection(Input *input, Position &pos)
     }
     else // Do not start a drag action
     {
-      Tile *tile = map->getTile(pos);
+      // The press can start moving the selection, which needs the selected items
+      mapView.selection.materialize(pos);
+
+      const Tile *tile = map->getTile(pos);
       if (tile->hasTopItem())
       {
-        Item &topItem = *tile->getTopItem();
         if (tile->topItemSelected())
         {
           mapView.selection.moveOrigin = pos;
@@ -123,12 +131,12 @@ void handleSelection(Input *input, Position &pos)
 
           if (input->shift())
           {
-            mapView.selectAll(*tile);
+            mapView.selectAll(pos);
           }
           else // Shift is not down
           {
             mapView.history.startGroup(ActionGroupType::Selection);
-            mapView.selectTopItem(*tile);
+            mapView.selectTopItem(pos);
             mapView.history.endGroup(ActionGroupType::Selection);
           }
         }
@@ -165,11 +173,11 @@ void handleSelection(Input *input, Position &pos)
     }
     else // Deselect not blocked
     {
-      Tile *tile = map->getTile(pos);
+      const Tile *tile = map->getTile(pos);
       if (tile && tile->topItemSelected())
       {
         mapView.history.startGroup(ActionGroupType::Selection);
-        mapView.deselectTopItem(*tile);
+        mapView.deselectTopItem(pos);
         mapView.history.endGroup(ActionGroupType::Selection);
       }
     }
@@ -59,6 +59,22 @@ Item Item::deepCopy() const
 	return item;
 }
 
+uint64_t Item::contentHash() const
+{
+	uint64_t hash = util::mixHash(itemType->id);
+	util::combineHash64(hash, getSubtype());
+
+	// The attribute map is unordered, so combine the attribute hashes in an order-independent way
+	uint64_t attributeHash = 0;
+	for (const auto &[type, attribute] : attributes)
+	{
+		attributeHash += attribute.contentHash();
+	}
+	util::combineHash64(hash, attributeHash);
+
+	return hash;
+}
+
 const TextureInfo Item::getTextureInfo(const Position &pos) const
 {
 	// TODO Add more pattern checks like hanging or cumulative item types
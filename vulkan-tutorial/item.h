@@ -35,6 +35,11 @@ public:
 
 	Item deepCopy() const;
 
+	/*
+		Hash of the item's id, subtype and attributes. Selection and entity state are not included.
+	*/
+	uint64_t contentHash() const;
+
 	// Item(Item &&item) = default;
 
 	uint32_t getId() const
@@ -62,6 +67,10 @@ public:
 	const bool isGround() const;
 
 	uint16_t getSubtype() const;
+	void setSubtype(uint16_t subtype)
+	{
+		this->subtype = subtype;
+	}
 
 	bool hasAttributes() const
 	{
@@ -78,6 +87,12 @@ public:
 		return attributes;
 	}
 
+	void setAttribute(ItemAttribute &&attribute)
+	{
+		ItemAttribute_t type = attribute.type;
+		attributes.insert_or_assign(type, std::move(attribute));
+	}
+
 private:
 	std::unordered_map<ItemAttribute_t, ItemAttribute> attributes;
 	// Subtype is either fluid type, count, subtype, or charges.
@@ -62,4 +62,20 @@ void ItemAttribute::setString(std::string &value)
   {
     Logger::error() << "Tried to assign value " << value << " to an ItemAttribute of type " << this->type;
   }
-}
\ No newline at end of file
+}
+
+uint64_t ItemAttribute::contentHash() const
+{
+  uint64_t hash = util::mixHash(static_cast<uint64_t>(to_underlying(type)));
+  util::combineHash64(hash, value.index());
+
+  std::visit(
+      util::overloaded{
+          [&hash](bool v) { util::combineHash64(hash, v ? 1 : 0); },
+          [&hash](int v) { util::combineHash64(hash, static_cast<uint64_t>(static_cast<int64_t>(v))); },
+          [&hash](double v) { util::combineHash64(hash, util::hashBytes(&v, sizeof(v))); },
+          [&hash](const std::string &v) { util::combineHash64(hash, util::hashBytes(v.data(), v.size())); }},
+      value);
+
+  return hash;
+}
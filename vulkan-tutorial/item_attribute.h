@@ -21,6 +21,11 @@ public:
   ItemAttribute(ItemAttribute_t type);
   ItemAttribute_t type;
 
+  /*
+    Hash of the type and value. Stable between runs and platforms.
+  */
+  uint64_t contentHash() const;
+
   template <typename T>
   bool holds() const
   {
@@ -40,7 +45,6 @@ public:
     }
   }
 
-protected:
   void setBool(bool value);
   void setInt(int value);
   void setDouble(double value);
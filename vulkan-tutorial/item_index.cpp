@@ -0,0 +1,131 @@
+#include "item_index.h"
+
+#include <algorithm>
+
+#include "map_storage.h"
+#include "position.h"
+#include "quad_tree.h"
+#include "tile.h"
+#include "debug.h"
+
+void ItemIndex::markDirty(int x, int y)
+{
+  dirtyChunks.emplace(ChunkKey::of(x, y));
+}
+
+void ItemIndex::update(const MapStorage &storage)
+{
+  std::vector<std::pair<uint16_t, uint32_t>> counts;
+
+  for (uint32_t key : dirtyChunks)
+  {
+    // Remove the old contribution of the chunk
+    auto previous = countsByChunk.find(key);
+    if (previous != countsByChunk.end())
+    {
+      for (const auto &[serverId, count] : previous->second)
+      {
+        auto entry = items.find(serverId);
+        entry->second.total -= count;
+        entry->second.chunks.erase(key);
+        if (entry->second.total == 0)
+          items.erase(entry);
+      }
+
+      countsByChunk.erase(previous);
+    }
+
+    auto [x, y] = ChunkKey::position(key);
+    quadtree::Node *leaf = storage.getLeaf(x, y);
+    if (!leaf)
+      continue;
+
+    DEBUG_ASSERT(!leaf->isCompressed(), "A modified leaf can not be compressed before the item index is updated.");
+
+    counts.clear();
+    auto add = [&counts](const Item &item) {
+      uint16_t serverId = static_cast<uint16_t>(item.getId());
+      auto found = std::find_if(counts.begin(), counts.end(), [serverId](const auto &count) { return count.first == serverId; });
+      if (found != counts.end())
+        ++found->second;
+      else
+        counts.emplace_back(serverId, 1);
+    };
+
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      Floor *floor = leaf->getFloor(z);
+      if (!floor)
+        continue;
+
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const Tile *tile = floor->getTileLocation(i).getTile();
+        if (!tile)
+          continue;
+
+        if (const Item *ground = tile->getGround())
+          add(*ground);
+
+        for (const Item &item : tile->getItems())
+          add(item);
+      }
+    }
+
+    if (counts.empty())
+      continue;
+
+    for (const auto &[serverId, count] : counts)
+    {
+      Entry &entry = items[serverId];
+      entry.total += count;
+      entry.chunks.emplace(key, count);
+    }
+
+    countsByChunk.emplace(key, counts);
+  }
+
+  dirtyChunks.clear();
+}
+
+uint32_t ItemIndex::count(uint16_t serverId) const
+{
+  auto found = items.find(serverId);
+  return found != items.end() ? found->second.total : 0;
+}
+
+const ItemIndex::ChunkCounts *ItemIndex::getChunks(uint16_t serverId) const
+{
+  auto found = items.find(serverId);
+  return found != items.end() ? &found->second.chunks : nullptr;
+}
+
+size_t ItemIndex::getMemoryUsage() const
+{
+  using ChunkEntry = std::pair<const uint32_t, uint32_t>;
+  using ItemEntry = std::pair<const uint16_t, Entry>;
+  using CountsEntry = std::pair<const uint32_t, std::vector<std::pair<uint16_t, uint32_t>>>;
+
+  size_t bytes = items.bucket_count() * sizeof(void *) + items.size() * (sizeof(ItemEntry) + sizeof(void *));
+  for (const auto &[serverId, entry] : items)
+  {
+    bytes += entry.chunks.bucket_count() * sizeof(void *) + entry.chunks.size() * (sizeof(ChunkEntry) + sizeof(void *));
+  }
+
+  bytes += countsByChunk.bucket_count() * sizeof(void *) + countsByChunk.size() * (sizeof(CountsEntry) + sizeof(void *));
+  for (const auto &[key, counts] : countsByChunk)
+  {
+    bytes += counts.capacity() * sizeof(counts[0]);
+  }
+
+  bytes += dirtyChunks.bucket_count() * sizeof(void *) + dirtyChunks.size() * (sizeof(uint32_t) + sizeof(void *));
+
+  return bytes;
+}
+
+void ItemIndex::clear()
+{
+  items.clear();
+  countsByChunk.clear();
+  dirtyChunks.clear();
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+class MapStorage;
+
+/*
+	Index from server id to the chunks that contain items with that id, with the
+	number of such items in each chunk. The index is kept up to date incrementally:
+	the map reports every chunk that it modifies (see Map::markDirty), and those
+	chunks are recounted the next time the index is updated.
+*/
+class ItemIndex
+{
+public:
+	// Chunk key (see ChunkKey) -> number of items
+	using ChunkCounts = std::unordered_map<uint32_t, uint32_t>;
+
+	void markDirty(int x, int y);
+
+	/*
+		Recount the chunks that have been modified since the last update. The
+		modified leaves must not be compressed.
+	*/
+	void update(const MapStorage &storage);
+
+	/*
+		Number of items with the server id on the map (ground included).
+	*/
+	uint32_t count(uint16_t serverId) const;
+
+	/*
+		The chunks that contain items with the server id, or nullptr if there are none.
+	*/
+	const ChunkCounts *getChunks(uint16_t serverId) const;
+
+	size_t getMemoryUsage() const;
+
+	void clear();
+
+private:
+	struct Entry
+	{
+		ChunkCounts chunks;
+		uint32_t total = 0;
+	};
+
+	std::unordered_map<uint16_t, Entry> items;
+	// The counts that each chunk currently contributes to 'items'
+	std::unordered_map<uint32_t, std::vector<std::pair<uint16_t, uint32_t>>> countsByChunk;
+	std::unordered_set<uint32_t> dirtyChunks;
+};
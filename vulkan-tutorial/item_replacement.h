@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "position.h"
+
+/*
+	A map-wide replacement of item ids (see Map::replaceItems), stored compactly
+	enough to be undone: per modified tile, the stack indices of the replaced items
+	with the ids to put back, and the reordering of the stack if the replacement
+	moved items between the always-on-top part and the rest of the stack.
+
+	Applying a replacement (Map::applyItemReplacement) turns it into its own
+	inverse, so the same data is used for undo and redo.
+*/
+struct ItemReplacement
+{
+	// Index of the ground item
+	static constexpr uint16_t Ground = UINT16_MAX;
+
+	struct ItemChange
+	{
+		uint16_t index;
+		uint16_t serverId;
+	};
+
+	struct TileChange
+	{
+		Position position;
+		// Range in 'items'
+		uint32_t firstItem;
+		uint16_t itemCount;
+		// Range in 'order'. An empty range means that the stack keeps its order.
+		uint16_t orderCount;
+		uint32_t firstOrder;
+	};
+
+	std::vector<TileChange> tiles;
+	std::vector<ItemChange> items;
+	/*
+		Stack permutations, new stack[i] = old stack[order[i]]. Item indices refer to
+		the stack before it is reordered.
+	*/
+	std::vector<uint16_t> order;
+
+	bool empty() const
+	{
+		return tiles.empty();
+	}
+
+	size_t getMemoryUsage() const
+	{
+		return tiles.capacity() * sizeof(TileChange) + items.capacity() * sizeof(ItemChange) + order.capacity() * sizeof(uint16_t);
+	}
+};
@@ -13,8 +13,10 @@
 #include <cstring>
 #include <algorithm>
 #include <optional>
+#include <string>
 #include <set>
 #include <fstream>
+#include <filesystem>
 #include <array>
 #include <cassert>
 
@@ -37,6 +39,7 @@
 #include "map.h"
 #include "ecs/ecs.h"
 #include "input_control.h"
+#include "map_storage_benchmark.h"
 
 using namespace std;
 
@@ -159,13 +162,16 @@ class K
 {
 };
 
-int main()
+int main(int argc, char *argv[])
 {
 	try
 	{
 		// testy();
 		// return 0;
 
+		// MapStorageBenchmark::runAll();
+		// return 0;
+
 		engine::create();
 
 		// Register animation
@@ -187,6 +193,45 @@ int main()
 		input.registerHook(InputControl::mapEditing);
 
 		g_engine->initialize(window);
+
+		// Usage: [--page-file] [map.otbm]
+		std::optional<std::filesystem::path> mapPath;
+		bool usePageFile = false;
+		for (int i = 1; i < argc; ++i)
+		{
+			std::string arg = argv[i];
+			if (arg == "--page-file")
+				usePageFile = true;
+			else
+				mapPath = arg;
+		}
+
+		if (mapPath)
+		{
+			MapIO::loadMap(mapPath.value(), *g_engine->getMapView()->getMap());
+		}
+
+		// Keep the compressed data of inactive chunks on disk instead of in memory (for large maps)
+		if (usePageFile && !g_engine->getMapView()->getMap()->usePageFile("map.pages"))
+		{
+			Logger::error() << "Could not create the page file map.pages; compressed chunks stay in memory." << std::endl;
+		}
+
+		// Recover the edits of a session that crashed, and journal the edits of this one.
+		// The journal only applies to the map that it was started from (the map as it was last saved).
+		g_engine->getMapView()->journal.recover("map.journal", *g_engine->getMapView()->getMap());
+
+		// Place ground borders automatically when painting grounds. Without a borders file, no borders are placed.
+		const std::filesystem::path bordersPath = "data/borders.xml";
+		if (std::filesystem::exists(bordersPath))
+		{
+			g_engine->getMapView()->autoBorder.loadFromXml(bordersPath);
+		}
+		else
+		{
+			Logger::info() << "No borders file at " << bordersPath.string() << "; automatic borders are off." << std::endl;
+		}
+
 		Logger::info() << "Loading finished in " << g_engine->startTime.elapsedMillis() << " ms." << std::endl;
 
 		bool captureMouse = g_engine->captureMouse;
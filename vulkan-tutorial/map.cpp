@@ -9,43 +9,43 @@
 #include "ecs/item_animation.h"
 #include "debug.h"
 #include "graphics/appearances.h"
+#include "items.h"
 
 #include <stack>
+#include <algorithm>
+#include <tuple>
+#include <future>
+#include <numeric>
+#include <thread>
+#include <unordered_set>
 
 Map::Map()
-    : root(quadtree::Node::NodeType::Root), width(2048), height(2048)
+    : Map(MapStorageType::QuadTree)
 {
 }
 
-void Map::clear()
+Map::Map(MapStorageType storageType)
+    : Map(MAP_DEFAULT_SIZE, MAP_DEFAULT_SIZE, storageType)
 {
-  root.clear();
 }
 
-void Map::moveSelectedItems(const Position source, const Position destination)
+Map::Map(uint16_t width, uint16_t height, MapStorageType storageType)
+    : storage(MapStorage::create(storageType)), width(width), height(height)
 {
-  TileLocation *from = getTileLocation(source);
-  if (!from)
-  {
-    ABORT_PROGRAM("No tile to move.");
-  }
-
-  TileLocation &to = getOrCreateTileLocation(destination);
+}
 
-  if (from->getTile()->allSelected())
-  {
-    std::unique_ptr<Tile> fromTile = from->dropTile();
-    to.setTile(std::move(fromTile));
-  }
-  else
-  {
-    if (!to.hasTile())
-    {
-      to.setEmptyTile();
-    }
+void Map::setSize(uint16_t width, uint16_t height)
+{
+  this->width = width;
+  this->height = height;
+}
 
-    from->getTile()->moveSelected(*to.getTile());
-  }
+void Map::clear()
+{
+  itemIndex.clear();
+  compressedChunks.clear();
+  storage->clear();
+  changeBus.markAllChanged();
 }
 
 MapRegion Map::getRegion(Position from, Position to)
@@ -74,7 +74,7 @@ void Map::insertTile(Tile &&tile)
 
 void Map::removeTile(const Position pos)
 {
-  auto leaf = root.getLeafUnsafe(pos.x, pos.y);
+  auto leaf = getLeaf(pos.x, pos.y);
   if (leaf)
   {
     Floor *floor = leaf->getFloor(pos.z);
@@ -83,7 +83,9 @@ void Map::removeTile(const Position pos)
       auto &loc = floor->getTileLocation(pos.x, pos.y);
       if (loc.hasTile())
       {
+        markDirty(pos);
         loc.removeTile();
+        releaseIfEmpty(pos);
       }
     }
   }
@@ -91,7 +93,7 @@ void Map::removeTile(const Position pos)
 
 std::unique_ptr<Tile> Map::dropTile(const Position pos)
 {
-  auto leaf = root.getLeafUnsafe(pos.x, pos.y);
+  auto leaf = getLeaf(pos.x, pos.y);
   if (leaf)
   {
     Floor *floor = leaf->getFloor(pos.z);
@@ -100,7 +102,10 @@ std::unique_ptr<Tile> Map::dropTile(const Position pos)
       auto &loc = floor->getTileLocation(pos.x, pos.y);
       if (loc.hasTile())
       {
-        return loc.dropTile();
+        markDirty(pos);
+        std::unique_ptr<Tile> tile = loc.dropTile();
+        releaseIfEmpty(pos);
+        return tile;
       }
     }
   }
@@ -108,15 +113,1121 @@ std::unique_ptr<Tile> Map::dropTile(const Position pos)
   return {};
 }
 
+void Map::releaseIfEmpty(const Position pos)
+{
+  quadtree::Node *leaf = getLeaf(pos.x, pos.y);
+  if (!leaf)
+    return;
+
+  Floor *floor = leaf->getFloor(pos.z);
+  if (floor && floor->isEmpty())
+  {
+    leaf->removeFloor(pos.z);
+  }
+
+  if (leaf->isEmpty())
+  {
+    compressedChunks.discard(*leaf);
+    storage->removeLeaf(pos.x, pos.y);
+  }
+}
+
+void Map::markDirty(const Position &pos)
+{
+  storage->markDirty(pos.x, pos.y);
+  itemIndex.markDirty(pos.x, pos.y);
+  changeBus.markChanged(pos.x, pos.y);
+}
+
+uint32_t Map::countItems(uint16_t serverId) const
+{
+  itemIndex.update(*storage);
+  return itemIndex.count(serverId);
+}
+
+std::vector<Position> Map::findItems(uint16_t serverId) const
+{
+  itemIndex.update(*storage);
+
+  std::vector<Position> result;
+  const ItemIndex::ChunkCounts *chunks = itemIndex.getChunks(serverId);
+  if (!chunks)
+    return result;
+
+  auto hasItem = [serverId](const Tile &tile) {
+    const Item *ground = tile.getGround();
+    if (ground && ground->getId() == serverId)
+      return true;
+
+    const std::vector<Item> &items = tile.getItems();
+    return std::any_of(items.begin(), items.end(), [serverId](const Item &item) { return item.getId() == serverId; });
+  };
+
+  for (const auto &[key, count] : *chunks)
+  {
+    auto [x, y] = ChunkKey::position(key);
+    quadtree::Node *leaf = getLeaf(x, y);
+    DEBUG_ASSERT(leaf != nullptr, "The item index refers to a chunk that is not on the map.");
+    if (!leaf)
+      continue;
+
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      Floor *floor = leaf->getFloor(z);
+      if (!floor)
+        continue;
+
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const TileLocation &location = floor->getTileLocation(i);
+        const Tile *tile = location.getTile();
+        if (tile && hasItem(*tile))
+          result.emplace_back(location.getPosition());
+      }
+    }
+  }
+
+  std::sort(result.begin(), result.end(), [](const Position &a, const Position &b) {
+    return std::tie(a.z, a.y, a.x) < std::tie(b.z, b.y, b.x);
+  });
+
+  return result;
+}
+
+std::optional<Position> Map::findNextItem(uint16_t serverId, const Position &after) const
+{
+  std::vector<Position> positions = findItems(serverId);
+  if (positions.empty())
+    return {};
+
+  auto next = std::upper_bound(positions.begin(), positions.end(), after, [](const Position &a, const Position &b) {
+    return std::tie(a.z, a.y, a.x) < std::tie(b.z, b.y, b.x);
+  });
+
+  return next != positions.end() ? *next : positions.front();
+}
+
+std::vector<Position> Map::findItems(const std::vector<uint16_t> &serverIds, const Position &from, const Position &to) const
+{
+  std::vector<Position> result;
+  if (serverIds.empty())
+    return result;
+
+  int x1 = static_cast<int>(std::min(from.x, to.x));
+  int x2 = static_cast<int>(std::max(from.x, to.x));
+  int y1 = static_cast<int>(std::min(from.y, to.y));
+  int y2 = static_cast<int>(std::max(from.y, to.y));
+  int z1 = std::max(std::min(from.z, to.z), 0);
+  int z2 = std::min(std::max(from.z, to.z), MAP_LAYERS - 1);
+
+  std::vector<uint16_t> ids = serverIds;
+  std::sort(ids.begin(), ids.end());
+  auto isWanted = [&ids](const Item &item) {
+    return std::binary_search(ids.begin(), ids.end(), static_cast<uint16_t>(item.getId()));
+  };
+
+  auto hasItem = [&isWanted](const Tile &tile) {
+    const Item *ground = tile.getGround();
+    if (ground && isWanted(*ground))
+      return true;
+
+    const std::vector<Item> &items = tile.getItems();
+    return std::any_of(items.begin(), items.end(), isWanted);
+  };
+
+  storage->forEachLeafWithItems(serverIds, x1, y1, x2, y2, [&](quadtree::Node *leaf) {
+    loadLeaf(*leaf);
+
+    for (int z = z1; z <= z2; ++z)
+    {
+      Floor *floor = leaf->getFloor(z);
+      if (!floor)
+        continue;
+
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const TileLocation &location = floor->getTileLocation(i);
+        const Tile *tile = location.getTile();
+        Position position = location.getPosition();
+
+        if (tile && position.x >= x1 && position.x <= x2 && position.y >= y1 && position.y <= y2 && hasItem(*tile))
+          result.emplace_back(position);
+      }
+    }
+  });
+
+  std::sort(result.begin(), result.end(), [](const Position &a, const Position &b) {
+    return std::tie(a.z, a.y, a.x) < std::tie(b.z, b.y, b.x);
+  });
+
+  return result;
+}
+
+/*
+  The part of the stack that an item of the type belongs in: ground borders
+  first, then the other always-on-top items, then everything else.
+*/
+static int stackRank(const ItemType &itemType)
+{
+  if (!itemType.alwaysOnTop)
+    return 2;
+
+  return itemType.isGroundBorder() ? 0 : 1;
+}
+
+ItemReplacement Map::replaceItems(const std::unordered_map<uint16_t, uint16_t> &mapping)
+{
+  itemIndex.update(*storage);
+
+  // Old server id -> new item type. Much faster to look up than the mapping.
+  std::vector<ItemType *> newTypes(UINT16_MAX + 1, nullptr);
+  std::vector<uint32_t> chunks;
+
+  for (const auto &[from, to] : mapping)
+  {
+    ItemType *oldType = Items::items.getItemType(from);
+    ItemType *newType = Items::items.getItemType(to);
+    if (from == to || !oldType || !newType || oldType->isGroundTile() != newType->isGroundTile())
+      continue;
+
+    const ItemIndex::ChunkCounts *found = itemIndex.getChunks(from);
+    if (!found)
+      continue;
+
+    newTypes[from] = newType;
+    for (const auto &[key, count] : *found)
+    {
+      chunks.emplace_back(key);
+    }
+  }
+
+  std::sort(chunks.begin(), chunks.end());
+  chunks.erase(std::unique(chunks.begin(), chunks.end()), chunks.end());
+
+  // Loading a leaf can decompress its group, so that is done before the parallel part
+  std::vector<quadtree::Node *> leaves;
+  leaves.reserve(chunks.size());
+  for (uint32_t key : chunks)
+  {
+    auto [x, y] = ChunkKey::position(key);
+    quadtree::Node *leaf = getLeaf(x, y);
+    DEBUG_ASSERT(leaf != nullptr, "The item index refers to a chunk that is not on the map.");
+    if (leaf)
+      leaves.emplace_back(leaf);
+  }
+
+  struct Partial
+  {
+    ItemReplacement replacement;
+    // The modified tile of each tile change
+    std::vector<Tile *> tiles;
+  };
+
+  auto replaceInLeaves = [&newTypes, &leaves](size_t start, size_t end) {
+    Partial partial;
+    ItemReplacement &result = partial.replacement;
+
+    auto hasReplacement = [&newTypes](const Tile &tile) {
+      const Item *ground = tile.getGround();
+      if (ground && newTypes[ground->getId()])
+        return true;
+
+      const std::vector<Item> &items = tile.getItems();
+      return std::any_of(items.begin(), items.end(), [&newTypes](const Item &item) { return newTypes[item.getId()] != nullptr; });
+    };
+
+    for (size_t i = start; i < end; ++i)
+    {
+      quadtree::Node *leaf = leaves[i];
+      for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+      {
+        Floor *floor = leaf->getFloor(z);
+        if (!floor)
+          continue;
+
+        for (uint32_t j = 0; j < MAP_TREE_CHILDREN_COUNT; ++j)
+        {
+          TileLocation &location = floor->getTileLocation(j);
+          const Tile *sharedTile = location.getTile();
+          if (!sharedTile || !hasReplacement(*sharedTile))
+            continue;
+
+          Tile &tile = *location.getMutableTile();
+
+          ItemReplacement::TileChange change{};
+          change.position = location.getPosition();
+          change.firstItem = static_cast<uint32_t>(result.items.size());
+          change.firstOrder = static_cast<uint32_t>(result.order.size());
+
+          bool reorder = false;
+          auto replace = [&result, &newTypes, &reorder](Item &item, uint16_t index) {
+            ItemType *newType = newTypes[item.getId()];
+            if (!newType)
+              return;
+
+            reorder |= stackRank(*newType) != stackRank(*item.itemType);
+            result.items.push_back({index, static_cast<uint16_t>(item.getId())});
+            item.itemType = newType;
+          };
+
+          if (tile.ground)
+            replace(*tile.ground, ItemReplacement::Ground);
+
+          for (size_t k = 0; k < tile.items.size(); ++k)
+          {
+            replace(tile.items[k], static_cast<uint16_t>(k));
+          }
+
+          change.itemCount = static_cast<uint16_t>(result.items.size() - change.firstItem);
+
+          if (reorder)
+          {
+            std::vector<uint16_t> order(tile.items.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&tile](uint16_t a, uint16_t b) {
+              return stackRank(*tile.items[a].itemType) < stackRank(*tile.items[b].itemType);
+            });
+
+            if (!std::is_sorted(order.begin(), order.end()))
+            {
+              util::appendVector(std::move(order), result.order);
+              change.orderCount = static_cast<uint16_t>(tile.items.size());
+              reorderStack(tile, result, change);
+            }
+          }
+
+          result.tiles.emplace_back(change);
+          partial.tiles.emplace_back(&tile);
+        }
+      }
+    }
+
+    return partial;
+  };
+
+  size_t taskCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t leavesPerTask = (leaves.size() + taskCount - 1) / taskCount;
+
+  std::vector<std::future<Partial>> tasks;
+  for (size_t start = 0; start < leaves.size(); start += leavesPerTask)
+  {
+    size_t end = std::min(start + leavesPerTask, leaves.size());
+    tasks.emplace_back(std::async(std::launch::async, replaceInLeaves, start, end));
+  }
+
+  ItemReplacement result;
+  for (auto &task : tasks)
+  {
+    Partial partial = task.get();
+    ItemReplacement &replacement = partial.replacement;
+
+    uint32_t itemOffset = static_cast<uint32_t>(result.items.size());
+    uint32_t orderOffset = static_cast<uint32_t>(result.order.size());
+
+    for (size_t i = 0; i < replacement.tiles.size(); ++i)
+    {
+      ItemReplacement::TileChange &change = replacement.tiles[i];
+      change.firstItem += itemOffset;
+      change.firstOrder += orderOffset;
+
+      // Marking and the ECS are not thread safe, so they are updated here
+      markDirty(change.position);
+
+      Tile &tile = *partial.tiles[i];
+      for (uint32_t k = 0; k < change.itemCount; ++k)
+      {
+        uint16_t index = replacement.items[change.firstItem - itemOffset + k].index;
+        updateItemAnimation(index == ItemReplacement::Ground ? *tile.ground : tile.items[index]);
+      }
+    }
+
+    util::appendVector(std::move(replacement.tiles), result.tiles);
+    util::appendVector(std::move(replacement.items), result.items);
+    util::appendVector(std::move(replacement.order), result.order);
+  }
+
+  return result;
+}
+
+PositionBitmap Map::selectArea(const Position &from, const Position &to, bool select)
+{
+  int x1 = static_cast<int>(std::min(from.x, to.x));
+  int x2 = static_cast<int>(std::max(from.x, to.x));
+  int y1 = static_cast<int>(std::min(from.y, to.y));
+  int y2 = static_cast<int>(std::max(from.y, to.y));
+  int z1 = std::min(from.z, to.z);
+  int z2 = std::max(from.z, to.z);
+
+  // Loading a leaf can decompress its group, so that is done before the parallel part
+  std::vector<quadtree::Node *> leaves;
+  for (int y = y1 & ~3; y <= y2; y += 4)
+  {
+    for (int x = x1 & ~3; x <= x2; x += 4)
+    {
+      if (quadtree::Node *leaf = getLeaf(x, y))
+        leaves.emplace_back(leaf);
+    }
+  }
+
+  auto selectInLeaves = [&leaves, x1, x2, y1, y2, z1, z2, select](size_t start, size_t end) {
+    PositionBitmap result;
+    for (size_t i = start; i < end; ++i)
+    {
+      quadtree::Node *leaf = leaves[i];
+      for (int z = z1; z <= z2; ++z)
+      {
+        Floor *floor = leaf->getFloor(z);
+        if (!floor)
+          continue;
+
+        uint16_t mask = 0;
+        Position position{};
+        for (uint32_t j = 0; j < MAP_TREE_CHILDREN_COUNT; ++j)
+        {
+          TileLocation &location = floor->getTileLocation(j);
+          const Tile *tile = location.getTile();
+          if (!tile)
+            continue;
+
+          position = location.getPosition();
+          if (position.x < x1 || position.x > x2 || position.y < y1 || position.y > y2)
+            continue;
+
+          // A shared tile never has a selection, so only tiles that change are unshared
+          if (select)
+          {
+            if (tile->isEmpty() || tile->allSelected())
+              continue;
+
+            location.getMutableTile()->selectAll();
+          }
+          else
+          {
+            if (!tile->hasSelection())
+              continue;
+
+            location.getMutableTile()->deselectAll();
+          }
+
+          mask |= 1 << ((position.x & 3) * 4 + (position.y & 3));
+        }
+
+        if (mask != 0)
+          result.insertMask(position.x, position.y, z, mask);
+      }
+    }
+
+    return result;
+  };
+
+  size_t taskCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t leavesPerTask = (leaves.size() + taskCount - 1) / taskCount;
+
+  std::vector<std::future<PositionBitmap>> tasks;
+  for (size_t start = 0; start < leaves.size(); start += leavesPerTask)
+  {
+    size_t end = std::min(start + leavesPerTask, leaves.size());
+    tasks.emplace_back(std::async(std::launch::async, selectInLeaves, start, end));
+  }
+
+  PositionBitmap result;
+  for (auto &task : tasks)
+  {
+    result.insert(task.get());
+  }
+
+  // Marking is not thread safe, so it is done here, once per chunk
+  for (const auto &[key, chunk] : result.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    markDirty(Position{x, y, 0});
+  }
+
+  return result;
+}
+
+SelectionMove Map::moveSelection(const PositionBitmap &positions, const Position &delta)
+{
+  SelectionMove move;
+  move.delta = delta;
+  move.positions = positions;
+
+  applySelectionMove(move);
+  return move;
+}
+
+void Map::applySelectionMove(SelectionMove &move)
+{
+  if (move.applied)
+    undoSelectionMove(move);
+  else
+    doSelectionMove(move);
+
+  move.applied = !move.applied;
+}
+
+void Map::doSelectionMove(SelectionMove &move)
+{
+  const Position delta = move.delta;
+  bool chunkAligned = (delta.x & 3) == 0 && (delta.y & 3) == 0;
+
+  DEBUG_ASSERT(move.positions.empty() || (isInBounds(move.positions.getBounds()->from + delta) && isInBounds(move.positions.getBounds()->to + delta)),
+               "The moved selection must be within the map.");
+
+  struct SourceChunk
+  {
+    quadtree::Node *leaf;
+    const PositionBitmap::Chunk *selected;
+  };
+
+  // Loading a leaf can decompress its group, so that is done before the parallel part
+  std::vector<SourceChunk> sources;
+  for (const auto &[key, chunk] : move.positions.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    if (quadtree::Node *leaf = getLeaf(x, y))
+      sources.push_back({leaf, &chunk});
+  }
+
+  struct MovedTile
+  {
+    Position destination;
+    std::unique_ptr<Tile> tile;
+  };
+
+  struct MovedFloor
+  {
+    // The destination of the top-left tile of the floor
+    Position destination;
+    std::unique_ptr<Floor> floor;
+  };
+
+  struct Extracted
+  {
+    std::vector<MovedTile> wholeTiles;
+    // The selected items of the tiles that are not moved whole
+    std::vector<MovedTile> partialTiles;
+    std::vector<MovedFloor> floors;
+    std::vector<std::pair<Position, std::unique_ptr<Tile>>> replaced;
+    PositionBitmap whole;
+  };
+
+  // The tiles of the floor if they are all moved whole, otherwise 0
+  auto wholeFloorTiles = [](Floor &floor, uint16_t selected) {
+    uint16_t tiles = 0;
+    for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+    {
+      const Tile *tile = floor.getTileLocation(i).getTile();
+      if (!tile)
+        continue;
+
+      if (!(selected & (1 << i)) || !tile->allSelected())
+        return uint16_t(0);
+
+      tiles |= 1 << i;
+    }
+
+    return tiles;
+  };
+
+  auto extract = [&sources, &delta, &wholeFloorTiles, chunkAligned](size_t start, size_t end) {
+    Extracted result;
+    for (size_t i = start; i < end; ++i)
+    {
+      quadtree::Node *leaf = sources[i].leaf;
+      for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
+      {
+        uint16_t selected = sources[i].selected->floors[z];
+        Floor *floor = leaf->getFloor(z);
+        if (selected == 0 || !floor)
+          continue;
+
+        uint16_t tiles = chunkAligned ? wholeFloorTiles(*floor, selected) : 0;
+        if (tiles != 0)
+        {
+          result.whole.insertMask(leaf->getX(), leaf->getY(), z, tiles);
+          result.floors.push_back({Position{leaf->getX() + delta.x, leaf->getY() + delta.y, z + delta.z}, std::move(leaf->children[z])});
+          continue;
+        }
+
+        for (uint32_t j = 0; j < MAP_TREE_CHILDREN_COUNT; ++j)
+        {
+          TileLocation &location = floor->getTileLocation(j);
+          const Tile *tile = location.getTile();
+          if (!(selected & (1 << j)) || !tile || !tile->hasSelection())
+            continue;
+
+          Position position = location.getPosition();
+          Position destination = position + delta;
+          if (tile->allSelected())
+          {
+            result.whole.insert(position);
+            result.wholeTiles.push_back({destination, location.dropTile()});
+          }
+          else
+          {
+            // A tile with a selection is never shared, so this does not copy
+            Tile &source = *location.getMutableTile();
+            result.replaced.emplace_back(position, std::make_unique<Tile>(source.deepCopy()));
+
+            std::unique_ptr<Tile> moved(new Tile(destination));
+            source.moveSelected(*moved);
+            result.partialTiles.push_back({destination, std::move(moved)});
+          }
+        }
+      }
+    }
+
+    return result;
+  };
+
+  size_t taskCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+
+  std::vector<Extracted> extracted;
+  {
+    size_t chunksPerTask = (sources.size() + taskCount - 1) / taskCount;
+    std::vector<std::future<Extracted>> tasks;
+    for (size_t start = 0; start < sources.size(); start += chunksPerTask)
+    {
+      size_t end = std::min(start + chunksPerTask, sources.size());
+      tasks.emplace_back(std::async(std::launch::async, extract, start, end));
+    }
+
+    for (auto &task : tasks)
+    {
+      extracted.emplace_back(task.get());
+    }
+  }
+
+  // Partially selected sources, recorded as they were before the move
+  PositionBitmap partialSources;
+  for (Extracted &part : extracted)
+  {
+    move.wholeTiles.insert(part.whole);
+    for (const auto &[position, tile] : part.replaced)
+    {
+      partialSources.insert(position);
+    }
+    util::appendVector(std::move(part.replaced), move.replaced);
+  }
+
+  struct DestinationChunk
+  {
+    quadtree::Node *leaf;
+    std::vector<MovedTile *> tiles;
+    std::vector<MovedFloor *> floors;
+  };
+
+  std::vector<DestinationChunk> destinations;
+  std::unordered_map<uint32_t, size_t> destinationIndex;
+  auto getDestination = [this, &destinations, &destinationIndex](const Position &position) -> DestinationChunk & {
+    auto [found, inserted] = destinationIndex.try_emplace(ChunkKey::of(position.x, position.y), destinations.size());
+    if (inserted)
+      destinations.push_back({&getOrCreateLeaf(position.x, position.y), {}, {}});
+
+    return destinations[found->second];
+  };
+
+  for (Extracted &part : extracted)
+  {
+    for (MovedTile &moved : part.wholeTiles)
+    {
+      getDestination(moved.destination).tiles.push_back(&moved);
+    }
+    for (MovedFloor &moved : part.floors)
+    {
+      getDestination(moved.destination).floors.push_back(&moved);
+    }
+  }
+
+  struct Placed
+  {
+    std::vector<std::pair<Position, std::unique_ptr<Tile>>> replaced;
+    // Tiles that are replaced without being recorded. They can own ECS entities,
+    // so they are destroyed after the parallel part.
+    std::vector<std::unique_ptr<Tile>> discarded;
+  };
+
+  auto place = [&destinations, &partialSources, &delta](size_t start, size_t end) {
+    Placed result;
+
+    auto placeTile = [&result, &partialSources](quadtree::Node &leaf, const Position &destination, std::unique_ptr<Tile> tile) {
+      TileLocation &location = leaf.getOrCreateTileLocation(destination);
+      if (location.hasTile())
+      {
+        // The rest of a partially selected source is already recorded
+        if (partialSources.contains(destination))
+          result.discarded.emplace_back(location.dropTile());
+        else
+          result.replaced.emplace_back(destination, location.dropTile());
+      }
+
+      location.setTile(std::move(tile));
+    };
+
+    for (size_t i = start; i < end; ++i)
+    {
+      quadtree::Node &leaf = *destinations[i].leaf;
+      for (MovedFloor *moved : destinations[i].floors)
+      {
+        int z = moved->destination.z;
+        if (!leaf.children[z])
+        {
+          moved->floor->setPosition(leaf.getX(), leaf.getY(), z);
+          leaf.children[z] = std::move(moved->floor);
+          continue;
+        }
+
+        // The destination floor has tiles, so the tiles are moved one by one
+        for (uint32_t j = 0; j < MAP_TREE_CHILDREN_COUNT; ++j)
+        {
+          TileLocation &location = moved->floor->getTileLocation(j);
+          if (location.hasTile())
+            placeTile(leaf, location.getPosition() + delta, location.dropTile());
+        }
+      }
+
+      for (MovedTile *moved : destinations[i].tiles)
+      {
+        placeTile(leaf, moved->destination, std::move(moved->tile));
+      }
+    }
+
+    return result;
+  };
+
+  {
+    size_t chunksPerTask = (destinations.size() + taskCount - 1) / taskCount;
+    std::vector<std::future<Placed>> tasks;
+    for (size_t start = 0; start < destinations.size(); start += chunksPerTask)
+    {
+      size_t end = std::min(start + chunksPerTask, destinations.size());
+      tasks.emplace_back(std::async(std::launch::async, place, start, end));
+    }
+
+    for (auto &task : tasks)
+    {
+      Placed placed = task.get();
+      util::appendVector(std::move(placed.replaced), move.replaced);
+    }
+  }
+
+  // Adding items to a stack can remove other items (see Tile::moveSelected), which
+  // destroys their ECS entities, so the partially selected tiles are merged here
+  for (Extracted &part : extracted)
+  {
+    for (MovedTile &moved : part.partialTiles)
+    {
+      TileLocation &location = getOrCreateTileLocation(moved.destination);
+      if (!partialSources.contains(moved.destination))
+      {
+        // A whole source has been emptied, and its tile is restored separately
+        bool keep = location.hasTile() && !move.wholeTiles.contains(moved.destination);
+        move.replaced.emplace_back(moved.destination, keep ? std::make_unique<Tile>(location.getTile()->deepCopy()) : nullptr);
+      }
+
+      if (!location.hasTile())
+        location.setEmptyTile();
+
+      moved.tile->moveSelected(*location.getMutableTile());
+    }
+  }
+
+  for (const auto &[key, chunk] : move.positions.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    markDirty(Position{x, y, 0});
+
+    for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
+    {
+      if (chunk.floors[z] != 0)
+        releaseIfEmpty(Position{x, y, z});
+    }
+  }
+
+  for (const DestinationChunk &destination : destinations)
+  {
+    markDirty(Position{destination.leaf->getX(), destination.leaf->getY(), 0});
+  }
+}
+
+void Map::undoSelectionMove(SelectionMove &move)
+{
+  // A destination can be the source of another tile, so all whole tiles are taken
+  // out before anything is put back
+  std::vector<std::unique_ptr<Tile>> wholeTiles;
+  wholeTiles.reserve(move.wholeTiles.size());
+  for (const Position &position : move.wholeTiles)
+  {
+    TileLocation *location = getTileLocation(position + move.delta);
+    DEBUG_ASSERT(location && location->hasTile(), "A moved tile is missing.");
+
+    markDirty(location->getPosition());
+    wholeTiles.emplace_back(location->dropTile());
+  }
+
+  for (auto &[position, tile] : move.replaced)
+  {
+    TileLocation &location = getOrCreateTileLocation(position);
+    if (!tile)
+    {
+      if (location.hasTile())
+        location.removeTile();
+
+      continue;
+    }
+
+    // The recorded copies of modified tiles have no animations
+    auto restoreAnimation = [](Item &item) {
+      if (!item.isEntity() && item.itemType->appearance->getSpriteInfo().hasAnimation())
+        updateItemAnimation(item);
+    };
+
+    if (tile->ground)
+      restoreAnimation(*tile->ground);
+    for (Item &item : tile->items)
+    {
+      restoreAnimation(item);
+    }
+
+    location.setTile(std::move(tile));
+  }
+
+  size_t i = 0;
+  for (const Position &position : move.wholeTiles)
+  {
+    getOrCreateTileLocation(position).setTile(std::move(wholeTiles[i++]));
+  }
+
+  for (const auto &[position, tile] : move.replaced)
+  {
+    releaseIfEmpty(position);
+  }
+
+  PositionBitmap destinations = move.positions.translated(move.delta);
+  for (const auto &[key, chunk] : destinations.getChunks())
+  {
+    auto [x, y] = ChunkKey::position(key);
+    for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
+    {
+      if (chunk.floors[z] != 0)
+        releaseIfEmpty(Position{x, y, z});
+    }
+  }
+
+  move.replaced.clear();
+  move.wholeTiles.clear();
+}
+
+void Map::applyItemReplacement(ItemReplacement &replacement)
+{
+  for (ItemReplacement::TileChange &change : replacement.tiles)
+  {
+    Tile *tile = getMutableTile(change.position);
+    DEBUG_ASSERT(tile != nullptr, "The tile of an item replacement no longer exists.");
+
+    auto itemAt = [tile](uint16_t index) -> Item & {
+      return index == ItemReplacement::Ground ? *tile->ground : tile->items.at(index);
+    };
+
+    for (uint32_t i = change.firstItem; i < change.firstItem + change.itemCount; ++i)
+    {
+      ItemReplacement::ItemChange &itemChange = replacement.items[i];
+      Item &item = itemAt(itemChange.index);
+
+      uint16_t serverId = static_cast<uint16_t>(item.getId());
+      item.itemType = Items::items.getItemType(itemChange.serverId);
+      itemChange.serverId = serverId;
+    }
+
+    if (change.orderCount != 0)
+    {
+      reorderStack(*tile, replacement, change);
+    }
+
+    for (uint32_t i = change.firstItem; i < change.firstItem + change.itemCount; ++i)
+    {
+      updateItemAnimation(itemAt(replacement.items[i].index));
+    }
+  }
+}
+
+void Map::applyTileEdit(TileEdit &edit)
+{
+  Tile &tile = getOrCreateTile(edit.position);
+
+  for (TileEdit::Step &step : edit.steps)
+  {
+    switch (step.operation)
+    {
+    case TileEdit::Operation::InsertItem:
+    {
+      DEBUG_ASSERT(step.index <= tile.items.size(), "The stack of the tile has changed since the edit.");
+      if (step.item->selected)
+        ++tile.selectionCount;
+
+      tile.items.emplace(tile.items.begin() + step.index, std::move(*step.item));
+      step.item.reset();
+      step.operation = TileEdit::Operation::RemoveItem;
+      break;
+    }
+    case TileEdit::Operation::RemoveItem:
+    {
+      DEBUG_ASSERT(step.index < tile.items.size(), "The stack of the tile has changed since the edit.");
+      if (tile.items[step.index].selected)
+        --tile.selectionCount;
+
+      step.item = std::make_unique<Item>(std::move(tile.items[step.index]));
+      tile.items.erase(tile.items.begin() + step.index);
+      step.operation = TileEdit::Operation::InsertItem;
+      break;
+    }
+    case TileEdit::Operation::SetGround:
+    {
+      if (tile.ground && tile.ground->selected)
+        --tile.selectionCount;
+      if (step.item && step.item->selected)
+        ++tile.selectionCount;
+
+      std::swap(tile.ground, step.item);
+      break;
+    }
+    case TileEdit::Operation::SetFlags:
+      std::swap(tile.flags, step.flags);
+      break;
+    }
+  }
+
+  std::reverse(edit.steps.begin(), edit.steps.end());
+
+  if (tile.isEmpty() && tile.flags == 0)
+  {
+    removeTile(edit.position);
+  }
+}
+
+void Map::reorderStack(Tile &tile, ItemReplacement &replacement, ItemReplacement::TileChange &change)
+{
+  DEBUG_ASSERT(change.orderCount == tile.items.size(), "The stack of the tile has changed since the item replacement.");
+
+  uint16_t *order = &replacement.order[change.firstOrder];
+
+  std::vector<Item> items;
+  items.reserve(tile.items.size());
+  for (uint16_t i = 0; i < change.orderCount; ++i)
+  {
+    items.emplace_back(std::move(tile.items[order[i]]));
+  }
+  tile.items = std::move(items);
+
+  // The item at old index order[i] is now at index i
+  std::vector<uint16_t> inverse(change.orderCount);
+  for (uint16_t i = 0; i < change.orderCount; ++i)
+  {
+    inverse[order[i]] = i;
+  }
+
+  for (uint32_t i = change.firstItem; i < change.firstItem + change.itemCount; ++i)
+  {
+    uint16_t &index = replacement.items[i].index;
+    if (index != ItemReplacement::Ground)
+      index = inverse[index];
+  }
+
+  std::copy(inverse.begin(), inverse.end(), order);
+}
+
+void Map::updateItemAnimation(Item &item)
+{
+  // The animation belongs to the item type, so the old one can not be kept
+  item.destroyEntity();
+
+  const SpriteInfo &spriteInfo = item.itemType->appearance->getSpriteInfo();
+  if (spriteInfo.hasAnimation())
+  {
+    ecs::EntityId entityId = item.assignNewEntityId();
+    g_ecs.addComponent(entityId, ItemAnimationComponent(spriteInfo.getAnimation()));
+  }
+}
+
+uint64_t Map::getHash() const
+{
+  return storage->getHash();
+}
+
+MapStorage::Totals Map::getTotals() const
+{
+  return storage->getTotals();
+}
+
+size_t Map::shareIdenticalTiles()
+{
+  std::vector<quadtree::Node *> leaves;
+  storage->getLeaves(leaves);
+
+  auto forEachLocation = [&leaves](auto f) {
+    for (quadtree::Node *leaf : leaves)
+    {
+      for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+      {
+        Floor *floor = leaf->getFloor(z);
+        if (!floor)
+          continue;
+
+        for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+        {
+          TileLocation &location = floor->getTileLocation(i);
+          if (location.hasTile())
+            f(location);
+        }
+      }
+    }
+  };
+
+  // Only contents that occur more than once are worth sharing
+  std::unordered_map<uint64_t, uint32_t> occurrences;
+  forEachLocation([&occurrences](TileLocation &location) {
+    const Tile *tile = location.getTile();
+    if (!tile->isEmpty() && TilePool::canShare(*tile))
+      ++occurrences[tile->contentHash()];
+  });
+
+  size_t shared = 0;
+  forEachLocation([this, &occurrences, &shared](TileLocation &location) {
+    if (!location.isShared())
+    {
+      const Tile *tile = location.getTile();
+      if (tile->isEmpty() || !TilePool::canShare(*tile))
+        return;
+
+      auto found = occurrences.find(tile->contentHash());
+      if (found == occurrences.end() || found->second < 2)
+        return;
+
+      // The content does not change, so the content hashes stay valid
+      location.setSharedTile(tilePool.intern(*tile));
+    }
+
+    ++shared;
+  });
+
+  tilePool.prune();
+
+  return shared;
+}
+
+bool Map::usePageFile(const std::filesystem::path &path)
+{
+  return compressedChunks.usePageFile(path);
+}
+
+size_t Map::compressInactiveChunks(uint32_t idleSeconds, size_t maxChunks)
+{
+  accessTick = static_cast<uint32_t>(created.elapsedMillis() / 1000);
+
+  // The index reads the modified leaves, so it must be updated while they are still decompressed
+  itemIndex.update(*storage);
+
+  std::vector<quadtree::Node *> leaves;
+  storage->getLeaves(leaves);
+
+  auto isInactive = [this, idleSeconds](const quadtree::Node &leaf) {
+    return accessTick - leaf.lastAccess >= idleSeconds && CompressedChunks::canCompress(leaf);
+  };
+
+  // Leaves that are close on the map are close in 'leaves', so the groups are local
+  std::vector<quadtree::Node *> group;
+  size_t compressed = 0;
+  for (quadtree::Node *leaf : leaves)
+  {
+    if (compressed + group.size() >= maxChunks)
+      break;
+
+    if (leaf->compressed || !isInactive(*leaf))
+      continue;
+
+    // A group that was decompressed is evicted as a whole, without compressing it again if it is unchanged
+    if (compressedChunks.hasGroup(*leaf))
+    {
+      compressed += compressedChunks.evict(*leaf, isInactive);
+      if (compressedChunks.hasGroup(*leaf))
+        continue;
+    }
+
+    group.emplace_back(leaf);
+    if (group.size() == CompressedChunks::GroupSize)
+    {
+      compressedChunks.compress(group);
+      compressed += group.size();
+      group.clear();
+    }
+  }
+
+  compressedChunks.compress(group);
+  compressed += group.size();
+
+  return compressed;
+}
+
+MapStats Map::stats() const
+{
+  std::vector<quadtree::Node *> leaves;
+  storage->getLeaves(leaves);
+
+  size_t taskCount = std::max<size_t>(1, std::thread::hardware_concurrency());
+  size_t leavesPerTask = (leaves.size() + taskCount - 1) / taskCount;
+
+  std::vector<std::future<MapStats>> tasks;
+  for (size_t start = 0; start < leaves.size(); start += leavesPerTask)
+  {
+    size_t end = std::min(start + leavesPerTask, leaves.size());
+    tasks.emplace_back(std::async(std::launch::async, [&leaves, start, end]() {
+      MapStats partial;
+      for (size_t i = start; i < end; ++i)
+      {
+        partial.addLeaf(*leaves[i]);
+      }
+      return partial;
+    }));
+  }
+
+  MapStats result;
+  for (auto &task : tasks)
+  {
+    result += task.get();
+  }
+
+  result.nodes = storage->getNodeCount();
+  result.leaves = leaves.size();
+  result.bytes.storage = storage->getMemoryUsage();
+  result.bytes.sharedTiles = tilePool.getMemoryUsage();
+  result.bytes.itemIndex = itemIndex.getMemoryUsage();
+  result.compressedLeaves = compressedChunks.size();
+  result.bytes.compressedLeaves = compressedChunks.getMemoryUsage();
+  result.pageFileSize = compressedChunks.getPageFileSize();
+
+  return result;
+}
+
 bool Map::isTileEmpty(const Position pos) const
 {
-  Tile *tile = getTile(pos);
+  const Tile *tile = getTile(pos);
   return !tile || tile->isEmpty();
 }
 
-Tile *Map::getTile(const Position pos) const
+Tile *Map::getMutableTile(const Position pos)
 {
-  auto leaf = root.getLeafUnsafe(pos.x, pos.y);
+  TileLocation *location = getTileLocation(pos);
+  if (!location || !location->hasTile())
+    return nullptr;
+
+  markDirty(pos);
+  return location->getMutableTile();
+}
+
+const Tile *Map::getTile(const Position pos) const
+{
+  auto leaf = getLeaf(pos.x, pos.y);
   if (!leaf)
     return nullptr;
 
@@ -129,20 +1240,22 @@ Tile *Map::getTile(const Position pos) const
 
 Tile &Map::getOrCreateTile(int x, int y, int z)
 {
-  DEBUG_ASSERT(root.isRoot(), "Only root nodes can create a tile.");
-  auto &leaf = root.getLeafWithCreate(x, y);
+  DEBUG_ASSERT(isInBounds(Position{x, y, z}), "The position is outside of the map.");
+  auto &leaf = getOrCreateLeaf(x, y);
 
   DEBUG_ASSERT(leaf.isLeaf(), "The node must be a leaf node.");
 
   Floor &floor = leaf.getOrCreateFloor(x, y, z);
   TileLocation &location = floor.getTileLocation(x, y);
+  // The caller gets mutable access to the tile
+  markDirty(location.getPosition());
 
-  if (!location.getTile())
+  if (!location.hasTile())
   {
     location.setTile(std::make_unique<Tile>(location));
   }
 
-  return *location.getTile();
+  return *location.getMutableTile();
 }
 
 TileLocation *Map::getTileLocation(const Position &pos) const
@@ -153,11 +1266,12 @@ TileLocation *Map::getTileLocation(const Position &pos) const
 TileLocation *Map::getTileLocation(int x, int y, int z) const
 {
   DEBUG_ASSERT(z >= 0 && z < MAP_LAYERS, "Z value '" + std::to_string(z) + "' is out of bounds.");
-  quadtree::Node *leaf = root.getLeafUnsafe(x, y);
+  quadtree::Node *leaf = getLeaf(x, y);
   if (leaf)
   {
     Floor *floor = leaf->getFloor(z);
-    return &floor->getTileLocation(x, y);
+    if (floor)
+      return &floor->getTileLocation(x, y);
   }
 
   return nullptr;
@@ -165,27 +1279,65 @@ TileLocation *Map::getTileLocation(int x, int y, int z) const
 
 TileLocation &Map::getOrCreateTileLocation(const Position &pos)
 {
-  auto &leaf = root.getLeafWithCreate(pos.x, pos.y);
+  DEBUG_ASSERT(isInBounds(pos), "The position is outside of the map.");
+  auto &leaf = getOrCreateLeaf(pos.x, pos.y);
   TileLocation &location = leaf.getOrCreateTileLocation(pos);
+  markDirty(pos);
 
   return location;
 }
 
+const ChunkSummary *Map::getChunkSummary(int x, int y) const
+{
+  quadtree::Node *leaf = storage->getLeaf(x, y);
+  return leaf ? &leaf->getSummary() : nullptr;
+}
+
 quadtree::Node *Map::getLeafUnsafe(int x, int y)
 {
-  return root.getLeafUnsafe(x, y);
+  return getLeaf(x, y);
+}
+
+quadtree::Node *Map::getLeaf(int x, int y) const
+{
+  quadtree::Node *leaf = storage->getLeaf(x, y);
+  if (leaf)
+  {
+    loadLeaf(*leaf);
+  }
+
+  return leaf;
+}
+
+quadtree::Node &Map::getOrCreateLeaf(int x, int y)
+{
+  quadtree::Node &leaf = storage->getOrCreateLeaf(x, y);
+  loadLeaf(leaf);
+
+  return leaf;
+}
+
+void Map::loadLeaf(quadtree::Node &leaf) const
+{
+  if (leaf.compressed)
+  {
+    compressedChunks.decompress(leaf, tilePool);
+  }
+
+  leaf.lastAccess = accessTick;
 }
 
 MapIterator *MapIterator::nextFromLeaf()
 {
-  quadtree::Node *node = stack.top().node;
+  quadtree::Node *node = (*leaves)[leafIndex];
   DEBUG_ASSERT(node->isLeaf(), "The node must be a leaf node.");
+  map->loadLeaf(*node);
 
-  for (int z = this->floorIndex; z < MAP_LAYERS; ++z)
+  for (uint32_t z = this->floorIndex; z < MAP_LAYERS; ++z)
   {
     if (Floor *floor = node->getFloor(z))
     {
-      for (uint32_t i = this->tileIndex; i < MAP_LAYERS; ++i)
+      for (uint32_t i = this->tileIndex; i < MAP_TREE_CHILDREN_COUNT; ++i)
       {
         TileLocation &location = floor->getTileLocation(i);
         if (location.hasTile() && (location.getTile()->getItems().size() > 0 || location.getTile()->getGround()))
@@ -197,52 +1349,23 @@ MapIterator *MapIterator::nextFromLeaf()
           return this;
         }
       }
-      // Reset tile index before iterating next floor
-      this->tileIndex = 0;
     }
+    // Reset tile index before iterating next floor
+    this->tileIndex = 0;
   }
 
   return nullptr;
 }
 
-void MapIterator::emplace(quadtree::Node *node)
-{
-  stack.emplace(node);
-}
-
 MapIterator Map::begin()
 {
   MapIterator iterator;
-  iterator.emplace(&this->root);
-
-  while (!iterator.stack.empty())
-  {
-    MapIterator::NodeIndex &current = iterator.stack.top();
-
-    if (current.node->isLeaf())
-    {
-      auto next = iterator.nextFromLeaf();
-      return next ? *next : end();
-    }
+  iterator.map = this;
+  iterator.leaves = std::make_shared<std::vector<quadtree::Node *>>();
+  storage->getLeaves(*iterator.leaves);
 
-    uint32_t size = static_cast<uint32_t>(current.node->nodes.size());
-    for (uint32_t i = current.cursor; i < size; ++i)
-    {
-      if (auto &child = current.node->nodes[i])
-      {
-        current.cursor = i + 1;
-        iterator.emplace(child.get());
-        break;
-      }
-    }
-
-    if (&iterator.stack.top().node == &current.node)
-    {
-      return end();
-    }
-  }
-
-  return end();
+  ++iterator;
+  return iterator;
 }
 
 void MapIterator::finish()
@@ -254,42 +1377,16 @@ void MapIterator::finish()
 
 MapIterator &MapIterator::operator++()
 {
-  while (!stack.empty())
+  while (leaves && leafIndex < leaves->size())
   {
-    MapIterator::NodeIndex &current = stack.top();
-
-    if (current.node->isLeaf())
+    if (nextFromLeaf())
     {
-      auto next = nextFromLeaf();
-      if (!next)
-      {
-        stack.pop();
-        continue;
-      }
-
-      return *next;
+      return *this;
     }
 
-    tileIndex = 0;
+    ++leafIndex;
     floorIndex = 0;
-
-    size_t size = current.node->nodes.size();
-    // This node is finished
-    if (current.cursor == size)
-    {
-      stack.pop();
-      continue;
-    }
-
-    for (; current.cursor < size; ++current.cursor)
-    {
-      if (auto &child = current.node->nodes[current.cursor])
-      {
-        current.cursor += 1;
-        emplace(child.get());
-        break;
-      }
-    }
+    tileIndex = 0;
   }
 
   this->finish();
@@ -13,14 +13,29 @@
 #include "tile.h"
 #include "tile_location.h"
 #include "quad_tree.h"
+#include "map_storage.h"
+#include "map_stats.h"
+#include "tile_pool.h"
+#include "compressed_chunks.h"
+#include "item_index.h"
+#include "item_replacement.h"
+#include "position_bitmap.h"
+#include "selection_move.h"
+#include "tile_edit.h"
+#include "chunk_changes.h"
 #include "position.h"
 #include "util.h"
+#include "time.h"
 
 #include "town.h"
 
 #include "version.h"
 
 class MapView;
+namespace MapIO
+{
+	class Loader;
+}
 
 class MapRegion
 {
@@ -115,8 +130,6 @@ public:
 		return *this;
 	}
 
-	MapIterator *nextFromLeaf();
-
 	MapIterator end()
 	{
 		MapIterator iterator;
@@ -127,8 +140,6 @@ public:
 	// Mark the iterator as finished
 	void finish();
 
-	void emplace(quadtree::Node *node);
-
 	TileLocation *operator*();
 	TileLocation *operator->();
 	MapIterator &operator++();
@@ -145,36 +156,27 @@ public:
 		return !(other == *this);
 	}
 
-	struct NodeIndex
-	{
-		uint32_t cursor = 0;
-		quadtree::Node *node;
-
-		NodeIndex(quadtree::Node *node) : cursor(0), node(node) {}
-
-		// bool operator==(const NodeIndex &other)
-		// {
-		// 	return other.cursor == cursor && &other.node == &node;
-		// }
-		// bool operator==(NodeIndex &other)
-		// {
-		// 	return other.cursor == cursor && &other.node == &node;
-		// }
-	};
-
 	friend class Map;
 
 private:
-	std::stack<NodeIndex> stack{};
+	const Map *map = nullptr;
+	// Shared between copies of the iterator, since range-based for loops copy it.
+	std::shared_ptr<std::vector<quadtree::Node *>> leaves;
+	size_t leafIndex = 0;
+
 	uint32_t tileIndex = 0;
 	uint32_t floorIndex = 0;
 	TileLocation *value = nullptr;
+
+	MapIterator *nextFromLeaf();
 };
 
 class Map
 {
 public:
 	Map();
+	Map(MapStorageType storageType);
+	Map(uint16_t width, uint16_t height, MapStorageType storageType = MapStorageType::QuadTree);
 
 	MapIterator begin();
 	MapIterator end();
@@ -183,7 +185,11 @@ public:
 
 	TileLocation *getTileLocation(int x, int y, int z) const;
 	TileLocation *getTileLocation(const Position &pos) const;
-	Tile *getTile(const Position pos) const;
+	/*
+		The tile may be shared (see TileLocation::getTile). Use getMutableTile to modify it.
+	*/
+	const Tile *getTile(const Position pos) const;
+	Tile *getMutableTile(const Position pos);
 
 	bool isTileEmpty(const Position pos) const;
 
@@ -193,6 +199,14 @@ public:
 	uint16_t getWidth() const;
 	uint16_t getHeight() const;
 
+	/*
+		Resize the map. Memory is only used for the parts of the map that contain
+		tiles, so a large size does not cost anything by itself.
+	*/
+	void setSize(uint16_t width, uint16_t height);
+
+	bool isInBounds(const Position &pos) const;
+
 	Towns &getTowns()
 	{
 		return towns;
@@ -203,17 +217,183 @@ public:
 	*/
 	void clear();
 
+	/*
+		Count the contents and approximate memory usage of the map. The leaves are
+		processed in parallel, so this must not run concurrently with edits.
+	*/
+	MapStats stats() const;
+
+	/*
+		Number of tiles and items in the map. Unlike stats(), this only looks at
+		the chunks that changed since the last call (see MapStorage::getTotals).
+	*/
+	MapStorage::Totals getTotals() const;
+
+	/*
+		Content hash of the whole map. Edits only invalidate the hashes on the path
+		from the edited leaf to the root, so this is cheap to call repeatedly.
+	*/
+	uint64_t getHash() const;
+
+	/*
+		Let all tiles with identical content (that occur more than once) share a
+		single immutable copy. Returns the number of locations that share a tile
+		afterwards. Tiles are unshared again when they are modified.
+	*/
+	size_t shareIdenticalTiles();
+
+	/*
+		LZMA compress the chunks that have not been accessed through the map (or a
+		MapRegion) during the last 'idleSeconds' seconds. Compressed chunks are
+		decompressed transparently the next time they are accessed. At most
+		'maxChunks' chunks are compressed, to bound the time spent in one call.
+		Returns the number of chunks that were compressed.
+	*/
+	size_t compressInactiveChunks(uint32_t idleSeconds, size_t maxChunks = SIZE_MAX);
+
+	/*
+		Store the compressed data of inactive chunks in a page file on disk instead
+		of in memory. Only the compressed groups are spilled to disk: every chunk,
+		compressed or not, keeps its leaf node (position, hash, item filter and
+		summary), its item index entry and its place in a group in memory, about
+		400 bytes per chunk. The memory usage of the map therefore still grows with
+		the number of chunks, only much more slowly than with the tiles in memory.
+		Returns false if the file can not be created.
+	*/
+	bool usePageFile(const std::filesystem::path &path);
+
+	/*
+		Number of items with the server id on the map. Uses the item index, so the
+		map is not scanned.
+	*/
+	uint32_t countItems(uint16_t serverId) const;
+
+	/*
+		Positions of the tiles that contain an item with the server id, ordered by
+		floor, then y, then x. Only the chunks that contain the item are visited.
+	*/
+	std::vector<Position> findItems(uint16_t serverId) const;
+
+	/*
+		The first position after 'after' (in the order of findItems) with an item
+		with the server id. Wraps around to the first position.
+	*/
+	std::optional<Position> findNextItem(uint16_t serverId, const Position &after) const;
+
+	/*
+		Positions of the tiles between 'from' and 'to' (inclusive, on all floors in
+		between) that contain an item with any of the server ids, in the order of
+		findItems. Chunks are skipped without being opened when their item filter
+		rules out all of the ids (see quadtree::Node::getItemFilter).
+	*/
+	std::vector<Position> findItems(const std::vector<uint16_t> &serverIds, const Position &from, const Position &to) const;
+
+	/*
+		Replace the items (ground included) with a server id in 'mapping' by items
+		with the mapped server id, on the whole map. Only the chunks that contain
+		such items (according to the item index) are visited, and they are processed
+		in parallel. An item is never moved between the ground and the stack, so
+		mappings between ground and non-ground items are ignored. Stacks are only
+		reordered where a replacement changes which part of the stack an item
+		belongs in (see Tile::addItem).
+
+		Returns what is needed to undo the replacement (see applyItemReplacement).
+	*/
+	ItemReplacement replaceItems(const std::unordered_map<uint16_t, uint16_t> &mapping);
+
+	/*
+		Swap the item ids (and stack order) of the map with the ones stored in the
+		replacement. The replacement then describes how to undo the swap.
+	*/
+	void applyItemReplacement(ItemReplacement &replacement);
+
+	/*
+		Perform the steps of the edit on the tile at its position, and turn the
+		edit into its inverse (see TileEdit). The tile is created if it does not
+		exist, and removed if the edit leaves it empty.
+	*/
+	void applyTileEdit(TileEdit &edit);
+
+	/*
+		Select (or deselect) every item on the tiles between 'from' and 'to'
+		(inclusive, on all floors in between). The chunks are processed in parallel.
+		Returns the positions of the tiles whose selection changed.
+	*/
+	PositionBitmap selectArea(const Position &from, const Position &to, bool select = true);
+
+	/*
+		Move the selected items at 'positions' by 'delta'. The moved items replace
+		the tiles at their destination if the ground is moved, and are added to them
+		otherwise. Tiles whose items are all selected are moved whole, and when the
+		move is by whole chunks, a floor whose tiles are all moved whole is moved to
+		its new chunk as a unit. The source chunks, and then the destination chunks,
+		are processed in parallel. All moved positions must be within the map.
+
+		Returns what is needed to undo the move (see applySelectionMove).
+	*/
+	SelectionMove moveSelection(const PositionBitmap &positions, const Position &delta);
+
+	/*
+		Undo the selection move if it is applied, or redo it if it has been undone.
+	*/
+	void applySelectionMove(SelectionMove &move);
+
+	/*
+		Summary of the chunk that contains (x, y), or nullptr if there is no such
+		chunk. Does not decompress the chunk.
+	*/
+	const ChunkSummary *getChunkSummary(int x, int y) const;
+
+	/*
+		Decompress the leaf if it is compressed, and mark it as recently accessed.
+		Code that reaches leaves through getStorage() must call this before looking
+		at their floors.
+	*/
+	void loadLeaf(quadtree::Node &leaf) const;
+
+	/*
+		The chunks that are modified through the map are reported here.
+	*/
+	ChunkChangeBus &getChangeBus()
+	{
+		return changeBus;
+	}
+
 	quadtree::Node *getLeafUnsafe(int x, int y);
 
+	const MapStorage &getStorage() const
+	{
+		return *storage;
+	}
+
 private:
 	friend class MapView;
+	friend class MapPatch;
+	friend class EditJournal;
+	friend class MapIO::Loader;
 	Towns towns;
 	MapVersion mapVersion;
 	std::string description;
 
 	uint16_t width, height;
 
-	quadtree::Node root;
+	// Mutable because loading a leaf (see loadLeaf) interns its shared tiles again
+	mutable TilePool tilePool;
+	std::unique_ptr<MapStorage> storage;
+
+	mutable CompressedChunks compressedChunks;
+	mutable ItemIndex itemIndex;
+	ChunkChangeBus changeBus;
+	TimePoint created;
+	// Seconds since the map was created, updated by compressInactiveChunks
+	uint32_t accessTick = 0;
+
+	/*
+		Like MapStorage::getLeaf and MapStorage::getOrCreateLeaf, but the leaf is
+		loaded (see loadLeaf).
+	*/
+	quadtree::Node *getLeaf(int x, int y) const;
+	quadtree::Node &getOrCreateLeaf(int x, int y);
 
 	/*
 		Replace the tile at the given tile's location. Returns the old tile if one
@@ -226,12 +406,33 @@ private:
 	TileLocation &getOrCreateTileLocation(const Position &pos);
 	void removeTile(const Position pos);
 
-	void moveSelectedItems(const Position source, const Position destination);
 	/*
 		Remove and release ownership of the tile
 	*/
 	std::unique_ptr<Tile> dropTile(const Position pos);
+	/*
+		Release the floor at pos if it has no tiles, and the leaf if it has no floors.
+	*/
+	void releaseIfEmpty(const Position pos);
+	/*
+		Must be called when the contents of the tile at pos change (see MapStorage::markDirty).
+	*/
+	void markDirty(const Position &pos);
 	void createItemAt(Position pos, uint16_t id);
+
+	/*
+		Reorder the stack of the tile by the permutation of the tile change, and
+		replace the permutation by its inverse. The item indices of the change are
+		updated to refer to the reordered stack.
+	*/
+	static void reorderStack(Tile &tile, ItemReplacement &replacement, ItemReplacement::TileChange &change);
+	/*
+		Give the item the animation of its current item type.
+	*/
+	static void updateItemAnimation(Item &item);
+
+	void doSelectionMove(SelectionMove &move);
+	void undoSelectionMove(SelectionMove &move);
 };
 
 inline uint16_t Map::getWidth() const
@@ -241,4 +442,9 @@ inline uint16_t Map::getWidth() const
 inline uint16_t Map::getHeight() const
 {
 	return height;
+}
+
+inline bool Map::isInBounds(const Position &pos) const
+{
+	return pos.x >= 0 && pos.x < width && pos.y >= 0 && pos.y < height && pos.z >= 0 && pos.z < MAP_LAYERS;
 }
\ No newline at end of file
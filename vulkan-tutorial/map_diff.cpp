@@ -0,0 +1,196 @@
+#include "map_diff.h"
+
+#include <cstring>
+#include <optional>
+
+#include "map.h"
+#include "quad_tree.h"
+#include "tile_codec.h"
+#include "logger.h"
+
+namespace
+{
+  constexpr char Magic[] = {'V', 'M', 'E', 'P'};
+
+  const Tile *getTile(const quadtree::Node *leaf, uint32_t z, uint32_t index)
+  {
+    if (!leaf)
+      return nullptr;
+
+    Floor *floor = leaf->getFloor(z);
+    return floor ? floor->getTileLocation(index).getTile() : nullptr;
+  }
+
+  template <typename F>
+  void forEachChangedTile(const Map &older, const Map &newer, F f)
+  {
+    older.getStorage().forEachChangedLeaf(newer.getStorage(), [&older, &newer, &f](quadtree::Node *oldLeaf, quadtree::Node *newLeaf) {
+      if (oldLeaf)
+        older.loadLeaf(*oldLeaf);
+      if (newLeaf)
+        newer.loadLeaf(*newLeaf);
+
+      const quadtree::Node *leaf = oldLeaf ? oldLeaf : newLeaf;
+      for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+      {
+        for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+        {
+          const Tile *oldTile = getTile(oldLeaf, z, i);
+          const Tile *newTile = getTile(newLeaf, z, i);
+
+          uint64_t oldHash = oldTile ? oldTile->contentHash() : 0;
+          uint64_t newHash = newTile ? newTile->contentHash() : 0;
+          if (oldHash != newHash)
+          {
+            Position pos{static_cast<long>(leaf->getX() + (i >> 2)), static_cast<long>(leaf->getY() + (i & 3)), static_cast<int>(z)};
+            f(pos, newHash == 0 ? nullptr : newTile);
+          }
+        }
+      }
+    });
+  }
+
+  struct PatchTile
+  {
+    Position position;
+    // Empty if the tile was removed
+    std::optional<TileCodec::TileData> tile;
+  };
+} // namespace
+
+std::vector<Position> MapDiff::changedPositions(const Map &older, const Map &newer)
+{
+  std::vector<Position> result;
+  forEachChangedTile(older, newer, [&result](const Position &pos, const Tile *tile) { result.emplace_back(pos); });
+
+  return result;
+}
+
+MapPatch::MapPatch(std::vector<uint8_t> &&data)
+    : data(std::move(data)) {}
+
+MapPatch MapPatch::create(const Map &older, const Map &newer)
+{
+  BinaryWriter writer;
+  writer.writeBytes(Magic, sizeof(Magic));
+  writer.writeU16(Version);
+  writer.writeU64(older.getHash());
+  writer.writeU64(newer.getHash());
+
+  // Tile count, written when known
+  size_t countOffset = writer.data.size();
+  writer.writeU32(0);
+
+  uint32_t count = 0;
+  forEachChangedTile(older, newer, [&writer, &count](const Position &pos, const Tile *tile) {
+    ++count;
+    writer.writeU16(static_cast<uint16_t>(pos.x));
+    writer.writeU16(static_cast<uint16_t>(pos.y));
+    writer.writeU8(static_cast<uint8_t>(pos.z));
+    writer.writeU8(tile ? 1 : 0);
+
+    if (tile)
+    {
+      TileCodec::write(writer, *tile);
+    }
+  });
+
+  for (int i = 0; i < 4; ++i)
+  {
+    writer.data[countOffset + i] = static_cast<uint8_t>(count >> (i * 8));
+  }
+
+  return MapPatch(std::move(writer.data));
+}
+
+bool MapPatch::apply(Map &map) const
+{
+  BinaryReader reader(data);
+
+  char magic[sizeof(Magic)];
+  if (!reader.readBytes(magic, sizeof(magic)) || std::memcmp(magic, Magic, sizeof(Magic)) != 0)
+  {
+    Logger::error() << "The data is not a map patch." << std::endl;
+    return false;
+  }
+
+  uint16_t version = reader.readU16();
+  if (version != Version)
+  {
+    Logger::error() << "Unsupported map patch version: " << version << std::endl;
+    return false;
+  }
+
+  uint64_t baseHash = reader.readU64();
+  uint64_t resultHash = reader.readU64();
+  if (baseHash != map.getHash())
+  {
+    Logger::error() << "The map patch was created for another revision of the map." << std::endl;
+    return false;
+  }
+
+  // Read everything before touching the map, so that a malformed patch leaves the map unchanged
+  uint32_t count = reader.readU32();
+  std::vector<PatchTile> tiles;
+  bool malformed = false;
+  for (uint32_t i = 0; i < count && reader.ok() && !malformed; ++i)
+  {
+    PatchTile &patchTile = tiles.emplace_back();
+    patchTile.position.x = reader.readU16();
+    patchTile.position.y = reader.readU16();
+    patchTile.position.z = reader.readU8();
+
+    if (reader.readU8() == 0)
+      continue;
+
+    patchTile.tile = TileCodec::read(reader);
+    malformed = !patchTile.tile;
+  }
+
+  if (malformed || !reader.ok() || tiles.size() != count || !reader.atEnd())
+  {
+    Logger::error() << "The map patch is malformed." << std::endl;
+    return false;
+  }
+
+  for (const PatchTile &patchTile : tiles)
+  {
+    if (!map.isInBounds(patchTile.position))
+    {
+      Logger::error() << "The map patch contains a tile outside of the map: " << patchTile.position << std::endl;
+      return false;
+    }
+  }
+
+  // The old tiles are kept until the result has been checked, so that a mismatch can be undone
+  std::vector<std::unique_ptr<Tile>> oldTiles;
+  oldTiles.reserve(tiles.size());
+  for (const PatchTile &patchTile : tiles)
+  {
+    oldTiles.emplace_back(map.dropTile(patchTile.position));
+    if (!patchTile.tile)
+      continue;
+
+    TileLocation &location = map.getOrCreateTileLocation(patchTile.position);
+    location.setTile(TileCodec::createTile(location, patchTile.tile.value()));
+  }
+
+  if (map.getHash() != resultHash)
+  {
+    // In reverse, in case the patch has a position more than once
+    for (size_t i = tiles.size(); i > 0; --i)
+    {
+      const Position &position = tiles[i - 1].position;
+      map.removeTile(position);
+      if (oldTiles[i - 1])
+      {
+        map.getOrCreateTileLocation(position).setTile(std::move(oldTiles[i - 1]));
+      }
+    }
+
+    Logger::error() << "The map does not match the expected result after applying the patch." << std::endl;
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "position.h"
+
+class Map;
+
+namespace MapDiff
+{
+	/*
+		Positions of the tiles that differ between the two maps. Chunks with equal
+		content hashes are skipped without looking at their tiles, so the cost
+		depends on the number of changed chunks rather than on the size of the maps.
+	*/
+	std::vector<Position> changedPositions(const Map &older, const Map &newer);
+} // namespace MapDiff
+
+/*
+	A binary patch that turns one revision of a map into another. Only the tiles
+	that changed are stored.
+
+	Format (all integers little endian):
+		"VMEP", u16 version, u64 base hash, u64 result hash, u32 tile count, tiles
+	Tile:
+		u16 x, u16 y, u8 z, u8 hasTile
+		if hasTile: the tile's contents, see TileCodec
+*/
+class MapPatch
+{
+public:
+	static constexpr uint16_t Version = 1;
+
+	explicit MapPatch(std::vector<uint8_t> &&data);
+
+	/*
+		Create a patch that, applied to 'older', gives a map with the content of 'newer'.
+	*/
+	static MapPatch create(const Map &older, const Map &newer);
+
+	/*
+		Apply the patch. Returns false without modifying the map if the patch is
+		malformed, if the map is not the revision that the patch was created from,
+		or if the patched map does not have the result hash of the patch (the
+		changed tiles are then restored).
+	*/
+	bool apply(Map &map) const;
+
+	const std::vector<uint8_t> &getData() const
+	{
+		return data;
+	}
+
+private:
+	std::vector<uint8_t> data;
+};
@@ -6,6 +6,10 @@
 #include "version.h"
 #include "definitions.h"
 #include "tile.h"
+#include "file.h"
+#include "items.h"
+#include "logger.h"
+#include "time.h"
 
 #include <string>
 
@@ -18,6 +22,32 @@ enum NodeType
 
 constexpr uint32_t DEFAULT_BUFFER_SIZE = 0xFFFF;
 
+namespace
+{
+  std::string readString(BinaryReader &reader)
+  {
+    uint16_t length = reader.readU16();
+    std::string s(length, '\0');
+    reader.readBytes(s.data(), length);
+    return s;
+  }
+
+  std::string readLongString(BinaryReader &reader)
+  {
+    uint32_t length = reader.readU32();
+    if (length > reader.remaining())
+    {
+      // Let the read fail instead of allocating the length
+      reader.readBytes(nullptr, length);
+      return "";
+    }
+
+    std::string s(length, '\0');
+    reader.readBytes(s.data(), length);
+    return s;
+  }
+} // namespace
+
 SaveBuffer::SaveBuffer(std::ofstream &stream)
     : maxBufferSize(DEFAULT_BUFFER_SIZE), stream(stream)
 {
@@ -178,7 +208,7 @@ void MapIO::saveMap(Map &map)
       {
         ++savedTiles;
 
-        Tile *tile = location->getTile();
+        const Tile *tile = location->getTile();
 
         // We can skip the tile if it has no entities
         if (!tile || tile->getEntityCount() == 0)
@@ -236,6 +266,7 @@ void MapIO::saveMap(Map &map)
           }
           else
           {
+            buffer.writeU8(OTBM_ATTR_ITEM);
             buffer.writeU16(ground->getId());
           }
         }
@@ -366,3 +397,442 @@ void MapIO::Serializer::serializeItemAttribute(ItemAttribute &attribute)
     buffer.writeU64(static_cast<uint64_t>(attribute.get<double>().value()));
   }
 }
+
+
+bool MapIO::loadMap(const std::filesystem::path &path, Map &map)
+{
+  TimePoint start;
+
+  std::vector<uint8_t> data;
+  try
+  {
+    data = File::read(path.string());
+  }
+  catch (const std::runtime_error &error)
+  {
+    Logger::error() << error.what() << std::endl;
+    return false;
+  }
+
+  Loader loader(map, data);
+  if (!loader.load())
+  {
+    Logger::error() << path.string() << " is not a valid OTBM map." << std::endl;
+    return false;
+  }
+
+  size_t sharedTiles = map.shareIdenticalTiles();
+
+  Logger::info() << "Loaded " << path.string() << " (" << map.getWidth() << "x" << map.getHeight() << ", " << sharedTiles << " shared tiles) in " << start.elapsedMillis() << " ms." << std::endl;
+  return true;
+}
+
+bool MapIO::Loader::load()
+{
+  // "OTBM" or four zero bytes
+  constexpr size_t IdentifierSize = 4;
+  if (data.size() < IdentifierSize)
+    return false;
+  cursor = IdentifierSize;
+
+  uint8_t type;
+  std::vector<uint8_t> properties;
+  if (!nextChild(type, properties) || type != OTBM_ROOT)
+    return false;
+
+  BinaryReader reader(properties);
+  uint32_t version = reader.readU32();
+  uint16_t width = reader.readU16();
+  uint16_t height = reader.readU16();
+  uint32_t majorVersionItems = reader.readU32();
+  reader.readU32();
+
+  if (!reader.ok())
+    return false;
+
+  if (version > static_cast<uint32_t>(OTBMVersion::MAP_OTBM_4))
+  {
+    Logger::error() << "Unsupported OTBM version: " << version << std::endl;
+    return false;
+  }
+
+  if (majorVersionItems > Items::items.getOtbVersionInfo().majorVersion)
+  {
+    Logger::error() << "The map uses a newer items.otb (" << majorVersionItems << ") than the loaded one (" << Items::items.getOtbVersionInfo().majorVersion << ")." << std::endl;
+  }
+
+  // Must be set before any tile is created, since tiles outside the size are not allowed
+  map.setSize(width, height);
+  map.mapVersion.otbmVersion = static_cast<OTBMVersion>(version);
+
+  std::vector<uint8_t> childProperties;
+  while (nextChild(type, childProperties))
+  {
+    if (type == OTBM_MAP_DATA)
+    {
+      if (!readMapData(childProperties))
+        return false;
+    }
+    else
+    {
+      skipChildren();
+    }
+  }
+
+  if (skippedItems != 0)
+  {
+    Logger::info() << "Skipped " << skippedItems << " items with unknown ids or attributes." << std::endl;
+  }
+
+  return valid;
+}
+
+bool MapIO::Loader::nextChild(uint8_t &type, std::vector<uint8_t> &properties)
+{
+  if (!valid || cursor >= data.size())
+  {
+    valid = false;
+    return false;
+  }
+
+  uint8_t marker = data[cursor++];
+  if (marker == NODE_END)
+    return false;
+
+  if (marker != NODE_START || cursor >= data.size())
+  {
+    valid = false;
+    return false;
+  }
+
+  type = data[cursor++];
+  properties.clear();
+
+  while (cursor < data.size())
+  {
+    uint8_t byte = data[cursor];
+    if (byte == NODE_START || byte == NODE_END)
+      return true;
+
+    ++cursor;
+    if (byte == ESCAPE_CHAR)
+    {
+      if (cursor == data.size())
+        break;
+      byte = data[cursor++];
+    }
+
+    properties.emplace_back(byte);
+  }
+
+  // The node is not terminated
+  valid = false;
+  return false;
+}
+
+void MapIO::Loader::skipChildren()
+{
+  uint8_t type;
+  std::vector<uint8_t> properties;
+  while (nextChild(type, properties))
+  {
+    skipChildren();
+  }
+}
+
+bool MapIO::Loader::readMapData(const std::vector<uint8_t> &properties)
+{
+  BinaryReader reader(properties);
+  while (reader.ok() && !reader.atEnd())
+  {
+    uint8_t attribute = reader.readU8();
+    switch (attribute)
+    {
+    case OTBM_ATTR_DESCRIPTION:
+      // The editor writes its own description first, so the last one is the description of the map
+      map.description = readString(reader);
+      break;
+    case OTBM_ATTR_EXT_SPAWN_FILE:
+    case OTBM_ATTR_EXT_HOUSE_FILE:
+      readString(reader);
+      break;
+    default:
+      Logger::error() << "Unknown map attribute: " << static_cast<int>(attribute) << std::endl;
+      return false;
+    }
+  }
+
+  if (!reader.ok())
+    return false;
+
+  uint8_t type;
+  std::vector<uint8_t> childProperties;
+  while (nextChild(type, childProperties))
+  {
+    bool ok = true;
+    switch (type)
+    {
+    case OTBM_TILE_AREA:
+      ok = readTileArea(childProperties);
+      break;
+    case OTBM_TOWNS:
+      ok = readTowns();
+      break;
+    default:
+      skipChildren();
+      break;
+    }
+
+    if (!ok)
+      return false;
+  }
+
+  return valid;
+}
+
+bool MapIO::Loader::readTileArea(const std::vector<uint8_t> &properties)
+{
+  BinaryReader reader(properties);
+  Position areaPosition;
+  areaPosition.x = reader.readU16();
+  areaPosition.y = reader.readU16();
+  areaPosition.z = reader.readU8();
+
+  if (!reader.ok())
+    return false;
+
+  uint8_t type;
+  std::vector<uint8_t> tileProperties;
+  while (nextChild(type, tileProperties))
+  {
+    if (type == OTBM_TILE || type == OTBM_HOUSETILE)
+    {
+      if (!readTile(areaPosition, type, tileProperties))
+        return false;
+    }
+    else
+    {
+      skipChildren();
+    }
+  }
+
+  return valid;
+}
+
+bool MapIO::Loader::readTile(const Position &areaPosition, uint8_t type, const std::vector<uint8_t> &properties)
+{
+  BinaryReader reader(properties);
+  Position pos = areaPosition;
+  pos.x += reader.readU8();
+  pos.y += reader.readU8();
+
+  if (type == OTBM_HOUSETILE)
+  {
+    // House id; houses are not supported yet
+    reader.readU32();
+  }
+
+  TileCodec::TileData tile{};
+  while (reader.ok() && !reader.atEnd())
+  {
+    uint8_t attribute = reader.readU8();
+    switch (attribute)
+    {
+    case OTBM_ATTR_TILE_FLAGS:
+      tile.flags = reader.readU32();
+      break;
+    case OTBM_ATTR_ITEM:
+    {
+      // An item without attributes
+      TileCodec::ItemData item{};
+      item.id = reader.readU16();
+      addItem(tile, item);
+      break;
+    }
+    default:
+      Logger::error() << "Unknown tile attribute at " << pos << ": " << static_cast<int>(attribute) << std::endl;
+      return false;
+    }
+  }
+
+  if (!reader.ok())
+    return false;
+
+  uint8_t childType;
+  std::vector<uint8_t> itemProperties;
+  while (nextChild(childType, itemProperties))
+  {
+    if (childType == OTBM_ITEM)
+    {
+      addItem(tile, readItem(itemProperties));
+    }
+
+    // Container contents
+    skipChildren();
+  }
+
+  if (!valid)
+    return false;
+
+  if (!map.isInBounds(pos))
+  {
+    Logger::error() << "The tile at " << pos << " is outside the map." << std::endl;
+    return false;
+  }
+
+  if (!tile.ground && tile.items.empty() && tile.flags == 0)
+    return true;
+
+  TileLocation &location = map.getOrCreateTileLocation(pos);
+  location.setTile(TileCodec::createTile(location, tile));
+
+  return true;
+}
+
+std::optional<TileCodec::ItemData> MapIO::Loader::readItem(const std::vector<uint8_t> &properties)
+{
+  BinaryReader reader(properties);
+
+  TileCodec::ItemData item{};
+  item.id = reader.readU16();
+
+  while (reader.ok() && !reader.atEnd())
+  {
+    uint8_t attribute = reader.readU8();
+    switch (attribute)
+    {
+    case OTBM_ATTR_COUNT:
+    case OTBM_ATTR_RUNE_CHARGES:
+      item.subtype = reader.readU8();
+      break;
+    case OTBM_ATTR_CHARGES:
+      item.subtype = reader.readU16();
+      break;
+    case OTBM_ATTR_ACTION_ID:
+      item.attributes.emplace_back(ItemAttribute_t::ActionId).setInt(reader.readU16());
+      break;
+    case OTBM_ATTR_UNIQUE_ID:
+      item.attributes.emplace_back(ItemAttribute_t::UniqueId).setInt(reader.readU16());
+      break;
+    case OTBM_ATTR_TEXT:
+    {
+      std::string text = readString(reader);
+      item.attributes.emplace_back(ItemAttribute_t::Text).setString(text);
+      break;
+    }
+    case OTBM_ATTR_DESC:
+    {
+      std::string description = readString(reader);
+      item.attributes.emplace_back(ItemAttribute_t::Description).setString(description);
+      break;
+    }
+    // Attributes that the editor does not have
+    case OTBM_ATTR_HOUSEDOORID:
+    case OTBM_ATTR_DECAYING_STATE:
+      reader.readU8();
+      break;
+    case OTBM_ATTR_DEPOT_ID:
+      reader.readU16();
+      break;
+    case OTBM_ATTR_DURATION:
+    case OTBM_ATTR_WRITTENDATE:
+    case OTBM_ATTR_SLEEPERGUID:
+    case OTBM_ATTR_SLEEPSTART:
+      reader.readU32();
+      break;
+    case OTBM_ATTR_TELE_DEST:
+    {
+      OTBM_TeleportDest destination;
+      reader.readBytes(&destination, sizeof(destination));
+      break;
+    }
+    case OTBM_ATTR_WRITTENBY:
+      readString(reader);
+      break;
+    case OTBM_ATTR_ATTRIBUTE_MAP:
+    {
+      // See Serializer::serializeItemAttributeMap
+      uint16_t count = reader.readU16();
+      for (uint16_t i = 0; i < count && reader.ok(); ++i)
+      {
+        readString(reader);
+        auto type = static_cast<ItemAttribute_t>(reader.readU8());
+        switch (type)
+        {
+        case ItemAttribute_t::UniqueId:
+        case ItemAttribute_t::ActionId:
+          item.attributes.emplace_back(type).setInt(static_cast<int>(reader.readU32()));
+          break;
+        case ItemAttribute_t::Text:
+        case ItemAttribute_t::Description:
+        {
+          std::string value = readLongString(reader);
+          item.attributes.emplace_back(type).setString(value);
+          break;
+        }
+        default:
+          return {};
+        }
+      }
+      break;
+    }
+    default:
+      // The size of an unknown attribute is not known, so the rest can not be read
+      return {};
+    }
+  }
+
+  if (!reader.ok())
+    return {};
+
+  return item;
+}
+
+void MapIO::Loader::addItem(TileCodec::TileData &tile, const std::optional<TileCodec::ItemData> &item)
+{
+  const ItemType *itemType = item ? Items::items.getItemType(item->id) : nullptr;
+  if (itemType == nullptr || !itemType->isValid())
+  {
+    ++skippedItems;
+    return;
+  }
+
+  // The ground is always the first item of a tile
+  if (!tile.ground && tile.items.empty() && itemType->isGroundTile())
+    tile.ground = item;
+  else
+    tile.items.emplace_back(item.value());
+}
+
+bool MapIO::Loader::readTowns()
+{
+  uint8_t type;
+  std::vector<uint8_t> properties;
+  while (nextChild(type, properties))
+  {
+    if (type == OTBM_TOWN)
+    {
+      BinaryReader reader(properties);
+      Town town(reader.readU32());
+      town.setName(readString(reader));
+
+      Position templePosition;
+      templePosition.x = reader.readU16();
+      templePosition.y = reader.readU16();
+      templePosition.z = reader.readU8();
+      town.setTemplePosition(templePosition);
+
+      if (!reader.ok())
+        return false;
+
+      if (!map.towns.addTown(town))
+      {
+        Logger::error() << "Duplicate town id: " << town.getID() << std::endl;
+      }
+    }
+
+    skipChildren();
+  }
+
+  return valid;
+}
@@ -1,6 +1,8 @@
 #pragma once
 
+#include <filesystem>
 #include <fstream>
+#include <optional>
 #include <vector>
 #include <unordered_map>
 
@@ -8,6 +10,7 @@
 #include "item.h"
 
 #include "item_attribute.h"
+#include "tile_codec.h"
 
 // Pragma pack is VERY important since otherwise it won't be able to load the structs correctly
 #pragma pack(1)
@@ -141,6 +144,56 @@ namespace MapIO
 {
 	void saveMap(Map &map);
 
+	/*
+		Load an OTBM map into an empty map. The size of the map is taken from the
+		header, and identical tiles are shared afterwards (see
+		Map::shareIdenticalTiles). Items with an unknown id are skipped. Returns
+		false if the file can not be read or is malformed; the tiles that were read
+		before the error stay in the map.
+	*/
+	bool loadMap(const std::filesystem::path &path, Map &map);
+
+	/*
+		Reads the nodes of an OTBM file (see loadMap). Container contents, spawns,
+		houses and waypoints are not supported by the editor and are skipped.
+	*/
+	class Loader
+	{
+	public:
+		Loader(Map &map, const std::vector<uint8_t> &data)
+				: map(map), data(data) {}
+
+		bool load();
+
+	private:
+		Map &map;
+		const std::vector<uint8_t> &data;
+		size_t cursor = 0;
+		bool valid = true;
+
+		size_t skippedItems = 0;
+
+		/*
+			Enter the next child of the current node, reading its type and its
+			(unescaped) properties. Returns false, and leaves the current node, if
+			the current node has no more children.
+		*/
+		bool nextChild(uint8_t &type, std::vector<uint8_t> &properties);
+		void skipChildren();
+
+		bool readMapData(const std::vector<uint8_t> &properties);
+		bool readTileArea(const std::vector<uint8_t> &properties);
+		bool readTile(const Position &areaPosition, uint8_t type, const std::vector<uint8_t> &properties);
+		std::optional<TileCodec::ItemData> readItem(const std::vector<uint8_t> &properties);
+		bool readTowns();
+
+		/*
+			Add a read item to the tile data. Items that could not be read or have an
+			unknown id are skipped.
+		*/
+		void addItem(TileCodec::TileData &tile, const std::optional<TileCodec::ItemData> &item);
+	};
+
 	class Serializer
 	{
 	public:
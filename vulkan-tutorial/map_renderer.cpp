@@ -1,6 +1,8 @@
 #include "map_renderer.h"
 
+#include <algorithm>
 #include <stdexcept>
+#include <tuple>
 
 #include "file.h"
 #include "graphics/resource-descriptor.h"
@@ -213,18 +215,44 @@ void MapRenderer::drawMap(const MapView &mapView)
 
   Position from{mapRect.x1, mapRect.y1, startZ};
   Position to{mapRect.x2, mapRect.y2, endZ};
-  for (auto &tileLocation : mapView.getMap()->getRegion(from, to))
+
+  if (!mapView.getItemFilter().empty())
   {
-    if (!tileLocation.hasTile())
-    {
-      continue;
-    }
-    /* Avoid drawing the tile only if the whole tile is selected
-                 and the selection is moving
-              */
-    if (!(tileLocation.getTile()->allSelected() && isSelectionMoving))
+    drawFilteredMap(mapView, from, to);
+  }
+  else
+  {
+    const Map &map = *mapView.getMap();
+    const ChunkSummary *summary = nullptr;
+    Position summaryChunk{-1, -1, 0};
+
+    for (auto &tileLocation : mapView.getMap()->getRegion(from, to))
     {
-      drawTile(tileLocation, mapView, ItemDrawFlags::DrawSelected);
+      if (!tileLocation.hasTile())
+      {
+        continue;
+      }
+      /* Avoid drawing the tile only if the whole tile is selected
+                   and the selection is moving
+                */
+      if (!(tileLocation.getTile()->allSelected() && isSelectionMoving))
+      {
+        Position position = tileLocation.getPosition();
+        if ((position.x & ~3) != summaryChunk.x || (position.y & ~3) != summaryChunk.y)
+        {
+          summaryChunk = Position{position.x & ~3, position.y & ~3, 0};
+          summary = map.getChunkSummary(position.x, position.y);
+        }
+
+        // A moving selection is drawn by drawMovingSelection
+        uint32_t drawFlags = isSelectionMoving ? ItemDrawFlags::None : ItemDrawFlags::DrawSelected;
+        if (summary && summary->maxElevation == 0)
+          drawFlags |= ItemDrawFlags::NoElevation;
+        if (mapView.selection.inArea(position))
+          drawFlags |= ItemDrawFlags::InSelectionArea;
+
+        drawTile(tileLocation, mapView, drawFlags);
+      }
     }
   }
 
@@ -237,6 +265,10 @@ void MapRenderer::drawMap(const MapView &mapView)
   {
     drawMovingSelection(mapView);
   }
+  else
+  {
+    movingSelection.valid = false;
+  }
 
   if (mapView.isDragging())
   {
@@ -244,18 +276,38 @@ void MapRenderer::drawMap(const MapView &mapView)
   }
 }
 
+void MapRenderer::drawFilteredMap(const MapView &mapView, const Position &from, const Position &to)
+{
+  Map &map = *mapView.getMap();
+  bool isSelectionMoving = mapView.selection.moving;
+
+  std::vector<Position> positions = map.findItems(mapView.getItemFilter(), from, to);
+
+  // Draw the lower floors first, like the map region does
+  std::stable_sort(positions.begin(), positions.end(), [](const Position &a, const Position &b) { return a.z > b.z; });
+
+  for (const Position &position : positions)
+  {
+    const TileLocation &tileLocation = *map.getTileLocation(position);
+    if (!(tileLocation.getTile()->allSelected() && isSelectionMoving))
+    {
+      uint32_t drawFlags = isSelectionMoving ? ItemDrawFlags::None : ItemDrawFlags::DrawSelected;
+      if (mapView.selection.inArea(position))
+        drawFlags |= ItemDrawFlags::InSelectionArea;
+
+      drawTile(tileLocation, mapView, drawFlags);
+    }
+  }
+}
+
 void MapRenderer::drawTile(const TileLocation &tileLocation, const MapView &mapView, uint32_t drawFlags)
 {
   auto position = tileLocation.getPosition();
   auto tile = tileLocation.getTile();
 
   bool drawSelected = drawFlags & ItemDrawFlags::DrawSelected;
-
-  Position selectionMovePosDelta{};
-  if (mapView.selection.moving)
-  {
-    selectionMovePosDelta = g_engine->getCursorPos().toPos(mapView) - mapView.selection.moveOrigin.value();
-  }
+  bool hasElevation = !(drawFlags & ItemDrawFlags::NoElevation);
+  bool inSelectionArea = drawFlags & ItemDrawFlags::InSelectionArea;
 
   if (tile->getGround())
   {
@@ -265,10 +317,7 @@ void MapRenderer::drawTile(const TileLocation &tileLocation, const MapView &mapV
       ObjectDrawInfo info;
       info.appearance = ground->itemType->appearance;
       info.position = position;
-      if (ground->selected)
-        info.position += selectionMovePosDelta;
-
-      info.color = ground->selected ? colors::Selected : colors::Default;
+      info.color = ground->selected || inSelectionArea ? colors::Selected : colors::Default;
       info.textureInfo = ground->getTextureInfo(info.position);
 
       drawItem(info);
@@ -287,16 +336,14 @@ void MapRenderer::drawTile(const TileLocation &tileLocation, const MapView &mapV
 
     ObjectDrawInfo info;
     info.appearance = item.itemType->appearance;
-    info.color = item.selected ? colors::Selected : colors::Default;
+    info.color = item.selected || inSelectionArea ? colors::Selected : colors::Default;
     info.drawOffset = drawOffset;
     info.position = position;
-    if (item.selected)
-      info.position += selectionMovePosDelta;
     info.textureInfo = item.getTextureInfo(position);
 
     drawItem(info);
 
-    if (item.itemType->hasElevation())
+    if (hasElevation && item.itemType->hasElevation())
     {
       uint32_t elevation = item.itemType->getElevation();
       drawOffset.x -= elevation;
@@ -311,7 +358,7 @@ void MapRenderer::drawPreviewCursor(const MapView &mapView)
 
   Position pos = g_engine->getCursorPos().worldPos(mapView).mapPos().floor(mapView.getFloor());
 
-  Tile *tile = mapView.getMap()->getTile(pos);
+  const Tile *tile = mapView.getMap()->getTile(pos);
 
   int elevation = tile ? tile->getTopElevation() : 0;
 
@@ -327,40 +374,145 @@ void MapRenderer::drawPreviewCursor(const MapView &mapView)
 
 void MapRenderer::drawMovingSelection(const MapView &mapView)
 {
-  auto mapRect = mapView.getGameBoundingRect();
+  std::optional<PositionBitmap::Bounds> bounds = mapView.selection.getBounds();
+  if (!bounds)
+    return;
+
+  updateMovingSelectionCache(mapView);
 
   Position moveOrigin = mapView.selection.moveOrigin.value();
   Position cursorPos = g_engine->getCursorPos().toPos(mapView);
 
   Position deltaPos = cursorPos - moveOrigin;
 
-  mapRect.x1 -= deltaPos.x;
-  mapRect.x1 = std::max(0, mapRect.x1);
-  mapRect.x2 -= deltaPos.x;
+  // The part of the selection that is visible after it is moved
+  auto mapRect = mapView.getGameBoundingRect();
+  int x1 = std::max<int>(mapRect.x1 - deltaPos.x, bounds->from.x);
+  int x2 = std::min<int>(mapRect.x2 - deltaPos.x, bounds->to.x);
+  int y1 = std::max<int>(mapRect.y1 - deltaPos.y, bounds->from.y);
+  int y2 = std::min<int>(mapRect.y2 - deltaPos.y, bounds->to.y);
+
+  if (x1 > x2 || y1 > y2)
+    return;
 
-  mapRect.y1 -= deltaPos.y;
-  mapRect.y1 = std::max(0, mapRect.y1);
+  // Lower floors first, like the map region does
+  for (int z = bounds->to.z; z >= bounds->from.z; --z)
+  {
+    for (const MovingSelectionCache::Chunk &chunk : movingSelection.chunks)
+    {
+      if (chunk.x + 3 < x1 || chunk.x > x2 || chunk.y + 3 < y1 || chunk.y > y2)
+        continue;
+
+      for (uint32_t i = chunk.floorStart[z]; i < chunk.floorStart[z + 1]; ++i)
+      {
+        ObjectDrawInfo info = movingSelection.items[i];
+        info.position += deltaPos;
+        drawItem(info);
+      }
+    }
+  }
+}
 
-  mapRect.y2 -= deltaPos.y;
+void MapRenderer::updateMovingSelectionCache(const MapView &mapView)
+{
+  const Map &map = *mapView.getMap();
+  const PositionBitmap &positions = mapView.selection.getPositions();
 
-  // TODO: Use selection Z bounds instead of all floors
-  int startZ = MAP_LAYERS - 1;
-  int endZ = 0;
+  if (movingSelection.valid && movingSelection.selectionSize == positions.size())
+    return;
 
-  Position from{mapRect.x1, mapRect.y1, startZ};
-  Position to{mapRect.x2, mapRect.y2, endZ};
+  movingSelection.chunks.clear();
+  movingSelection.items.clear();
 
-  for (auto &tileLocation : mapView.getMap()->getRegion(from, to))
+  for (const auto &[key, bits] : positions.getChunks())
   {
-    if (tileLocation.hasTile())
+    MovingSelectionCache::Chunk chunk;
+    std::tie(chunk.x, chunk.y) = ChunkKey::position(key);
+
+    for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
     {
-      // Draw only if the tile has a selection.
-      if ((tileLocation.getTile()->hasSelection() && mapView.selection.moving))
+      chunk.floorStart[z] = static_cast<uint32_t>(movingSelection.items.size());
+
+      for (uint32_t index = 0; index < MAP_TREE_CHILDREN_COUNT; ++index)
       {
-        drawTile(tileLocation, mapView, ItemDrawFlags::DrawSelected);
+        if (!(bits.floors[z] & (1 << index)))
+          continue;
+
+        Position position{chunk.x + static_cast<long>(index >> 2), chunk.y + static_cast<long>(index & 3), z};
+        const Tile *tile = map.getTile(position);
+        if (!tile)
+          continue;
+
+        // Like drawTile, but only the selected items
+        const Item *ground = tile->getGround();
+        if (ground && ground->selected)
+        {
+          ObjectDrawInfo info;
+          info.appearance = ground->itemType->appearance;
+          info.position = position;
+          info.color = colors::Selected;
+          info.textureInfo = ground->getTextureInfo(position);
+          movingSelection.items.emplace_back(info);
+        }
+
+        DrawOffset drawOffset{0, 0};
+        for (const Item &item : tile->getItems())
+        {
+          if (item.selected)
+          {
+            ObjectDrawInfo info;
+            info.appearance = item.itemType->appearance;
+            info.color = colors::Selected;
+            info.drawOffset = drawOffset;
+            info.position = position;
+            info.textureInfo = item.getTextureInfo(position);
+            movingSelection.items.emplace_back(info);
+          }
+
+          if (item.itemType->hasElevation())
+          {
+            uint32_t elevation = item.itemType->getElevation();
+            drawOffset.x -= elevation;
+            drawOffset.y -= elevation;
+          }
+        }
       }
     }
+
+    chunk.floorStart[MAP_LAYERS] = static_cast<uint32_t>(movingSelection.items.size());
+    movingSelection.chunks.emplace_back(chunk);
   }
+
+  movingSelection.selectionSize = positions.size();
+  movingSelection.valid = true;
+}
+
+void MapRenderer::subscribe(ChunkChangeBus &changeBus)
+{
+  changeBus.subscribe([this](const ChunkChanges &changes) {
+    // An invalid cache is rebuilt as a whole anyway, so only the first change after a rebuild is looked at
+    if (!movingSelection.valid)
+      return;
+
+    if (changes.all)
+    {
+      movingSelection.valid = false;
+      return;
+    }
+
+    for (const auto &[x, y] : changes.chunks)
+    {
+      auto cached = std::find_if(movingSelection.chunks.begin(), movingSelection.chunks.end(), [x = x, y = y](const MovingSelectionCache::Chunk &chunk) {
+        return chunk.x == x && chunk.y == y;
+      });
+
+      if (cached != movingSelection.chunks.end())
+      {
+        movingSelection.valid = false;
+        return;
+      }
+    }
+  });
 }
 
 void MapRenderer::drawSelectionRectangle(const MapView &mapView)
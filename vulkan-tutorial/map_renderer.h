@@ -6,6 +6,7 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
+#include <array>
 #include <vector>
 #include <memory>
 
@@ -34,6 +35,10 @@ namespace ItemDrawFlags
 {
 	constexpr uint32_t None = 0;
 	constexpr uint32_t DrawSelected = 1 << 0;
+	// None of the items on the tile have elevation (see ChunkSummary::maxElevation)
+	constexpr uint32_t NoElevation = 1 << 1;
+	// The tile is in a selection area that has not been materialized (see Selection::inArea)
+	constexpr uint32_t InSelectionArea = 1 << 2;
 } // namespace ItemDrawFlags
 
 struct TextureOffset
@@ -83,6 +88,12 @@ public:
 
 	void recordFrame(uint32_t currentFrame, MapView &mapView);
 
+	/*
+		Keep the data that the renderer derives from the map (the moving selection
+		cache) up to date with the changes of the map.
+	*/
+	void subscribe(ChunkChangeBus &changeBus);
+
 	VkCommandBuffer getCommandBuffer();
 
 	void createRenderPass();
@@ -115,6 +126,34 @@ private:
 
 	const glm::vec4 clearColor = {0.0f, 0.0f, 0.0f, 1.0f};
 
+	/*
+		What drawMovingSelection draws, without the move offset. It is built when a
+		move starts and reused for every frame of the move, so a frame only
+		translates the draw infos of the visible chunks. The sprites keep the
+		pattern and animation phase that they had when the move started. The cache
+		is invalidated when one of its chunks changes (see subscribe).
+	*/
+	struct MovingSelectionCache
+	{
+		struct Chunk
+		{
+			// Top-left tile of the chunk
+			int x;
+			int y;
+			// Floor z of the chunk is items[floorStart[z]] to items[floorStart[z + 1]]
+			std::array<uint32_t, MAP_LAYERS + 1> floorStart;
+		};
+
+		std::vector<Chunk> chunks;
+		std::vector<ObjectDrawInfo> items;
+
+		// The size of the selection that the cache was built for
+		size_t selectionSize = 0;
+		bool valid = false;
+	};
+
+	MovingSelectionCache movingSelection;
+
 	void createGraphicsPipeline();
 	void createCommandPool();
 	void createUniformBuffers();
@@ -131,8 +170,13 @@ private:
 	void drawMap(const MapView &mapView);
 	void drawPreviewCursor(const MapView &mapView);
 	void drawMovingSelection(const MapView &mapView);
+	void updateMovingSelectionCache(const MapView &mapView);
 	void drawSelectionRectangle(const MapView &mapView);
 
+	/*
+		Draw only the tiles that match the item filter of the map view.
+	*/
+	void drawFilteredMap(const MapView &mapView, const Position &from, const Position &to);
 	void drawTile(const TileLocation &tileLocation, const MapView &mapView, uint32_t drawFlags = ItemDrawFlags::None);
 	void drawItem(ObjectDrawInfo &info);
 
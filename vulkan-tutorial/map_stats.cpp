@@ -0,0 +1,183 @@
+#include "map_stats.h"
+
+#include <sstream>
+#include <iomanip>
+
+#include "quad_tree.h"
+#include "tile.h"
+#include "item.h"
+
+namespace
+{
+  size_t itemBytes(const Item &item)
+  {
+    const auto &attributes = item.getAttributes();
+    if (attributes.empty())
+      return 0;
+
+    // Bucket array + one heap allocated node per attribute
+    using Entry = std::pair<const ItemAttribute_t, ItemAttribute>;
+    return attributes.bucket_count() * sizeof(void *) + attributes.size() * (sizeof(Entry) + sizeof(void *));
+  }
+
+  std::string toMegabytes(size_t bytes)
+  {
+    std::ostringstream s;
+    s << std::fixed << std::setprecision(2) << static_cast<double>(bytes) / (1024 * 1024) << " MB";
+    return s.str();
+  }
+} // namespace
+
+void MapStats::addLeaf(const quadtree::Node &leaf)
+{
+  for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+  {
+    Floor *floor = leaf.getFloor(z);
+    if (!floor)
+      continue;
+
+    FloorStats &floorStats = perFloor[z];
+    ++floors;
+    ++floorStats.floors;
+    bytes.floors += sizeof(Floor);
+
+    for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+    {
+      const TileLocation &location = floor->getTileLocation(i);
+      const Tile *tile = location.getTile();
+      if (!tile)
+        continue;
+
+      bool shared = location.isShared();
+
+      ++tiles;
+      ++floorStats.tiles;
+      if (shared)
+        ++sharedTiles;
+      else
+        bytes.tiles += sizeof(Tile);
+
+      size_t itemCount = tile->getItemCount();
+      if (!shared)
+        bytes.items += tile->getItems().capacity() * sizeof(Item);
+
+      const Item *ground = tile->getGround();
+      if (ground)
+      {
+        ++itemCount;
+        if (!shared)
+          bytes.items += sizeof(Item);
+      }
+
+      if (itemCount == 0)
+        ++emptyTiles;
+
+      items += itemCount;
+      floorStats.items += itemCount;
+      ++itemsPerTile[std::min(itemCount, HistogramBuckets - 1)];
+
+      auto addItem = [this, shared](const Item &item) {
+        if (item.isEntity())
+          ++entities;
+
+        if (item.hasAttributes())
+        {
+          ++itemsWithAttributes;
+          attributes += item.getAttributes().size();
+          if (!shared)
+            bytes.attributes += itemBytes(item);
+        }
+      };
+
+      if (ground)
+        addItem(*ground);
+
+      for (const Item &item : tile->getItems())
+        addItem(item);
+    }
+  }
+}
+
+MapStats &MapStats::operator+=(const MapStats &other)
+{
+  nodes += other.nodes;
+  leaves += other.leaves;
+  floors += other.floors;
+  tiles += other.tiles;
+  emptyTiles += other.emptyTiles;
+  sharedTiles += other.sharedTiles;
+  compressedLeaves += other.compressedLeaves;
+  items += other.items;
+  itemsWithAttributes += other.itemsWithAttributes;
+  attributes += other.attributes;
+  entities += other.entities;
+  pageFileSize += other.pageFileSize;
+
+  bytes.storage += other.bytes.storage;
+  bytes.floors += other.bytes.floors;
+  bytes.tiles += other.bytes.tiles;
+  bytes.items += other.bytes.items;
+  bytes.attributes += other.bytes.attributes;
+  bytes.sharedTiles += other.bytes.sharedTiles;
+  bytes.compressedLeaves += other.bytes.compressedLeaves;
+  bytes.itemIndex += other.bytes.itemIndex;
+
+  for (size_t i = 0; i < HistogramBuckets; ++i)
+  {
+    itemsPerTile[i] += other.itemsPerTile[i];
+  }
+
+  for (size_t z = 0; z < MAP_LAYERS; ++z)
+  {
+    perFloor[z].floors += other.perFloor[z].floors;
+    perFloor[z].tiles += other.perFloor[z].tiles;
+    perFloor[z].items += other.perFloor[z].items;
+  }
+
+  return *this;
+}
+
+std::string MapStats::toString() const
+{
+  std::ostringstream s;
+  s << "Nodes: " << nodes << ", leaves: " << leaves << " (" << compressedLeaves << " compressed), floors: " << floors << std::endl;
+  s << "Tiles: " << tiles << " (" << emptyTiles << " empty, " << sharedTiles << " shared), items: " << items << std::endl;
+  s << "Items with attributes: " << itemsWithAttributes << " (" << attributes << " attributes), ECS entities: " << entities << std::endl;
+
+  s << std::endl
+    << "Memory: " << toMegabytes(bytes.total()) << std::endl;
+  s << "  Storage: " << toMegabytes(bytes.storage) << std::endl;
+  s << "  Floors: " << toMegabytes(bytes.floors) << std::endl;
+  s << "  Tiles: " << toMegabytes(bytes.tiles) << std::endl;
+  s << "  Items: " << toMegabytes(bytes.items) << std::endl;
+  s << "  Attributes: " << toMegabytes(bytes.attributes) << std::endl;
+  s << "  Shared tiles: " << toMegabytes(bytes.sharedTiles) << std::endl;
+  s << "  Compressed leaves: " << toMegabytes(bytes.compressedLeaves) << std::endl;
+  s << "  Item index: " << toMegabytes(bytes.itemIndex) << std::endl;
+  if (pageFileSize != 0)
+    s << "Page file: " << toMegabytes(pageFileSize) << std::endl;
+
+  s << std::endl
+    << "Items per tile:" << std::endl;
+  for (size_t i = 0; i < HistogramBuckets; ++i)
+  {
+    if (itemsPerTile[i] == 0)
+      continue;
+
+    s << "  " << i << (i == HistogramBuckets - 1 ? "+" : "") << ": " << itemsPerTile[i] << std::endl;
+  }
+
+  s << std::endl
+    << "Floors:" << std::endl;
+  s << std::fixed << std::setprecision(1);
+  for (size_t z = 0; z < MAP_LAYERS; ++z)
+  {
+    const FloorStats &floor = perFloor[z];
+    if (floor.floors == 0)
+      continue;
+
+    s << "  z=" << z << ": " << floor.tiles << " tiles, " << floor.items << " items, " << floor.density() * 100 << "% dense" << std::endl;
+  }
+
+  return s.str();
+}
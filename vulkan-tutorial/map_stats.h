@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <string>
+
+#include "const.h"
+
+namespace quadtree
+{
+	class Node;
+}
+
+/*
+	Memory and occupancy statistics for a map. See Map::stats().
+*/
+struct MapStats
+{
+	// Tiles with at least this many items (ground included) share the last histogram bucket.
+	static constexpr size_t HistogramBuckets = 16;
+
+	struct FloorStats
+	{
+		size_t floors = 0;
+		size_t tiles = 0;
+		size_t items = 0;
+
+		/*
+			Fraction of the tile locations in the allocated floors that have a tile.
+		*/
+		double density() const
+		{
+			return floors == 0 ? 0 : static_cast<double>(tiles) / (floors * MAP_TREE_CHILDREN_COUNT);
+		}
+	};
+
+	struct Bytes
+	{
+		size_t storage = 0;
+		size_t floors = 0;
+		size_t tiles = 0;
+		size_t items = 0;
+		size_t attributes = 0;
+		// The tile pool and the tiles in it (see TilePool)
+		size_t sharedTiles = 0;
+		// See CompressedChunks
+		size_t compressedLeaves = 0;
+		// See ItemIndex
+		size_t itemIndex = 0;
+
+		size_t total() const
+		{
+			return storage + floors + tiles + items + attributes + sharedTiles + compressedLeaves + itemIndex;
+		}
+	};
+
+	size_t nodes = 0;
+	size_t leaves = 0;
+	size_t floors = 0;
+	size_t tiles = 0;
+	size_t emptyTiles = 0;
+	// Locations that refer to a shared tile. Their memory is counted in bytes.sharedTiles.
+	size_t sharedTiles = 0;
+	// The floors, tiles and items of compressed leaves are not counted.
+	size_t compressedLeaves = 0;
+	size_t items = 0;
+	size_t itemsWithAttributes = 0;
+	size_t attributes = 0;
+	size_t entities = 0;
+	// Disk space used by compressed leaves (see Map::usePageFile). Not part of 'bytes'.
+	uint64_t pageFileSize = 0;
+
+	Bytes bytes;
+
+	// itemsPerTile[n] is the number of tiles with n items
+	std::array<size_t, HistogramBuckets> itemsPerTile{};
+	std::array<FloorStats, MAP_LAYERS> perFloor{};
+
+	/*
+		Add the floors, tiles and items of a leaf. Does not count the leaf itself.
+	*/
+	void addLeaf(const quadtree::Node &leaf);
+
+	MapStats &operator+=(const MapStats &other);
+
+	/*
+		Multi-line, human readable description.
+	*/
+	std::string toString() const;
+};
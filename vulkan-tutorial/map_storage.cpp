@@ -0,0 +1,140 @@
+#include "map_storage.h"
+
+#include "quad_tree.h"
+#include "morton_storage.h"
+#include "debug.h"
+#include "util.h"
+
+#include <algorithm>
+#include <unordered_map>
+
+std::unique_ptr<MapStorage> MapStorage::create(MapStorageType type)
+{
+  switch (type)
+  {
+  case MapStorageType::QuadTree:
+    return std::make_unique<quadtree::QuadTreeStorage>();
+  case MapStorageType::Morton:
+    return std::make_unique<MortonStorage>();
+  default:
+    ABORT_PROGRAM("Unknown MapStorageType.");
+  }
+}
+
+void MapStorage::forEachChangedLeaf(const MapStorage &other, const LeafPairCallback &f) const
+{
+  auto leafKey = [](const quadtree::Node *leaf) {
+    return (static_cast<uint32_t>(leaf->getY()) << 16) | static_cast<uint32_t>(leaf->getX());
+  };
+
+  std::vector<quadtree::Node *> otherLeaves;
+  other.getLeaves(otherLeaves);
+
+  std::unordered_map<uint32_t, quadtree::Node *> unmatched;
+  unmatched.reserve(otherLeaves.size());
+  for (quadtree::Node *leaf : otherLeaves)
+  {
+    unmatched.emplace(leafKey(leaf), leaf);
+  }
+
+  std::vector<quadtree::Node *> leaves;
+  getLeaves(leaves);
+
+  for (quadtree::Node *leaf : leaves)
+  {
+    quadtree::Node *otherLeaf = nullptr;
+
+    auto found = unmatched.find(leafKey(leaf));
+    if (found != unmatched.end())
+    {
+      otherLeaf = found->second;
+      unmatched.erase(found);
+    }
+
+    uint64_t otherHash = otherLeaf ? otherLeaf->getHash() : 0;
+    if (leaf->getHash() != otherHash)
+    {
+      f(leaf, otherLeaf);
+    }
+  }
+
+  for (const auto &[key, otherLeaf] : unmatched)
+  {
+    if (otherLeaf->getHash() != 0)
+    {
+      f(nullptr, otherLeaf);
+    }
+  }
+}
+
+void MapStorage::forEachLeafWithItems(const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f) const
+{
+  auto test = [&serverIds, &f](quadtree::Node *leaf) {
+    if (leaf->getItemFilter().mayContainAny(serverIds))
+      f(leaf);
+  };
+
+  if (toX < fromX || toY < fromY)
+    return;
+
+  int x1 = std::max(fromX, 0) & ~3;
+  int y1 = std::max(fromY, 0) & ~3;
+  uint64_t columns = std::max(toX - x1, 0) / 4 + 1;
+  uint64_t rows = std::max(toY - y1, 0) / 4 + 1;
+
+  // Look up the chunks of a small area directly instead of going through all leaves
+  if (columns * rows <= getLeafCount())
+  {
+    for (int y = y1; y <= toY; y += 4)
+    {
+      for (int x = x1; x <= toX; x += 4)
+      {
+        if (quadtree::Node *leaf = getLeaf(x, y))
+          test(leaf);
+      }
+    }
+
+    return;
+  }
+
+  std::vector<quadtree::Node *> leaves;
+  getLeaves(leaves);
+  for (quadtree::Node *leaf : leaves)
+  {
+    if (leaf->getX() + 3 >= fromX && leaf->getX() <= toX && leaf->getY() + 3 >= fromY && leaf->getY() <= toY)
+      test(leaf);
+  }
+}
+
+MapStorage::Part MapStorage::getPart(uint32_t key, const quadtree::Node &node)
+{
+  Part part;
+  uint64_t contentHash = node.getHash();
+
+  // Parts without content are left out of the hash, as if the part did not exist
+  if (contentHash != 0)
+  {
+    part.hash = util::mixHash(contentHash ^ util::mixHash(key));
+  }
+
+  const ChunkSummary &summary = node.getSummary();
+  part.tiles = summary.tileCount;
+  part.items = summary.itemCount;
+
+  return part;
+}
+
+void MapStorage::replacePart(Part &current, const Part &part) const
+{
+  hash += part.hash - current.hash;
+  totals.tiles += part.tiles - static_cast<uint64_t>(current.tiles);
+  totals.items += part.items - static_cast<uint64_t>(current.items);
+
+  current = part;
+}
+
+void MapStorage::clearParts()
+{
+  hash = 0;
+  totals = Totals{};
+}
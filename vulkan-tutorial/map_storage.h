@@ -0,0 +1,168 @@
+#pragma once
+
+#include <stdint.h>
+#include <functional>
+#include <memory>
+#include <vector>
+
+namespace quadtree
+{
+	class Node;
+}
+
+enum class MapStorageType
+{
+	// 16-ary pointer quadtree (see quad_tree.h)
+	QuadTree,
+	// Flat open-addressing table of chunks keyed by their Z-order (Morton) code
+	Morton
+};
+
+/*
+	Owns the chunks (leaf nodes) of a map. A chunk covers 4x4 tiles on all
+	floors. Map only talks to the storage through this interface, which makes it
+	possible to swap the underlying layout.
+*/
+class MapStorage
+{
+public:
+	virtual ~MapStorage() = default;
+
+	static std::unique_ptr<MapStorage> create(MapStorageType type);
+
+	virtual MapStorageType getType() const = 0;
+
+	/*
+		Returns the leaf containing (x, y), or nullptr if there is no such leaf.
+	*/
+	virtual quadtree::Node *getLeaf(int x, int y) const = 0;
+
+	/*
+		Returns the leaf containing (x, y). Creates the leaf if it does not already exist.
+	*/
+	virtual quadtree::Node &getOrCreateLeaf(int x, int y) = 0;
+
+	/*
+		Release the leaf containing (x, y) if there is one. The leaf must be empty
+		(see quadtree::Node::isEmpty). Storage that only existed to reach the leaf
+		is released as well.
+	*/
+	virtual void removeLeaf(int x, int y) = 0;
+
+	/*
+		Mark the content hash of the leaf containing (x, y), and of everything
+		above it, as outdated. Must be called whenever the tiles of the leaf change.
+	*/
+	virtual void markDirty(int x, int y) = 0;
+
+	/*
+		Content hash of all leaves (see quadtree::Node::getHash). Hashes are only
+		comparable between storages of the same type. Only the leaves that were
+		marked dirty since the last call are hashed again.
+	*/
+	virtual uint64_t getHash() const = 0;
+
+	struct Totals
+	{
+		uint64_t tiles = 0;
+		// Items, ground included
+		uint64_t items = 0;
+	};
+
+	/*
+		Number of tiles and items of all leaves (see quadtree::Node::getSummary).
+		Kept up to date together with the hash, so only the leaves that were marked
+		dirty since the last call are looked at.
+	*/
+	Totals getTotals() const
+	{
+		getHash();
+		return totals;
+	}
+
+	using LeafPairCallback = std::function<void(quadtree::Node *leaf, quadtree::Node *otherLeaf)>;
+
+	/*
+		Calls 'f' for every chunk whose content differs between this storage and
+		'other', according to the content hashes. One of the leaves is nullptr if the
+		chunk only exists in one of the storages.
+		The default implementation compares every pair of leaves.
+	*/
+	virtual void forEachChangedLeaf(const MapStorage &other, const LeafPairCallback &f) const;
+
+	using LeafCallback = std::function<void(quadtree::Node *leaf)>;
+
+	/*
+		Calls 'f' for every leaf that overlaps the area from (fromX, fromY) to
+		(toX, toY), inclusive, and may contain an item with one of the server ids
+		(see quadtree::Node::getItemFilter). The leaves are not loaded, so they can
+		be compressed. The default implementation tests the filter of every leaf in
+		the area; storages with inner nodes skip whole subtrees.
+	*/
+	virtual void forEachLeafWithItems(const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f) const;
+
+	/*
+		Appends all leaves to 'result'. Leaves that are close on the map are close
+		in the result.
+	*/
+	virtual void getLeaves(std::vector<quadtree::Node *> &result) const = 0;
+
+	virtual size_t getLeafCount() const = 0;
+
+	/*
+		Number of nodes that are not leaves, i.e. the nodes that only exist to
+		reach the leaves.
+	*/
+	virtual size_t getNodeCount() const = 0;
+
+	/*
+		Approximate number of bytes used by the storage itself, i.e. everything
+		except the floors and tiles owned by the leaves.
+	*/
+	virtual size_t getMemoryUsage() const = 0;
+
+	virtual void clear() = 0;
+
+protected:
+	/*
+		What a part of the map (a chunk or a block of chunks) adds to the hash and
+		the totals of the storage. The parts are summed, so the storage hash does
+		not depend on the order of the parts and can be updated when one of them
+		changes, by subtracting its old part and adding the new one.
+	*/
+	struct Part
+	{
+		uint64_t hash = 0;
+		uint32_t tiles = 0;
+		uint32_t items = 0;
+	};
+
+	// Sums of the parts
+	mutable uint64_t hash = 0;
+	mutable Totals totals;
+
+	/*
+		The part of the node, which covers the part of the map with the key.
+	*/
+	static Part getPart(uint32_t key, const quadtree::Node &node);
+
+	/*
+		Replace 'current', a part that is included in the sums, by 'part'.
+	*/
+	void replacePart(Part &current, const Part &part) const;
+
+	void clearParts();
+};
+
+inline const char *toString(MapStorageType type)
+{
+	switch (type)
+	{
+	case MapStorageType::QuadTree:
+		return "QuadTree";
+	case MapStorageType::Morton:
+		return "Morton";
+	default:
+		return "Unknown";
+	}
+}
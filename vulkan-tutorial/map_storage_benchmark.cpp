@@ -0,0 +1,140 @@
+#include "map_storage_benchmark.h"
+
+#include <chrono>
+#include <vector>
+
+#include "Logger.h"
+#include "quad_tree.h"
+#include "random.h"
+
+using namespace std::chrono;
+
+namespace
+{
+  constexpr int BenchmarkFloor = 7;
+
+  double elapsedNanos(steady_clock::time_point start)
+  {
+    return static_cast<double>(duration_cast<nanoseconds>(steady_clock::now() - start).count());
+  }
+} // namespace
+
+MapStorageBenchmark::Result MapStorageBenchmark::run(MapStorageType type, const Options &options)
+{
+  Result result{};
+  result.type = type;
+  result.mapOffset = options.mapOffset;
+
+  std::unique_ptr<MapStorage> storage = MapStorage::create(type);
+  Random random(options.seed);
+
+  int mapSize = static_cast<int>(options.mapSize);
+  int offset = static_cast<int>(options.mapOffset);
+
+  // Insert
+  auto start = steady_clock::now();
+  size_t tileCount = 0;
+  for (int x = offset; x < offset + mapSize; x += options.tileSpacing)
+  {
+    for (int y = offset; y < offset + mapSize; y += options.tileSpacing)
+    {
+      Position pos{x, y, BenchmarkFloor};
+      storage->getOrCreateLeaf(x, y).getOrCreateTileLocation(pos).setEmptyTile();
+      ++tileCount;
+    }
+  }
+  result.insertNsPerTile = elapsedNanos(start) / tileCount;
+
+  // Random lookups. The positions are generated up front so that the random
+  // number generator is not part of the measurement.
+  std::vector<std::pair<int, int>> positions;
+  positions.reserve(options.lookups);
+  for (uint32_t i = 0; i < options.lookups; ++i)
+  {
+    positions.emplace_back(offset + random.nextInt<int>(0, mapSize), offset + random.nextInt<int>(0, mapSize));
+  }
+
+  size_t found = 0;
+  start = steady_clock::now();
+  for (const auto [x, y] : positions)
+  {
+    quadtree::Node *leaf = storage->getLeaf(x, y);
+    if (leaf)
+    {
+      TileLocation *location = leaf->getTile(x, y, BenchmarkFloor);
+      if (location && location->hasTile())
+        ++found;
+    }
+  }
+  result.lookupNsPerTile = elapsedNanos(start) / options.lookups;
+
+  // Region scans, chunk by chunk like MapRegion
+  std::vector<std::pair<int, int>> regionStarts;
+  regionStarts.reserve(options.regionScans);
+  for (uint32_t i = 0; i < options.regionScans; ++i)
+  {
+    regionStarts.emplace_back(
+        offset + random.nextInt<int>(0, mapSize - static_cast<int>(options.regionWidth)),
+        offset + random.nextInt<int>(0, mapSize - static_cast<int>(options.regionHeight)));
+  }
+
+  start = steady_clock::now();
+  for (const auto [x1, y1] : regionStarts)
+  {
+    int x2 = x1 + options.regionWidth;
+    int y2 = y1 + options.regionHeight;
+    for (int chunkX = x1 & ~3; chunkX <= x2; chunkX += 4)
+    {
+      for (int chunkY = y1 & ~3; chunkY <= y2; chunkY += 4)
+      {
+        quadtree::Node *leaf = storage->getLeaf(chunkX, chunkY);
+        if (!leaf)
+          continue;
+
+        Floor *floor = leaf->getFloor(BenchmarkFloor);
+        if (!floor)
+          continue;
+
+        for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+        {
+          if (floor->getTileLocation(i).hasTile())
+            ++found;
+        }
+      }
+    }
+  }
+  result.regionScanUsPerScan = elapsedNanos(start) / 1000.0 / options.regionScans;
+
+  result.leafCount = storage->getLeafCount();
+  result.storageBytes = storage->getMemoryUsage();
+
+  // Makes sure that the lookups can not be optimized away
+  if (found == 0)
+  {
+    Logger::error() << "MapStorageBenchmark: no tiles were found." << std::endl;
+  }
+
+  return result;
+}
+
+void MapStorageBenchmark::runAll(const Options &options)
+{
+  // The same area at the origin and in the far corner of a full size map
+  Options farOptions = options;
+  farOptions.mapOffset = MAP_MAX_SIZE - options.mapSize;
+
+  for (const Options *current : {&options, static_cast<const Options *>(&farOptions)})
+  {
+    for (MapStorageType type : {MapStorageType::QuadTree, MapStorageType::Morton})
+    {
+      Result result = run(type, *current);
+
+      Logger::info() << "[" << toString(type) << ", offset " << result.mapOffset << "]"
+                     << " insert: " << result.insertNsPerTile << " ns/tile"
+                     << ", lookup: " << result.lookupNsPerTile << " ns/tile"
+                     << ", region scan: " << result.regionScanUsPerScan << " us/scan"
+                     << ", leaves: " << result.leafCount
+                     << ", storage: " << result.storageBytes / 1024 << " KiB" << std::endl;
+    }
+  }
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "map_storage.h"
+
+/*
+	Compares the MapStorage implementations on the access patterns of the editor:
+	random tile lookups, viewport-sized region scans, tile insertion and memory
+	usage of the storage structure.
+*/
+namespace MapStorageBenchmark
+{
+	struct Options
+	{
+		// Side length (in tiles) of the populated square area
+		uint32_t mapSize = 2048;
+		// Top-left corner of the populated area. A large offset places the area in
+		// the far corner of a full 65535x65535 map.
+		uint32_t mapOffset = 0;
+		// Every n:th tile in the area gets a tile
+		uint32_t tileSpacing = 2;
+		uint32_t lookups = 4'000'000;
+		// Viewport size of a region scan (roughly 1080p at 100% zoom)
+		uint32_t regionWidth = 60;
+		uint32_t regionHeight = 34;
+		uint32_t regionScans = 20'000;
+		uint32_t seed = 123;
+	};
+
+	struct Result
+	{
+		MapStorageType type;
+		uint32_t mapOffset;
+		double insertNsPerTile;
+		double lookupNsPerTile;
+		double regionScanUsPerScan;
+		size_t leafCount;
+		size_t storageBytes;
+	};
+
+	Result run(MapStorageType type, const Options &options);
+
+	/*
+		Runs the benchmark for all storage types and logs the results.
+	*/
+	void runAll(const Options &options = Options{});
+} // namespace MapStorageBenchmark
@@ -1,35 +1,90 @@
 #include "map_view.h"
 
 #include "const.h"
+#include "items.h"
 
 MapView::MapView(GLFWwindow *window)
     : window(window),
       map(std::make_shared<Map>()),
       dragState{},
+      history(*this),
       selection(*this)
 {
 }
 
-void MapView::selectTopItem(Tile &tile)
+void MapView::selectTopItem(const Position &pos)
 {
   MapAction action = newAction(MapActionType::Selection);
-  action.addChange(Change::selectTopItem(tile));
+  action.addChange(Change::selectTopItem(pos, *map->getTile(pos)));
 
   history.commit(std::move(action));
 }
 
-void MapView::deselectTopItem(Tile &tile)
+void MapView::deselectTopItem(const Position &pos)
 {
   MapAction action = newAction(MapActionType::Selection);
-  action.addChange(Change::deselectTopItem(tile));
+  action.addChange(Change::deselectTopItem(pos, *map->getTile(pos)));
 
   history.commit(std::move(action));
 }
 
-void MapView::selectAll(Tile &tile)
+void MapView::selectAll(const Position &pos)
 {
-  tile.selectAll();
-  selection.select(tile.position);
+  PositionBitmap positions;
+  positions.insert(pos);
+
+  MapAction action = newAction(MapActionType::Selection);
+  action.addChange(Change::selection(std::move(positions)));
+
+  history.commit(std::move(action));
+}
+
+void MapView::selectItems(uint16_t serverId)
+{
+  std::vector<Change> changes;
+  for (const Position &position : map->findItems(serverId))
+  {
+    std::optional<Change> change = Change::selectItems(position, *map->getTile(position), serverId);
+    if (change)
+    {
+      changes.emplace_back(std::move(change.value()));
+    }
+  }
+
+  // Only commit a change if anything was selected
+  if (changes.empty())
+    return;
+
+  history.startGroup(ActionGroupType::Selection);
+
+  MapAction action(*this, MapActionType::Selection);
+  for (Change &change : changes)
+  {
+    action.addChange(std::move(change));
+  }
+
+  history.commit(std::move(action));
+  history.endGroup(ActionGroupType::Selection);
+}
+
+size_t MapView::replaceItems(const std::unordered_map<uint16_t, uint16_t> &mapping)
+{
+  ItemReplacement replacement = map->replaceItems(mapping);
+  if (replacement.empty())
+    return 0;
+
+  size_t count = replacement.items.size();
+
+  history.startGroup(ActionGroupType::ReplaceItems);
+
+  MapAction action(*this, MapActionType::ReplaceItems);
+  action.addChange(Change::replaceItems(std::move(replacement)));
+  action.markAsCommitted();
+
+  history.commit(std::move(action));
+  history.endGroup(ActionGroupType::ReplaceItems);
+
+  return count;
 }
 
 void MapView::clearSelection()
@@ -48,6 +103,64 @@ bool MapView::isSelectionMoving() const
 }
 
 void MapView::addItem(const Position pos, uint16_t id)
+{
+  MapAction action(*this, MapActionType::SetTile);
+  action.addChange(Change::editTile(addItemEdit(pos, id)));
+
+  if (!autoBorder.empty() && Items::items.getItemType(id)->isGroundTile())
+  {
+    PositionBitmap changed;
+    changed.insert(pos);
+    commitWithBorders(std::move(action), changed);
+  }
+  else
+  {
+    history.commit(std::move(action));
+  }
+}
+
+void MapView::addItems(const PositionBitmap &positions, uint16_t id)
+{
+  MapAction action(*this, MapActionType::SetTile);
+  bool empty = true;
+  // In chunk order, so that consecutive tiles are in the same leaf of the map
+  for (const Position pos : positions)
+  {
+    if (!map->isInBounds(pos))
+      continue;
+
+    action.addChange(Change::editTile(addItemEdit(pos, id)));
+    empty = false;
+  }
+
+  if (empty)
+    return;
+
+  if (!autoBorder.empty() && Items::items.getItemType(id)->isGroundTile())
+  {
+    commitWithBorders(std::move(action), positions);
+  }
+  else
+  {
+    history.commit(std::move(action));
+  }
+}
+
+void MapView::commitWithBorders(MapAction &&action, const PositionBitmap &changed)
+{
+  action.commit();
+
+  // The border edits are applied here, so the action holds their inverse like its other changes
+  for (TileEdit &edit : autoBorder.update(*map, changed))
+  {
+    applyTileEdit(edit);
+    action.addChange(Change::editTile(std::move(edit)));
+  }
+
+  history.commit(std::move(action));
+}
+
+TileEdit MapView::addItemEdit(const Position pos, uint16_t id) const
 {
   Item item(id);
 
@@ -59,32 +172,73 @@ void MapView::addItem(const Position pos, uint16_t id)
     g_ecs.addComponent(entityId, ItemAnimationComponent(spriteInfo.getAnimation()));
   }
 
-  Tile &currentTile = map->getOrCreateTile(pos);
-  Tile newTile = currentTile.deepCopy();
-  newTile.addItem(std::move(item));
+  TileEdit edit(pos);
+  const Tile *currentTile = map->getTile(pos);
+  if (item.isGround())
+  {
+    edit.setGround(std::make_unique<Item>(std::move(item)));
+  }
+  else if (!currentTile)
+  {
+    edit.insertItem(0, std::move(item));
+  }
+  else
+  {
+    Tile::StackPosition stackPosition = currentTile->getStackPosition(item);
+    if (stackPosition.replace)
+    {
+      edit.removeItem(stackPosition.index);
+    }
+    edit.insertItem(stackPosition.index, std::move(item));
+  }
 
-  MapAction action(*this, MapActionType::SetTile);
-  action.addChange(std::move(newTile));
-  history.commit(std::move(action));
+  return edit;
 }
 
-void MapView::removeItems(const Position position, const std::set<size_t, std::greater<size_t>> &indices)
+void MapView::startBrushStroke(const Position position, const BrushSettings &settings)
 {
-  TileLocation *location = map->getTileLocation(position);
+  brushStroke.emplace(position, settings);
+}
 
-  DEBUG_ASSERT(location->hasTile(), "The location has no tile.");
-  Tile *tile = location->getTile();
+void MapView::continueBrushStroke(const Position position)
+{
+  if (brushStroke)
+  {
+    brushStroke->addSample(position);
+  }
+}
 
-  MapAction action(*this, MapActionType::RemoveTile);
+void MapView::paintBrushStroke(uint16_t id)
+{
+  if (brushStroke && brushStroke->hasPending())
+  {
+    addItems(brushStroke->takePending(MaxBrushTilesPerFrame), id);
+  }
+}
+
+void MapView::endBrushStroke(uint16_t id)
+{
+  if (brushStroke && brushStroke->hasPending())
+  {
+    addItems(brushStroke->takePending(), id);
+  }
 
-  Tile newTile = deepCopyTile(position);
+  brushStroke.reset();
+}
+
+void MapView::removeItems(const Position position, const std::set<size_t, std::greater<size_t>> &indices)
+{
+  DEBUG_ASSERT(map->getTile(position) != nullptr, "The location has no tile.");
 
+  MapAction action(*this, MapActionType::RemoveTile);
+
+  TileEdit edit(position);
   for (const auto index : indices)
   {
-    newTile.removeItem(index);
+    edit.removeItem(index);
   }
 
-  action.addChange(std::move(newTile));
+  action.addChange(Change::editTile(std::move(edit)));
 
   history.commit(std::move(action));
 }
@@ -93,32 +247,38 @@ void MapView::removeSelectedItems(const Tile &tile)
 {
   MapAction action(*this, MapActionType::ModifyTile);
 
-  Tile newTile = tile.deepCopy();
+  TileEdit edit(tile.position);
 
-  for (size_t i = 0; i < tile.items.size(); ++i)
+  // Remove from the top, so that the indices of the remaining items stay valid
+  for (size_t i = tile.items.size(); i-- > 0;)
   {
     if (tile.items.at(i).selected)
     {
-      newTile.removeItem(i);
+      edit.removeItem(i);
     }
   }
 
-  Item *ground = newTile.getGround();
+  Item *ground = tile.getGround();
   if (ground && ground->selected)
   {
-    newTile.ground.reset();
+    edit.setGround(nullptr);
   }
 
-  action.addChange(Change::setTile(std::move(newTile)));
+  action.addChange(Change::editTile(std::move(edit)));
 
   history.commit(std::move(action));
 }
 
-Tile *MapView::getTile(const Position pos) const
+const Tile *MapView::getTile(const Position pos) const
 {
   return map->getTile(pos);
 }
 
+Tile *MapView::getMutableTile(const Position pos)
+{
+  return map->getMutableTile(pos);
+}
+
 void MapView::insertTile(Tile &&tile)
 {
   MapAction action(*this, MapActionType::SetTile);
@@ -173,20 +333,33 @@ void MapView::translateCameraZ(int z)
   camera.translateZ(z);
 }
 
+void MapView::centerCamera(const Position &position)
+{
+  WorldPosition worldPos = MapPosition{position.x, position.y}.worldPos();
+
+  float x = static_cast<float>(worldPos.x) + (MapTileSize - viewport.width / camera.zoomFactor) / 2;
+  float y = static_cast<float>(worldPos.y) + (MapTileSize - viewport.height / camera.zoomFactor) / 2;
+  camera.setPosition(glm::vec3(x, y, static_cast<float>(position.z)));
+}
+
 void MapView::deleteSelectedItems()
 {
+  selection.materialize();
   if (selection.getPositions().empty())
   {
     return;
   }
 
   history.startGroup(ActionGroupType::RemoveMapItem);
-  for (auto pos : selection.getPositions())
+
+  // Removing the items deselects the positions, so iterate over a copy.
+  PositionBitmap positions = selection.getPositions();
+  for (auto pos : positions)
   {
-    Tile &tile = *getTile(pos);
+    const Tile &tile = *getTile(pos);
     if (tile.allSelected())
     {
-      removeTile(tile.getPosition());
+      removeTile(pos);
     }
     else
     {
@@ -248,16 +421,24 @@ void MapView::finishMoveSelection(const Position moveDestination)
 {
   if (selection.moving)
   {
+    selection.materialize();
     Position deltaPos = moveDestination - selection.moveOrigin.value();
 
-    for (const Position pos : selection.getPositions())
+    std::optional<PositionBitmap::Bounds> bounds = selection.getBounds();
+    bool inBounds = bounds && map->isInBounds(bounds->from + deltaPos) && map->isInBounds(bounds->to + deltaPos);
+    if (inBounds && deltaPos != Position{0, 0, 0})
     {
-      Position newPos = pos + deltaPos;
-      DEBUG_ASSERT(getTile(pos)->hasSelection(), "The tile at each position of a selection should have a selection.");
+      SelectionMove move = map->moveSelection(selection.getPositions(), deltaPos);
+      updateSelection(move);
+
+      history.startGroup(ActionGroupType::MoveItems);
+
+      MapAction action(*this, MapActionType::Move);
+      action.addChange(Change::moveSelection(std::move(move)));
+      action.markAsCommitted();
 
-      selection.deselect(pos);
-      map->moveSelectedItems(pos, newPos);
-      selection.select(newPos);
+      history.commit(std::move(action));
+      history.endGroup(ActionGroupType::MoveItems);
     }
   }
   selection.moving = false;
@@ -271,25 +452,26 @@ void MapView::endDragging()
   Position from = fromWorldPos.toPos(*this);
   Position to = toWorldPos.toPos(*this);
 
-  std::unordered_set<Position, PositionHash> positions;
-
+  // Only commit a change if anything was dragged over
+  bool hasTiles = false;
   for (auto &location : map->getRegion(from, to))
   {
-    Tile *tile = location.getTile();
+    const Tile *tile = location.getTile();
     if (tile && !tile->isEmpty())
     {
-      positions.emplace(location.getPosition());
+      hasTiles = true;
+      break;
     }
   }
 
-  // Only commit a change if anything was dragged over
-  if (!positions.empty())
+  if (hasTiles)
   {
     history.startGroup(ActionGroupType::Selection);
 
     MapAction action(*this, MapActionType::Selection);
 
-    action.addChange(Change::selection(positions));
+    // The tiles are selected when the selection is used (see Selection::materialize)
+    action.addChange(Change::selection(SelectionArea(from, to)));
 
     history.commit(std::move(action));
     history.endGroup(ActionGroupType::Selection);
@@ -315,7 +497,9 @@ bool MapView::isDragging() const
 */
 std::unique_ptr<Tile> MapView::setTileInternal(Tile &&tile)
 {
-  Tile *oldTile = map->getTile(tile.position);
+  // The selection state of the new tile replaces that of the old one
+  selection.materialize(tile.position);
+  const Tile *oldTile = map->getTile(tile.position);
 
   TileLocation &location = map->getOrCreateTileLocation(tile.position);
   std::unique_ptr<Tile> oldTilePtr = location.replaceTile(std::move(tile));
@@ -334,18 +518,58 @@ std::unique_ptr<Tile> MapView::setTileInternal(Tile &&tile)
 
 std::unique_ptr<Tile> MapView::removeTileInternal(const Position position)
 {
-  Tile *oldTile = map->getTile(position);
+  selection.materialize(position);
+  const Tile *oldTile = map->getTile(position);
   removeSelectionInternal(oldTile);
 
   return map->dropTile(position);
 }
 
-void MapView::removeSelectionInternal(Tile *tile)
+void MapView::removeSelectionInternal(const Tile *tile)
 {
+  // A tile with a selection is never shared, so its position is valid
   if (tile && tile->hasSelection())
     selection.deselect(tile->position);
 }
 
+void MapView::applySelectionMove(SelectionMove &move)
+{
+  map->applySelectionMove(move);
+  updateSelection(move);
+}
+
+void MapView::applyTileEdit(TileEdit &edit)
+{
+  // The selection state of the edited tile replaces that of the old one
+  selection.materialize(edit.position);
+  map->applyTileEdit(edit);
+
+  const Tile *tile = map->getTile(edit.position);
+  if (tile && tile->hasSelection())
+  {
+    selection.select(edit.position);
+  }
+  else
+  {
+    selection.deselect(edit.position);
+  }
+}
+
+void MapView::updateSelection(const SelectionMove &move)
+{
+  PositionBitmap moved = move.positions.translated(move.delta);
+  if (move.applied)
+  {
+    selection.deselect(move.positions);
+    selection.merge(moved);
+  }
+  else
+  {
+    selection.deselect(moved);
+    selection.merge(move.positions);
+  }
+}
+
 MapAction MapView::newAction(MapActionType actionType) const
 {
   MapAction action(const_cast<MapView &>(*this), actionType);
@@ -13,6 +13,9 @@
 #include "position.h"
 #include "util.h"
 #include "selection.h"
+#include "edit_journal.h"
+#include "brush_stroke.h"
+#include "auto_border.h"
 
 #include "action/action.h"
 
@@ -32,9 +35,22 @@ struct Viewport
 class MapView
 {
 public:
+	// Painting a tile costs a few microseconds, so this keeps a large brush within a frame
+	static constexpr size_t MaxBrushTilesPerFrame = 4096;
+
 	MapView(GLFWwindow *window);
 
 	EditorHistory history;
+	/*
+		Not open by default. When it is open, every edit that goes through the
+		history is appended to it (see EditJournal).
+	*/
+	EditJournal journal;
+	/*
+		Empty by default. When it has border families, painting a ground updates the
+		borders around the painted tiles as part of the same action (see AutoBorder).
+	*/
+	AutoBorder autoBorder;
 
 	Selection selection;
 
@@ -43,12 +59,25 @@ public:
 		return map.get();
 	}
 
-	Tile *getTile(const Position pos) const;
+	/*
+		The tile may be shared (see TileLocation::getTile). Use getMutableTile to modify it.
+	*/
+	const Tile *getTile(const Position pos) const;
+	Tile *getMutableTile(const Position pos);
 	void insertTile(Tile &&tile);
 	void removeTile(const Position pos);
-	void selectTopItem(Tile &tile);
-	void deselectTopItem(Tile &tile);
-	void selectAll(Tile &tile);
+	void selectTopItem(const Position &pos);
+	void deselectTopItem(const Position &pos);
+	void selectAll(const Position &pos);
+	/*
+		Select every item with the server id on the map, as one undoable action.
+	*/
+	void selectItems(uint16_t serverId);
+	/*
+		Replace items on the whole map (old server id -> new server id, see
+		Map::replaceItems) as one undoable action. Returns the number of replaced items.
+	*/
+	size_t replaceItems(const std::unordered_map<uint16_t, uint16_t> &mapping);
 	void clearSelection();
 	bool hasSelectionMoveOrigin() const;
 	bool isSelectionMoving() const;
@@ -57,6 +86,25 @@ public:
 	void finishMoveSelection(const Position moveDestination);
 
 	void addItem(const Position position, uint16_t id);
+	/*
+		Add an item to each of the tiles, as one change.
+	*/
+	void addItems(const PositionBitmap &positions, uint16_t id);
+
+	/*
+		Paint with the brush: start a stroke at the position, continue it to the
+		cursor once per frame, and paint the tiles that the stroke has reached since
+		the previous frame (see BrushStroke). At most MaxBrushTilesPerFrame tiles
+		are painted per frame; ending the stroke paints the rest.
+	*/
+	void startBrushStroke(const Position position, const BrushSettings &settings);
+	void continueBrushStroke(const Position position);
+	void paintBrushStroke(uint16_t id);
+	void endBrushStroke(uint16_t id);
+	bool hasBrushStroke() const
+	{
+		return brushStroke.has_value();
+	}
 
 	/* Note: The indices must be in descending order (std::greater), because
 		otherwise the wrong items could be removed.
@@ -109,6 +157,11 @@ public:
 
 	void translateCameraZ(int z);
 
+	/*
+		Move the camera so that the position is in the middle of the viewport, on its floor.
+	*/
+	void centerCamera(const Position &position);
+
 	const Viewport &getViewport() const
 	{
 		return viewport;
@@ -137,6 +190,20 @@ public:
 
 	bool hasSelection() const;
 
+	/*
+		Only draw the tiles that contain an item with one of the server ids. An
+		empty filter draws everything.
+	*/
+	void setItemFilter(std::vector<uint16_t> serverIds)
+	{
+		itemFilter = std::move(serverIds);
+	}
+
+	const std::vector<uint16_t> &getItemFilter() const
+	{
+		return itemFilter;
+	}
+
 private:
 	friend class MapAction;
 	GLFWwindow *window;
@@ -148,21 +215,49 @@ private:
 	};
 	std::optional<DragData> dragState;
 
+	std::optional<BrushStroke> brushStroke;
+
+	std::vector<uint16_t> itemFilter;
+
 	Camera camera;
 
 	std::shared_ptr<Map> map;
 
 	Tile deepCopyTile(const Position position) const
 	{
-		return map->getTile(position)->deepCopy();
+		Tile tile = map->getTile(position)->deepCopy();
+		// A shared tile does not know its position
+		tile.position = position;
+		return tile;
 	}
 
+	/*
+		The edit that adds a new item with the server id to the tile at the position.
+	*/
+	TileEdit addItemEdit(const Position position, uint16_t id) const;
+
+	/*
+		Commit the action, and add the border changes that the tiles around the
+		changed positions need to it (see AutoBorder). The borders depend on the new
+		grounds, so they can not be computed before the action has been applied.
+	*/
+	void commitWithBorders(MapAction &&action, const PositionBitmap &changed);
+
 	/*
 		Returns the old tile at the location of the tile.
 	*/
 	std::unique_ptr<Tile> setTileInternal(Tile &&tile);
 	std::unique_ptr<Tile> removeTileInternal(const Position position);
-	void removeSelectionInternal(Tile *tile);
+	void removeSelectionInternal(const Tile *tile);
+	/*
+		Undo or redo a selection move, and move the selection along with the items.
+	*/
+	void applySelectionMove(SelectionMove &move);
+	void updateSelection(const SelectionMove &move);
+	/*
+		Apply (or undo) a tile edit, and update the selection of its position.
+	*/
+	void applyTileEdit(TileEdit &edit);
 
 	MapAction newAction(MapActionType actionType) const;
 };
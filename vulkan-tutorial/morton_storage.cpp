@@ -0,0 +1,218 @@
+#include "morton_storage.h"
+
+#include <algorithm>
+
+#include "debug.h"
+#include "util.h"
+
+using namespace quadtree;
+
+constexpr uint32_t INITIAL_CAPACITY_LOG2 = 10;
+
+/*
+  Groups of 4x4 chunks (16 consecutive Morton keys) are placed in consecutive
+  slots, so that a region scan touches few cache lines. The groups themselves are
+  spread over the table with Fibonacci hashing to avoid long probe sequences.
+*/
+inline uint32_t hashKey(uint32_t key, uint32_t shift)
+{
+  uint32_t group = static_cast<uint32_t>(((key >> 4) * 2654435769u) >> (shift + 4));
+  return (group << 4) | (key & 0xF);
+}
+
+MortonStorage::MortonStorage()
+    : slots(1 << INITIAL_CAPACITY_LOG2), shift(32 - INITIAL_CAPACITY_LOG2)
+{
+}
+
+uint32_t MortonStorage::slotFor(uint32_t key) const
+{
+  uint32_t mask = static_cast<uint32_t>(slots.size() - 1);
+  uint32_t i = hashKey(key, shift);
+  while (slots[i].key != key && slots[i].key != EmptyKey)
+  {
+    i = (i + 1) & mask;
+  }
+
+  return i;
+}
+
+Node *MortonStorage::getLeaf(int x, int y) const
+{
+  const Slot &slot = slots[slotFor(morton::chunkKey(x, y))];
+  if (slot.key == EmptyKey)
+    return nullptr;
+
+  return const_cast<Node *>(&chunks[slot.index]);
+}
+
+Node &MortonStorage::getOrCreateLeaf(int x, int y)
+{
+  uint32_t key = morton::chunkKey(x, y);
+  uint32_t i = slotFor(key);
+  if (slots[i].key == key)
+  {
+    return chunks[slots[i].index];
+  }
+
+  // Keep the load factor below 0.5 so that probe sequences stay short
+  if ((getLeafCount() + 1) * 2 > slots.size())
+  {
+    grow();
+    i = slotFor(key);
+  }
+
+  slots[i].key = key;
+
+  Node *leaf;
+  if (freeChunks.empty())
+  {
+    slots[i].index = static_cast<uint32_t>(chunks.size());
+    leaf = &chunks.emplace_back(Node::NodeType::Leaf, 0);
+    chunkParts.emplace_back();
+    chunkQueued.emplace_back(false);
+  }
+  else
+  {
+    // A released chunk is empty, so it can be reused as is.
+    slots[i].index = freeChunks.back();
+    freeChunks.pop_back();
+    leaf = &chunks[slots[i].index];
+  }
+
+  leaf->setLeafPosition(x, y);
+  return *leaf;
+}
+
+void MortonStorage::removeLeaf(int x, int y)
+{
+  uint32_t i = slotFor(morton::chunkKey(x, y));
+  if (slots[i].key == EmptyKey)
+    return;
+
+  DEBUG_ASSERT(chunks[slots[i].index].isEmpty(), "Only an empty leaf can be removed.");
+  chunks[slots[i].index].hashDirty = true;
+  markChunkDirty(slots[i].index);
+  freeChunks.emplace_back(slots[i].index);
+
+  /*
+    Backward shift deletion: move later entries of the probe sequence into the
+    hole, so that lookups never have to skip over deleted slots.
+  */
+  uint32_t mask = static_cast<uint32_t>(slots.size() - 1);
+  uint32_t j = i;
+  while (true)
+  {
+    j = (j + 1) & mask;
+    if (slots[j].key == EmptyKey)
+      break;
+
+    uint32_t home = hashKey(slots[j].key, shift);
+    // The entry can be moved to i unless its home slot lies cyclically in (i, j].
+    bool reachable = i <= j ? (i < home && home <= j) : (i < home || home <= j);
+    if (!reachable)
+    {
+      slots[i] = slots[j];
+      i = j;
+    }
+  }
+
+  slots[i] = Slot{};
+}
+
+void MortonStorage::markDirty(int x, int y)
+{
+  uint32_t i = slotFor(morton::chunkKey(x, y));
+  if (slots[i].key == EmptyKey)
+    return;
+
+  chunks[slots[i].index].hashDirty = true;
+  markChunkDirty(slots[i].index);
+}
+
+void MortonStorage::markChunkDirty(uint32_t index) const
+{
+  if (!chunkQueued[index])
+  {
+    chunkQueued[index] = true;
+    dirtyChunks.emplace_back(index);
+  }
+}
+
+uint64_t MortonStorage::getHash() const
+{
+  // There are no inner nodes to cache partial results in, so only the parts of the dirty chunks are replaced.
+  for (uint32_t index : dirtyChunks)
+  {
+    // A released chunk is empty, so its part is empty
+    const Node &leaf = chunks[index];
+    replacePart(chunkParts[index], getPart(morton::chunkKey(leaf.getX(), leaf.getY()), leaf));
+    chunkQueued[index] = false;
+  }
+
+  dirtyChunks.clear();
+
+  return hash;
+}
+
+void MortonStorage::grow()
+{
+  std::vector<Slot> old = std::move(slots);
+  slots = std::vector<Slot>(old.size() * 2);
+  --shift;
+
+  for (const Slot &slot : old)
+  {
+    if (slot.key != EmptyKey)
+    {
+      slots[slotFor(slot.key)] = slot;
+    }
+  }
+}
+
+void MortonStorage::getLeaves(std::vector<Node *> &result) const
+{
+  std::vector<Slot> used;
+  used.reserve(chunks.size());
+  for (const Slot &slot : slots)
+  {
+    if (slot.key != EmptyKey)
+      used.emplace_back(slot);
+  }
+
+  std::sort(used.begin(), used.end(), [](const Slot &a, const Slot &b) { return a.key < b.key; });
+
+  result.reserve(result.size() + used.size());
+  for (const Slot &slot : used)
+  {
+    result.emplace_back(const_cast<Node *>(&chunks[slot.index]));
+  }
+}
+
+size_t MortonStorage::getLeafCount() const
+{
+  return chunks.size() - freeChunks.size();
+}
+
+size_t MortonStorage::getNodeCount() const
+{
+  return 0;
+}
+
+size_t MortonStorage::getMemoryUsage() const
+{
+  size_t hashBytes = chunkParts.capacity() * sizeof(Part) + dirtyChunks.capacity() * sizeof(uint32_t) + chunkQueued.capacity() / 8;
+  return sizeof(MortonStorage) + slots.capacity() * sizeof(Slot) + chunks.size() * sizeof(Node) + freeChunks.capacity() * sizeof(uint32_t) + hashBytes;
+}
+
+void MortonStorage::clear()
+{
+  chunks.clear();
+  freeChunks.clear();
+  clearParts();
+  chunkParts.clear();
+  dirtyChunks.clear();
+  chunkQueued.clear();
+  slots = std::vector<Slot>(1 << INITIAL_CAPACITY_LOG2);
+  shift = 32 - INITIAL_CAPACITY_LOG2;
+}
@@ -0,0 +1,89 @@
+#pragma once
+
+#include <stdint.h>
+#include <deque>
+#include <vector>
+
+#include "map_storage.h"
+#include "quad_tree.h"
+
+namespace morton
+{
+	/*
+		Interleaves the bits of x and y: ...y1x1y0x0.
+	*/
+	inline uint32_t encode(uint16_t x, uint16_t y)
+	{
+		auto spread = [](uint32_t v) {
+			v = (v | (v << 8)) & 0x00FF00FF;
+			v = (v | (v << 4)) & 0x0F0F0F0F;
+			v = (v | (v << 2)) & 0x33333333;
+			v = (v | (v << 1)) & 0x55555555;
+			return v;
+		};
+
+		return spread(x) | (spread(y) << 1);
+	}
+
+	/*
+		Morton key of the chunk (4x4 tiles) containing (x, y).
+	*/
+	inline uint32_t chunkKey(int x, int y)
+	{
+		return encode(static_cast<uint16_t>((x >> 2) & 0x3FFF), static_cast<uint16_t>((y >> 2) & 0x3FFF));
+	}
+} // namespace morton
+
+/*
+	Stores the leaves in a flat open-addressing (linear probing) table keyed by the
+	Morton code of the chunk. A lookup is one multiplicative hash and, in the
+	common case, one probe, regardless of the size of the map.
+*/
+class MortonStorage : public MapStorage
+{
+public:
+	MortonStorage();
+
+	MapStorageType getType() const override
+	{
+		return MapStorageType::Morton;
+	}
+
+	quadtree::Node *getLeaf(int x, int y) const override;
+	quadtree::Node &getOrCreateLeaf(int x, int y) override;
+	void removeLeaf(int x, int y) override;
+	void markDirty(int x, int y) override;
+	uint64_t getHash() const override;
+	void getLeaves(std::vector<quadtree::Node *> &result) const override;
+	size_t getLeafCount() const override;
+	size_t getNodeCount() const override;
+	size_t getMemoryUsage() const override;
+	void clear() override;
+
+private:
+	static constexpr uint32_t EmptyKey = UINT32_MAX;
+
+	struct Slot
+	{
+		uint32_t key = EmptyKey;
+		uint32_t index = 0;
+	};
+
+	std::vector<Slot> slots;
+	// Leaves are allocated in blocks. A deque never moves its elements.
+	std::deque<quadtree::Node> chunks;
+	// Indices of chunks released by removeLeaf. They are reused before the deque grows.
+	std::vector<uint32_t> freeChunks;
+
+	uint32_t shift;
+
+	// The part of each chunk that is currently included in the sums (see MapStorage::Part), by chunk index
+	mutable std::vector<Part> chunkParts;
+	// Indices of the chunks whose parts are outdated
+	mutable std::vector<uint32_t> dirtyChunks;
+	mutable std::vector<bool> chunkQueued;
+
+	uint32_t slotFor(uint32_t key) const;
+	void grow();
+	void markChunkDirty(uint32_t index) const;
+};
@@ -0,0 +1,86 @@
+#include "page_file.h"
+
+#include "debug.h"
+
+PageFile::~PageFile()
+{
+  if (file.is_open())
+  {
+    file.close();
+    std::error_code error;
+    std::filesystem::remove(path, error);
+  }
+}
+
+bool PageFile::open(const std::filesystem::path &path)
+{
+  DEBUG_ASSERT(!file.is_open(), "The page file is already open.");
+
+  this->path = path;
+  file.open(path, std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc);
+
+  return file.is_open();
+}
+
+bool PageFile::isOpen() const
+{
+  return file.is_open();
+}
+
+PageFile::Page PageFile::write(const std::string &data)
+{
+  Page page{end, static_cast<uint32_t>(data.size())};
+
+  auto found = freeSpace.lower_bound(page.size);
+  if (found != freeSpace.end())
+  {
+    page.offset = found->second;
+    uint32_t remainder = found->first - page.size;
+    freeSpace.erase(found);
+
+    if (remainder != 0)
+    {
+      freeSpace.emplace(remainder, page.offset + page.size);
+    }
+  }
+  else
+  {
+    end += page.size;
+  }
+
+  file.seekp(page.offset);
+  file.write(data.data(), data.size());
+  if (!file)
+  {
+    ABORT_PROGRAM("Could not write to the page file " + path.string());
+  }
+
+  return page;
+}
+
+std::string PageFile::read(const Page &page)
+{
+  std::string data(page.size, '\0');
+
+  file.seekg(page.offset);
+  file.read(&data[0], page.size);
+  if (!file)
+  {
+    ABORT_PROGRAM("Could not read from the page file " + path.string());
+  }
+
+  return data;
+}
+
+void PageFile::release(const Page &page)
+{
+  if (page.size != 0)
+  {
+    freeSpace.emplace(page.size, page.offset);
+  }
+}
+
+uint64_t PageFile::getSize() const
+{
+  return end;
+}
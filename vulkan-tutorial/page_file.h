@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+
+/*
+	A scratch file that stores variable sized pages. Space of released pages is
+	reused (best fit) before the file grows. The file is removed when the
+	PageFile is destroyed.
+*/
+class PageFile
+{
+public:
+	struct Page
+	{
+		uint64_t offset;
+		uint32_t size;
+	};
+
+	~PageFile();
+
+	/*
+		Create (or truncate) the file. Returns false if the file can not be opened.
+	*/
+	bool open(const std::filesystem::path &path);
+	bool isOpen() const;
+
+	Page write(const std::string &data);
+	std::string read(const Page &page);
+	void release(const Page &page);
+
+	/*
+		Size of the file, including the space of released pages.
+	*/
+	uint64_t getSize() const;
+
+private:
+	std::filesystem::path path;
+	std::fstream file;
+	uint64_t end = 0;
+
+	// Released space, by size
+	std::multimap<uint32_t, uint64_t> freeSpace;
+};
@@ -2,6 +2,7 @@
 
 #include <stdint.h>
 #include <ostream>
+#include <utility>
 
 #include "const.h"
 #include "util.h"
@@ -76,6 +77,28 @@ struct PositionHash
 	}
 };
 
+/*
+	Key of a chunk (the 4x4 tiles of a quadtree leaf): y / 4 in the high 14 bits
+	and x / 4 in the low 14 bits, so keys order chunks by row, then column. Every
+	position on the map (0 <= x, y < 65536) has a key. Used wherever chunks are
+	collected in a container, so that all of them agree on the encoding.
+*/
+struct ChunkKey
+{
+	static uint32_t of(long x, long y)
+	{
+		return (static_cast<uint32_t>(y >> 2) << 14) | static_cast<uint32_t>(x >> 2);
+	}
+
+	/*
+		Position of the top-left tile of the chunk with the key.
+	*/
+	static std::pair<int, int> position(uint32_t key)
+	{
+		return {static_cast<int>(key & 0x3FFF) << 2, static_cast<int>(key >> 14) << 2};
+	}
+};
+
 struct ScreenPosition : public BasePosition<double>
 {
 	WorldPosition worldPos(const MapView &mapView) const;
@@ -0,0 +1,393 @@
+#include "position_bitmap.h"
+
+#include <algorithm>
+
+static uint32_t bitCount(uint16_t mask)
+{
+  uint32_t result = 0;
+  while (mask)
+  {
+    mask &= mask - 1;
+    ++result;
+  }
+
+  return result;
+}
+
+PositionBitmap::PositionBitmap(const PositionBitmap &other)
+    : chunks(other.chunks), count(other.count) {}
+
+PositionBitmap::PositionBitmap(PositionBitmap &&other) noexcept
+    : chunks(std::move(other.chunks)), count(other.count)
+{
+  other.clear();
+}
+
+PositionBitmap &PositionBitmap::operator=(const PositionBitmap &other)
+{
+  // The cached chunk pointer refers to the chunks of this bitmap only
+  chunks = other.chunks;
+  count = other.count;
+  lastKey = UINT32_MAX;
+  lastChunk = nullptr;
+  boundsValid = false;
+  return *this;
+}
+
+PositionBitmap &PositionBitmap::operator=(PositionBitmap &&other) noexcept
+{
+  if (this == &other)
+    return *this;
+
+  chunks = std::move(other.chunks);
+  count = other.count;
+  lastKey = UINT32_MAX;
+  lastChunk = nullptr;
+  boundsValid = false;
+  other.clear();
+  return *this;
+}
+
+bool PositionBitmap::Chunk::empty() const
+{
+  return std::all_of(floors.begin(), floors.end(), [](uint16_t mask) { return mask == 0; });
+}
+
+uint16_t PositionBitmap::bit(int x, int y)
+{
+  return static_cast<uint16_t>(1 << ((x & 3) * 4 + (y & 3)));
+}
+
+PositionBitmap::Chunk &PositionBitmap::getOrCreateChunk(uint32_t key)
+{
+  if (key != lastKey)
+  {
+    lastChunk = &chunks[key];
+    lastKey = key;
+  }
+
+  return *lastChunk;
+}
+
+void PositionBitmap::eraseChunk(Chunks::iterator it)
+{
+  if (it->first == lastKey)
+  {
+    lastKey = UINT32_MAX;
+    lastChunk = nullptr;
+  }
+
+  chunks.erase(it);
+}
+
+bool PositionBitmap::insert(const Position &pos)
+{
+  uint16_t &mask = getOrCreateChunk(ChunkKey::of(pos.x, pos.y)).floors[pos.z];
+  uint16_t b = bit(pos.x, pos.y);
+  if (mask & b)
+    return false;
+
+  mask |= b;
+  ++count;
+  boundsValid = false;
+  return true;
+}
+
+bool PositionBitmap::erase(const Position &pos)
+{
+  auto found = chunks.find(ChunkKey::of(pos.x, pos.y));
+  if (found == chunks.end())
+    return false;
+
+  uint16_t &mask = found->second.floors[pos.z];
+  uint16_t b = bit(pos.x, pos.y);
+  if (!(mask & b))
+    return false;
+
+  mask &= ~b;
+  --count;
+  boundsValid = false;
+
+  if (mask == 0 && found->second.empty())
+    eraseChunk(found);
+
+  return true;
+}
+
+bool PositionBitmap::contains(const Position &pos) const
+{
+  auto found = chunks.find(ChunkKey::of(pos.x, pos.y));
+  return found != chunks.end() && (found->second.floors[pos.z] & bit(pos.x, pos.y));
+}
+
+void PositionBitmap::insertMask(int x, int y, int z, uint16_t mask)
+{
+  if (mask == 0)
+    return;
+
+  uint16_t &current = getOrCreateChunk(ChunkKey::of(x, y)).floors[z];
+  count += bitCount(mask & ~current);
+  current |= mask;
+  boundsValid = false;
+}
+
+void PositionBitmap::insert(const PositionBitmap &other)
+{
+  boundsValid = false;
+  for (const auto &[key, otherChunk] : other.chunks)
+  {
+    Chunk &chunk = getOrCreateChunk(key);
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      count += bitCount(otherChunk.floors[z] & ~chunk.floors[z]);
+      chunk.floors[z] |= otherChunk.floors[z];
+    }
+  }
+}
+
+void PositionBitmap::erase(const PositionBitmap &other)
+{
+  boundsValid = false;
+  for (const auto &[key, otherChunk] : other.chunks)
+  {
+    auto found = chunks.find(key);
+    if (found == chunks.end())
+      continue;
+
+    Chunk &chunk = found->second;
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      count -= bitCount(chunk.floors[z] & otherChunk.floors[z]);
+      chunk.floors[z] &= ~otherChunk.floors[z];
+    }
+
+    if (chunk.empty())
+      eraseChunk(found);
+  }
+}
+
+PositionBitmap PositionBitmap::translated(const Position &delta) const
+{
+  PositionBitmap result;
+
+  if ((delta.x & 3) == 0 && (delta.y & 3) == 0)
+  {
+    for (const auto &[key, chunk] : chunks)
+    {
+      auto [x, y] = ChunkKey::position(key);
+
+      Chunk moved;
+      for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
+      {
+        int movedZ = z + delta.z;
+        if (chunk.floors[z] == 0 || movedZ < 0 || movedZ >= static_cast<int>(MAP_LAYERS))
+          continue;
+
+        moved.floors[movedZ] = chunk.floors[z];
+        result.count += bitCount(chunk.floors[z]);
+      }
+
+      if (!moved.empty())
+        result.chunks.emplace_hint(result.chunks.end(), ChunkKey::of(x + delta.x, y + delta.y), moved);
+    }
+
+    return result;
+  }
+
+  for (Position position : *this)
+  {
+    position += delta;
+    if (position.z >= 0 && position.z < static_cast<int>(MAP_LAYERS))
+      result.insert(position);
+  }
+
+  return result;
+}
+
+template <typename F>
+void PositionBitmap::forEachChunkInRectangle(const Position &from, const Position &to, F f)
+{
+  int x1 = static_cast<int>(std::min(from.x, to.x));
+  int x2 = static_cast<int>(std::max(from.x, to.x));
+  int y1 = static_cast<int>(std::min(from.y, to.y));
+  int y2 = static_cast<int>(std::max(from.y, to.y));
+
+  for (int chunkY = y1 & ~3; chunkY <= y2; chunkY += 4)
+  {
+    // Bits (y & 3) for the rows of the chunk that are in the rectangle
+    uint16_t rows = 0;
+    for (int y = std::max(chunkY, y1); y <= std::min(chunkY + 3, y2); ++y)
+    {
+      rows |= 1 << (y & 3);
+    }
+
+    for (int chunkX = x1 & ~3; chunkX <= x2; chunkX += 4)
+    {
+      uint16_t mask = 0;
+      for (int x = std::max(chunkX, x1); x <= std::min(chunkX + 3, x2); ++x)
+      {
+        mask |= rows << ((x & 3) * 4);
+      }
+
+      f(ChunkKey::of(chunkX, chunkY), mask);
+    }
+  }
+}
+
+void PositionBitmap::insertRectangle(const Position &from, const Position &to)
+{
+  int z1 = std::min(from.z, to.z);
+  int z2 = std::max(from.z, to.z);
+  boundsValid = false;
+
+  forEachChunkInRectangle(from, to, [this, z1, z2](uint32_t key, uint16_t mask) {
+    Chunk &chunk = getOrCreateChunk(key);
+    for (int z = z1; z <= z2; ++z)
+    {
+      count += bitCount(mask & ~chunk.floors[z]);
+      chunk.floors[z] |= mask;
+    }
+  });
+}
+
+void PositionBitmap::eraseRectangle(const Position &from, const Position &to)
+{
+  int z1 = std::min(from.z, to.z);
+  int z2 = std::max(from.z, to.z);
+  boundsValid = false;
+
+  forEachChunkInRectangle(from, to, [this, z1, z2](uint32_t key, uint16_t mask) {
+    auto found = chunks.find(key);
+    if (found == chunks.end())
+      return;
+
+    Chunk &chunk = found->second;
+    for (int z = z1; z <= z2; ++z)
+    {
+      count -= bitCount(mask & chunk.floors[z]);
+      chunk.floors[z] &= ~mask;
+    }
+
+    if (chunk.empty())
+      eraseChunk(found);
+  });
+}
+
+void PositionBitmap::clear()
+{
+  chunks.clear();
+  count = 0;
+  lastKey = UINT32_MAX;
+  lastChunk = nullptr;
+  boundsValid = false;
+}
+
+const std::optional<PositionBitmap::Bounds> &PositionBitmap::getBounds() const
+{
+  if (boundsValid)
+    return bounds;
+
+  bounds.reset();
+  for (const auto &[key, chunk] : chunks)
+  {
+    auto [chunkX, chunkY] = ChunkKey::position(key);
+
+    uint16_t tiles = 0;
+    int z1 = MAP_LAYERS;
+    int z2 = -1;
+    for (int z = 0; z < static_cast<int>(MAP_LAYERS); ++z)
+    {
+      if (chunk.floors[z] == 0)
+        continue;
+
+      tiles |= chunk.floors[z];
+      z1 = std::min(z1, z);
+      z2 = std::max(z2, z);
+    }
+
+    // Bit (x & 3) * 4 + (y & 3): a nibble per column, a bit per row within it
+    int x1 = 3, x2 = 0, y1 = 3, y2 = 0;
+    for (int i = 0; i < 4; ++i)
+    {
+      if (tiles & (0xF << (i * 4)))
+      {
+        x1 = std::min(x1, i);
+        x2 = std::max(x2, i);
+      }
+      if (tiles & (0x1111 << i))
+      {
+        y1 = std::min(y1, i);
+        y2 = std::max(y2, i);
+      }
+    }
+
+    Position from{chunkX + x1, chunkY + y1, z1};
+    Position to{chunkX + x2, chunkY + y2, z2};
+    if (!bounds)
+    {
+      bounds = Bounds{from, to};
+      continue;
+    }
+
+    bounds->from = Position{std::min(bounds->from.x, from.x), std::min(bounds->from.y, from.y), std::min(bounds->from.z, from.z)};
+    bounds->to = Position{std::max(bounds->to.x, to.x), std::max(bounds->to.y, to.y), std::max(bounds->to.z, to.z)};
+  }
+
+  boundsValid = true;
+  return bounds;
+}
+
+size_t PositionBitmap::getMemoryUsage() const
+{
+  // Approximate size of a std::map node: the value and three pointers and a color
+  return chunks.size() * (sizeof(Chunks::value_type) + 4 * sizeof(void *));
+}
+
+PositionBitmap::Iterator::Iterator(Chunks::const_iterator chunk, Chunks::const_iterator end)
+    : chunk(chunk), end(end)
+{
+  if (chunk != end)
+  {
+    bits = chunk->second.floors[0];
+    skipEmpty();
+  }
+}
+
+Position PositionBitmap::Iterator::operator*() const
+{
+  auto [x, y] = ChunkKey::position(chunk->first);
+
+  uint32_t index = 0;
+  while (!(bits & (1 << index)))
+  {
+    ++index;
+  }
+
+  return Position{x + static_cast<long>(index >> 2), y + static_cast<long>(index & 3), static_cast<int>(z)};
+}
+
+PositionBitmap::Iterator &PositionBitmap::Iterator::operator++()
+{
+  bits &= bits - 1;
+  skipEmpty();
+  return *this;
+}
+
+void PositionBitmap::Iterator::skipEmpty()
+{
+  while (bits == 0)
+  {
+    if (++z == MAP_LAYERS)
+    {
+      if (++chunk == end)
+      {
+        z = 0;
+        return;
+      }
+
+      z = 0;
+    }
+
+    bits = chunk->second.floors[z];
+  }
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <map>
+#include <optional>
+
+#include "const.h"
+#include "position.h"
+
+/*
+	Set of map positions stored as one 16-bit mask per chunk floor (4x4 tiles),
+	in a sparse map of the chunks that have any positions. A dense area costs 2
+	bits per position, and operations on rectangles and on other bitmaps work on
+	whole masks instead of single positions. Iteration is in chunk order (by
+	chunk row, then column), then by floor.
+*/
+class PositionBitmap
+{
+public:
+	struct Chunk
+	{
+		// Bit (x & 3) * 4 + (y & 3) of floors[z] is set if (x, y, z) is in the set
+		std::array<uint16_t, MAP_LAYERS> floors{};
+
+		bool empty() const;
+	};
+
+	using Chunks = std::map<uint32_t, Chunk>;
+
+	/*
+		The smallest box that contains all positions, from <= to in each dimension.
+	*/
+	struct Bounds
+	{
+		Position from;
+		Position to;
+	};
+
+	PositionBitmap() = default;
+	PositionBitmap(const PositionBitmap &other);
+	PositionBitmap(PositionBitmap &&other) noexcept;
+	PositionBitmap &operator=(const PositionBitmap &other);
+	PositionBitmap &operator=(PositionBitmap &&other) noexcept;
+
+	class Iterator
+	{
+	public:
+		Iterator(Chunks::const_iterator chunk, Chunks::const_iterator end);
+
+		Position operator*() const;
+		Iterator &operator++();
+
+		bool operator==(const Iterator &other) const
+		{
+			return chunk == other.chunk && z == other.z && bits == other.bits;
+		}
+
+		bool operator!=(const Iterator &other) const
+		{
+			return !(*this == other);
+		}
+
+	private:
+		Chunks::const_iterator chunk;
+		Chunks::const_iterator end;
+		uint32_t z = 0;
+		// The remaining bits of the current floor
+		uint16_t bits = 0;
+
+		void skipEmpty();
+	};
+
+	/*
+		Returns true if the position was not already in the set.
+	*/
+	bool insert(const Position &pos);
+	/*
+		Returns true if the position was in the set.
+	*/
+	bool erase(const Position &pos);
+	bool contains(const Position &pos) const;
+
+	void insert(const PositionBitmap &other);
+	void erase(const PositionBitmap &other);
+
+	/*
+		Add or remove every position in the rectangle between 'from' and 'to'
+		(inclusive, on all floors in between).
+	*/
+	void insertRectangle(const Position &from, const Position &to);
+	void eraseRectangle(const Position &from, const Position &to);
+
+	/*
+		The positions moved by 'delta'. A move by whole chunks only changes the keys
+		of the chunks. Positions that would end up on a floor outside the map are
+		dropped.
+	*/
+	PositionBitmap translated(const Position &delta) const;
+
+	/*
+		Add the positions of 'mask' (see Chunk::floors) on floor z of the chunk that
+		contains (x, y).
+	*/
+	void insertMask(int x, int y, int z, uint16_t mask);
+
+	size_t size() const
+	{
+		return count;
+	}
+
+	bool empty() const
+	{
+		return count == 0;
+	}
+
+	void clear();
+
+	const Chunks &getChunks() const
+	{
+		return chunks;
+	}
+
+	/*
+		Nothing if the set is empty. Computed from the chunks, and cached until the
+		set is modified.
+	*/
+	const std::optional<Bounds> &getBounds() const;
+
+	size_t getMemoryUsage() const;
+
+	Iterator begin() const
+	{
+		return Iterator(chunks.begin(), chunks.end());
+	}
+
+	Iterator end() const
+	{
+		return Iterator(chunks.end(), chunks.end());
+	}
+
+private:
+	Chunks chunks;
+	size_t count = 0;
+
+	// Positions are often added chunk by chunk, so the last chunk is cached.
+	uint32_t lastKey = UINT32_MAX;
+	Chunk *lastChunk = nullptr;
+
+	mutable std::optional<Bounds> bounds;
+	mutable bool boundsValid = false;
+
+	static uint16_t bit(int x, int y);
+
+	Chunk &getOrCreateChunk(uint32_t key);
+	void eraseChunk(Chunks::iterator it);
+
+	/*
+		Calls f(chunk key, mask) for every chunk that overlaps the rectangle, with the
+		mask of the positions of the chunk that are in the rectangle.
+	*/
+	template <typename F>
+	static void forEachChunkInRectangle(const Position &from, const Position &to, F f);
+};
@@ -4,17 +4,18 @@
 #include <string>
 #include <sstream>
 #include <cassert>
+#include <stack>
+#include <algorithm>
 
 #include "debug.h"
+#include "util.h"
 
 using namespace quadtree;
 using namespace std;
 
-// uint32_t has 32 bits: +- get 16 bits each. 4 least sig.
-// is used within a chunk. This gives (16 - 4) / 2 levels in the tree.
-constexpr uint32_t LEVELS_IN_QUAD_TREE = (16 - 4) / 2;
-
-// The implementation assumes a map in the range [-65535, 65535]
+// The implementation assumes a map in the range [0, 65535]. The 16 - BLOCK_BITS
+// most significant bits select the block in QuadTreeStorage.
+constexpr uint32_t BLOCK_SHIFT = 16 - BLOCK_BITS;
 
 Node::Node(Node::NodeType nodeType)
     : nodeType(nodeType)
@@ -75,6 +76,17 @@ TileLocation &Floor::getTileLocation(uint32_t index)
   return locations[index];
 }
 
+bool Floor::isEmpty() const
+{
+  for (const TileLocation &location : locations)
+  {
+    if (location.hasTile())
+      return false;
+  }
+
+  return true;
+}
+
 Floor &Node::getOrCreateFloor(Position pos)
 {
   return getOrCreateFloor(pos.x, pos.y, pos.z);
@@ -131,6 +143,24 @@ Floor::~Floor()
   // cout << "~Floor()" << endl;
 }
 
+void Floor::setPosition(int x, int y, int z)
+{
+  x &= ~3;
+  y &= ~3;
+
+  for (int i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+  {
+    TileLocation &location = locations[i];
+    location.position.x = x + (i >> 2);
+    location.position.y = y + (i & 3);
+    location.position.z = z;
+
+    // A shared tile does not store its position
+    if (location.tile)
+      location.tile->setLocation(location);
+  }
+}
+
 TileLocation *Node::getTile(int x, int y, int z) const
 {
   DEBUG_ASSERT(isLeaf(), "Only leaves can contain tiles.");
@@ -148,12 +178,130 @@ Floor *Node::getFloor(uint32_t z) const
   return this->children[z].get();
 }
 
+void Node::removeFloor(uint32_t z)
+{
+  DEBUG_ASSERT(isLeaf(), "Only leaves contain floors.");
+  DEBUG_ASSERT(!children[z] || children[z]->isEmpty(), "Only an empty floor can be removed.");
+
+  children[z].reset();
+}
+
+bool Node::isEmpty() const
+{
+  if (isLeaf())
+  {
+    return !compressed && std::all_of(children.begin(), children.end(), [](const std::unique_ptr<Floor> &floor) { return !floor; });
+  }
+  else
+  {
+    return std::all_of(nodes.begin(), nodes.end(), [](const std::unique_ptr<Node> &node) { return !node; });
+  }
+}
+
+int Node::getX() const
+{
+  DEBUG_ASSERT(isLeaf(), "Only leaves have a position.");
+  return x;
+}
+
+int Node::getY() const
+{
+  DEBUG_ASSERT(isLeaf(), "Only leaves have a position.");
+  return y;
+}
+
+uint64_t Node::getHash() const
+{
+  if (!hashDirty)
+    return hash;
+
+  DEBUG_ASSERT(!compressed, "The hash of a compressed leaf must be computed before it is compressed.");
+
+  uint64_t result = 0;
+  bool empty = true;
+  itemFilter.clear();
+  summary = ChunkSummary{};
+
+  auto add = [&result, &empty](uint32_t index, uint64_t childHash) {
+    if (childHash == 0)
+      return;
+
+    util::combineHash64(result, index);
+    util::combineHash64(result, childHash);
+    empty = false;
+  };
+
+  if (isLeaf())
+  {
+    for (uint32_t z = 0; z < MAP_LAYERS; ++z)
+    {
+      Floor *floor = children[z].get();
+      if (!floor)
+        continue;
+
+      for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+      {
+        const Tile *tile = floor->getTileLocation(i).getTile();
+        if (tile)
+        {
+          add((z << 4) | i, tile->contentHash());
+          summary.addTile(*tile);
+
+          if (const Item *ground = tile->getGround())
+            itemFilter.add(static_cast<uint16_t>(ground->getId()));
+
+          for (const Item &item : tile->getItems())
+          {
+            itemFilter.add(static_cast<uint16_t>(item.getId()));
+          }
+        }
+      }
+    }
+  }
+  else
+  {
+    for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+    {
+      if (nodes[i])
+      {
+        add(i, nodes[i]->getHash());
+        if (hasItemFilter())
+          itemFilter.add(nodes[i]->itemFilter);
+        summary.add(nodes[i]->summary);
+      }
+    }
+  }
+
+  hash = empty ? 0 : result;
+  hashDirty = false;
+
+  return hash;
+}
+
+const ItemFilter &Node::getItemFilter() const
+{
+  getHash();
+  return itemFilter;
+}
+
+const ChunkSummary &Node::getSummary() const
+{
+  getHash();
+  return summary;
+}
+
+void Node::setLeafPosition(int x, int y)
+{
+  this->x = static_cast<uint16_t>(x & ~3);
+  this->y = static_cast<uint16_t>(y & ~3);
+}
+
 Node *Node::getLeafUnsafe(int x, int y) const
 {
   Node *node = const_cast<Node *>(this);
 
-  uint32_t currentX = x;
-  uint32_t currentY = y;
+  uint32_t currentX = static_cast<uint32_t>(x) << BLOCK_SHIFT;
+  uint32_t currentY = static_cast<uint32_t>(y) << BLOCK_SHIFT;
 
   while (!node->isLeaf())
   {
@@ -189,10 +337,10 @@ Node &Node::getLeaf(int x, int y)
 Node &Node::getLeafWithCreate(int x, int y)
 {
   Node *node = this;
-  uint32_t currentX = x;
-  uint32_t currentY = y;
+  uint32_t currentX = static_cast<uint32_t>(x) << BLOCK_SHIFT;
+  uint32_t currentY = static_cast<uint32_t>(y) << BLOCK_SHIFT;
 
-  uint8_t level = 6;
+  uint8_t level = LEVELS_IN_BLOCK - 1;
 
   Node *leaf = nullptr;
 
@@ -218,6 +366,7 @@ Node &Node::getLeafWithCreate(int x, int y)
       if (level == 0)
       {
         child = make_unique<Node>(Node::NodeType::Leaf, 0);
+        child->setLeafPosition(x, y);
         leaf = child.get();
         break;
       }
@@ -234,4 +383,309 @@ Node &Node::getLeafWithCreate(int x, int y)
   }
 
   return *leaf;
-}
\ No newline at end of file
+}
+
+void Node::getLeaves(std::vector<Node *> &result) const
+{
+  if (isLeaf())
+  {
+    result.emplace_back(const_cast<Node *>(this));
+    return;
+  }
+
+  for (auto &child : nodes)
+  {
+    if (child)
+    {
+      child->getLeaves(result);
+    }
+  }
+}
+
+QuadTreeStorage::QuadTreeStorage()
+{
+}
+
+uint32_t QuadTreeStorage::blockKey(int x, int y)
+{
+  uint32_t blockX = (static_cast<uint32_t>(x) & 0xFFFF) >> BLOCK_BITS;
+  uint32_t blockY = (static_cast<uint32_t>(y) & 0xFFFF) >> BLOCK_BITS;
+
+  return (blockY << (16 - BLOCK_BITS)) | blockX;
+}
+
+Node *QuadTreeStorage::getLeaf(int x, int y) const
+{
+  auto found = blocks.find(blockKey(x, y));
+  if (found == blocks.end())
+    return nullptr;
+
+  return found->second->getLeafUnsafe(x, y);
+}
+
+Node &QuadTreeStorage::getOrCreateLeaf(int x, int y)
+{
+  std::unique_ptr<Node> &block = blocks[blockKey(x, y)];
+  if (!block)
+  {
+    block = std::make_unique<Node>(Node::NodeType::Root);
+  }
+
+  return block->getLeafWithCreate(x, y);
+}
+
+void QuadTreeStorage::removeLeaf(int x, int y)
+{
+  auto found = blocks.find(blockKey(x, y));
+  if (found == blocks.end())
+    return;
+
+  // The parents of the nodes on the path from the block root to the leaf
+  std::array<std::pair<Node *, uint32_t>, LEVELS_IN_BLOCK> path;
+  size_t depth = 0;
+
+  Node *node = found->second.get();
+  uint32_t currentX = static_cast<uint32_t>(x) << BLOCK_SHIFT;
+  uint32_t currentY = static_cast<uint32_t>(y) << BLOCK_SHIFT;
+
+  while (!node->isLeaf())
+  {
+    uint32_t index = ((currentX & 0xC000) >> 14) | ((currentY & 0xC000) >> 12);
+    Node *child = node->nodes[index].get();
+    if (!child)
+      return;
+
+    node->hashDirty = true;
+    path[depth++] = {node, index};
+    node = child;
+    currentX <<= 2;
+    currentY <<= 2;
+  }
+
+  DEBUG_ASSERT(node->isEmpty(), "Only an empty leaf can be removed.");
+  dirtyBlocks.insert(found->first);
+
+  // Release the leaf, and then every ancestor that was only kept alive by it
+  while (depth > 0)
+  {
+    auto [parent, index] = path[--depth];
+    parent->nodes[index].reset();
+
+    if (!parent->isEmpty())
+      return;
+  }
+
+  blocks.erase(found);
+}
+
+void QuadTreeStorage::markDirty(int x, int y)
+{
+  auto found = blocks.find(blockKey(x, y));
+  if (found == blocks.end())
+    return;
+
+  dirtyBlocks.insert(found->first);
+
+  Node *node = found->second.get();
+  uint32_t currentX = static_cast<uint32_t>(x) << BLOCK_SHIFT;
+  uint32_t currentY = static_cast<uint32_t>(y) << BLOCK_SHIFT;
+
+  while (node)
+  {
+    node->hashDirty = true;
+    if (node->isLeaf())
+      break;
+
+    uint32_t index = ((currentX & 0xC000) >> 14) | ((currentY & 0xC000) >> 12);
+    node = node->nodes[index].get();
+    currentX <<= 2;
+    currentY <<= 2;
+  }
+}
+
+uint64_t QuadTreeStorage::getHash() const
+{
+  for (uint32_t key : dirtyBlocks)
+  {
+    Part &current = blockParts[key];
+
+    // The block may have been released
+    auto found = blocks.find(key);
+    if (found == blocks.end())
+    {
+      replacePart(current, Part{});
+      blockParts.erase(key);
+    }
+    else
+    {
+      replacePart(current, getPart(key, *found->second));
+    }
+  }
+
+  dirtyBlocks.clear();
+
+  return hash;
+}
+
+void QuadTreeStorage::forEachChangedLeaf(const MapStorage &other, const LeafPairCallback &f) const
+{
+  if (other.getType() != MapStorageType::QuadTree)
+  {
+    MapStorage::forEachChangedLeaf(other, f);
+    return;
+  }
+
+  const auto &otherBlocks = static_cast<const QuadTreeStorage &>(other).blocks;
+
+  for (const auto &[key, block] : blocks)
+  {
+    auto found = otherBlocks.find(key);
+    forEachChangedLeaf(block.get(), found == otherBlocks.end() ? nullptr : found->second.get(), f);
+  }
+
+  for (const auto &[key, otherBlock] : otherBlocks)
+  {
+    if (blocks.find(key) == blocks.end())
+    {
+      forEachChangedLeaf(nullptr, otherBlock.get(), f);
+    }
+  }
+}
+
+void QuadTreeStorage::forEachChangedLeaf(Node *node, Node *otherNode, const LeafPairCallback &f)
+{
+  uint64_t hash = node ? node->getHash() : 0;
+  uint64_t otherHash = otherNode ? otherNode->getHash() : 0;
+
+  // Equal hashes mean that the whole subtree is equal.
+  if (hash == otherHash)
+    return;
+
+  // Both trees use the same layout, so leaves are always at the same depth.
+  if ((node && node->isLeaf()) || (otherNode && otherNode->isLeaf()))
+  {
+    f(node, otherNode);
+    return;
+  }
+
+  for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+  {
+    Node *child = node ? node->nodes[i].get() : nullptr;
+    Node *otherChild = otherNode ? otherNode->nodes[i].get() : nullptr;
+    if (child || otherChild)
+    {
+      forEachChangedLeaf(child, otherChild, f);
+    }
+  }
+}
+
+void QuadTreeStorage::forEachLeafWithItems(const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f) const
+{
+  constexpr uint32_t BlocksPerRow = 1 << (16 - BLOCK_BITS);
+
+  for (const auto &[key, block] : blocks)
+  {
+    int x = static_cast<int>(key % BlocksPerRow) << BLOCK_BITS;
+    int y = static_cast<int>(key / BlocksPerRow) << BLOCK_BITS;
+    forEachLeafWithItems(block.get(), x, y, 1 << BLOCK_BITS, serverIds, fromX, fromY, toX, toY, f);
+  }
+}
+
+void QuadTreeStorage::forEachLeafWithItems(Node *node, int x, int y, int size, const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f)
+{
+  if (x > toX || y > toY || x + size <= fromX || y + size <= fromY)
+    return;
+
+  // Nodes above ITEM_FILTER_MAX_LEVEL have no filter, so they are always entered
+  if (node->hasItemFilter() && !node->getItemFilter().mayContainAny(serverIds))
+    return;
+
+  if (node->isLeaf())
+  {
+    f(node);
+    return;
+  }
+
+  int childSize = size / 4;
+  for (uint32_t i = 0; i < MAP_TREE_CHILDREN_COUNT; ++i)
+  {
+    Node *child = node->nodes[i].get();
+    if (child)
+    {
+      forEachLeafWithItems(child, x + (i & 3) * childSize, y + (i >> 2) * childSize, childSize, serverIds, fromX, fromY, toX, toY, f);
+    }
+  }
+}
+
+void QuadTreeStorage::getLeaves(std::vector<Node *> &result) const
+{
+  std::vector<uint32_t> keys;
+  keys.reserve(blocks.size());
+  for (const auto &entry : blocks)
+  {
+    keys.emplace_back(entry.first);
+  }
+
+  std::sort(keys.begin(), keys.end());
+
+  for (uint32_t key : keys)
+  {
+    blocks.at(key)->getLeaves(result);
+  }
+}
+
+size_t QuadTreeStorage::getLeafCount() const
+{
+  std::vector<Node *> leaves;
+  getLeaves(leaves);
+  return leaves.size();
+}
+
+size_t QuadTreeStorage::getNodeCount() const
+{
+  size_t count = 0;
+
+  std::stack<const Node *> stack;
+  for (const auto &entry : blocks)
+  {
+    stack.emplace(entry.second.get());
+  }
+
+  while (!stack.empty())
+  {
+    const Node *node = stack.top();
+    stack.pop();
+
+    if (node->isLeaf())
+      continue;
+
+    ++count;
+    for (auto &child : node->nodes)
+    {
+      if (child)
+      {
+        stack.emplace(child.get());
+      }
+    }
+  }
+
+  return count;
+}
+
+size_t QuadTreeStorage::getMemoryUsage() const
+{
+  // Directory: bucket array + one heap allocated entry per block
+  size_t bytes = sizeof(QuadTreeStorage) + blocks.bucket_count() * sizeof(void *);
+  bytes += blocks.size() * (sizeof(std::pair<const uint32_t, std::unique_ptr<Node>>) + sizeof(void *));
+  bytes += blockParts.bucket_count() * sizeof(void *) + blockParts.size() * (sizeof(std::pair<const uint32_t, Part>) + sizeof(void *));
+
+  return bytes + (getNodeCount() + getLeafCount()) * sizeof(Node);
+}
+
+void QuadTreeStorage::clear()
+{
+  blocks.clear();
+  clearParts();
+  blockParts.clear();
+  dirtyBlocks.clear();
+}
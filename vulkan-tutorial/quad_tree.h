@@ -3,13 +3,20 @@
 #include <stdint.h>
 #include <array>
 #include <memory>
+#include <unordered_map>
+#include <unordered_set>
 
 #include "position.h"
 #include "tile_location.h"
 #include "const.h"
+#include "map_storage.h"
+#include "item_filter.h"
+#include "chunk_summary.h"
 
 class MapIterator;
 class Map;
+class MortonStorage;
+class CompressedChunks;
 
 class Floor
 {
@@ -23,6 +30,17 @@ public:
 	TileLocation &getTileLocation(int x, int y);
 	TileLocation &getTileLocation(uint32_t index);
 
+	/*
+		True if none of the locations in the floor has a tile.
+	*/
+	bool isEmpty() const;
+
+	/*
+		Give the locations (and their tiles) the positions of the floor at z in the
+		chunk that contains (x, y). Used to move a whole floor to another chunk.
+	*/
+	void setPosition(int x, int y, int z);
+
 private:
 	// x, y locations
 	TileLocation locations[MAP_TREE_CHILDREN_COUNT];
@@ -30,16 +48,33 @@ private:
 
 namespace quadtree
 {
+	/*
+		The tree is split into blocks of (1 << BLOCK_BITS) x (1 << BLOCK_BITS) tiles.
+		Only blocks that contain tiles are allocated, so the depth of a lookup does
+		not depend on the size of the map.
+	*/
+	constexpr uint32_t BLOCK_BITS = 8;
+
+	// The 2 least significant bits of x and y are used within a leaf, and every level consumes 2 more.
+	constexpr uint32_t LEVELS_IN_BLOCK = (BLOCK_BITS - 2) / 2;
+
+	/*
+		The highest level whose nodes have an item filter. A node of level 1 combines
+		the ids of 16 chunks; above that, a filter would have the ids of hundreds of
+		chunks and let almost every id through (see ItemFilter).
+	*/
+	constexpr int ITEM_FILTER_MAX_LEVEL = 1;
+
 	class Node
 	{
-		enum class NodeType
+	public:
+		enum class NodeType : uint8_t
 		{
 			Root,
 			Node,
 			Leaf
 		};
 
-	public:
 		Node(NodeType nodeType);
 		Node(NodeType nodeType, int level);
 		~Node();
@@ -51,7 +86,11 @@ namespace quadtree
 		Node(const Node &) = delete;
 		Node &operator=(const Node &) = delete;
 
-		// Get a leaf node. Creates the leaf node if it does not already exist.
+		/*
+			Get a leaf node. Creates the leaf node if it does not already exist.
+			Only the BLOCK_BITS least significant bits of x and y are used, i.e. the
+			node must be the root of a block.
+		*/
 		Node &getLeafWithCreate(int x, int y);
 		Node &getLeaf(int x, int y);
 		Node *getLeafUnsafe(int x, int y) const;
@@ -61,20 +100,143 @@ namespace quadtree
 		Floor &getOrCreateFloor(int x, int y, int z);
 		Floor *getFloor(uint32_t z) const;
 
+		/*
+			Release the floor at z. The floor must not contain any tiles.
+		*/
+		void removeFloor(uint32_t z);
+
+		/*
+			True if the node has no children (floors for a leaf, nodes otherwise). A
+			compressed leaf is not empty.
+		*/
+		bool isEmpty() const;
+
+		/*
+			The position of the top-left tile of a leaf.
+		*/
+		int getX() const;
+		int getY() const;
+
+		/*
+			Content hash of the subtree. A leaf hashes the contents of its tiles, other
+			nodes hash the hashes of their children, so equal hashes mean equal content.
+			Only recomputed if the node has been marked dirty (see MapStorage::markDirty).
+			A node without any content hashes to 0.
+		*/
+		uint64_t getHash() const;
+
+		/*
+			Bloom filter of the server ids of the items in the subtree (ground
+			included). Computed together with the content hash, so it is also only
+			rebuilt for dirty nodes, and a compressed leaf keeps its filter.
+			Only meaningful if hasItemFilter() is true; the filter of a higher node is
+			empty.
+		*/
+		const ItemFilter &getItemFilter() const;
+
+		/*
+			True for leaves and the nodes up to ITEM_FILTER_MAX_LEVEL. The few nodes
+			above (17 per block) keep the unused filter member.
+		*/
+		bool hasItemFilter() const
+		{
+			return nodeType != NodeType::Root && level <= ITEM_FILTER_MAX_LEVEL;
+		}
+
+		/*
+			Flags, item counts and other facts about the tiles in the subtree. Like
+			the item filter, it is rebuilt together with the content hash, and a
+			compressed leaf keeps its summary.
+		*/
+		const ChunkSummary &getSummary() const;
+
 		TileLocation &getOrCreateTileLocation(Position pos);
 
 		bool isLeaf() const;
 		bool isRoot() const;
 
-		friend class Map;
-		friend class MapIterator;
+		/*
+			True if the floors of the leaf are stored in CompressedChunks.
+		*/
+		bool isCompressed() const
+		{
+			return compressed;
+		}
+
+		/*
+			Appends all leaves in this subtree to 'result'.
+		*/
+		void getLeaves(std::vector<Node *> &result) const;
+
+		friend class ::Map;
+		friend class ::MapIterator;
+		friend class QuadTreeStorage;
+		friend class ::MortonStorage;
+		friend class ::CompressedChunks;
 
 	protected:
 		NodeType nodeType = NodeType::Root;
+		mutable bool hashDirty = true;
+		// Only used by leaves
+		uint16_t x = 0;
+		uint16_t y = 0;
+		// True if the floors of the leaf are stored in CompressedChunks
+		bool compressed = false;
+		// When the leaf was last accessed through the map (see Map::compressInactiveChunks)
+		uint32_t lastAccess = 0;
+		mutable uint64_t hash = 0;
+		mutable ItemFilter itemFilter;
+		mutable ChunkSummary summary;
+
+		void setLeafPosition(int x, int y);
 		union
 		{
 			std::array<std::unique_ptr<Node>, MAP_TREE_CHILDREN_COUNT> nodes{};
 			std::array<std::unique_ptr<Floor>, MAP_TREE_CHILDREN_COUNT> children;
 		};
 	};
+
+	class QuadTreeStorage : public MapStorage
+	{
+	public:
+		QuadTreeStorage();
+
+		MapStorageType getType() const override
+		{
+			return MapStorageType::QuadTree;
+		}
+
+		Node *getLeaf(int x, int y) const override;
+		Node &getOrCreateLeaf(int x, int y) override;
+		void removeLeaf(int x, int y) override;
+		void markDirty(int x, int y) override;
+		uint64_t getHash() const override;
+		void forEachChangedLeaf(const MapStorage &other, const LeafPairCallback &f) const override;
+		void forEachLeafWithItems(const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f) const override;
+		void getLeaves(std::vector<Node *> &result) const override;
+		size_t getLeafCount() const override;
+		size_t getNodeCount() const override;
+		size_t getMemoryUsage() const override;
+		void clear() override;
+
+	private:
+		/*
+			Sparse top-level directory of the blocks that contain any leaves.
+		*/
+		std::unordered_map<uint32_t, std::unique_ptr<Node>> blocks;
+
+		// The part of each block that is currently included in the sums (see MapStorage::Part)
+		mutable std::unordered_map<uint32_t, Part> blockParts;
+		// Keys of the blocks whose parts are outdated
+		mutable std::unordered_set<uint32_t> dirtyBlocks;
+
+		static uint32_t blockKey(int x, int y);
+
+		static void forEachChangedLeaf(Node *node, Node *otherNode, const LeafPairCallback &f);
+		/*
+			'x' and 'y' are the position of the top-left tile of the node, and 'size'
+			is the width of the area that it covers.
+		*/
+		static void forEachLeafWithItems(Node *node, int x, int y, int size, const std::vector<uint16_t> &serverIds, int fromX, int fromY, int toX, int toY, const LeafCallback &f);
+	};
 }; // namespace quadtree
\ No newline at end of file
@@ -1,39 +1,98 @@
 #include "selection.h"
 
+#include <algorithm>
+
 #include "map_view.h"
 #include "debug.h"
 #include "action/action.h"
 
+SelectionArea::SelectionArea(const Position &a, const Position &b)
+    : from{std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z)},
+      to{std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z)}
+{
+}
+
 Selection::Selection(MapView &mapView) : mapView(mapView)
 {
 }
 
-void Selection::merge(std::unordered_set<Position, PositionHash> &positions)
+void Selection::merge(const PositionBitmap &positions)
+{
+  positionsWithSelection.insert(positions);
+}
+
+void Selection::deselect(const PositionBitmap &positions)
+{
+  positionsWithSelection.erase(positions);
+}
+
+bool Selection::contains(const Position pos) const
+{
+  if (positionsWithSelection.contains(pos))
+    return true;
+
+  if (!inArea(pos))
+    return false;
+
+  const Tile *tile = mapView.getTile(pos);
+  return tile && !tile->isEmpty();
+}
+
+bool Selection::inArea(const Position pos) const
+{
+  return std::any_of(areas.begin(), areas.end(), [&pos](const SelectionArea &area) { return area.contains(pos); });
+}
+
+void Selection::addArea(const SelectionArea &area)
 {
-  for (const auto &pos : positions)
+  areas.emplace_back(area);
+}
+
+void Selection::removeArea(const SelectionArea &area)
+{
+  auto found = std::find(areas.begin(), areas.end(), area);
+  if (found != areas.end())
   {
-    positionsWithSelection.emplace(pos);
+    areas.erase(found);
+    return;
   }
+
+  mapView.getMap()->selectArea(area.from, area.to, false);
+  positionsWithSelection.eraseRectangle(area.from, area.to);
 }
 
-void Selection::deselect(std::unordered_set<Position, PositionHash> &positions)
+void Selection::materialize()
 {
-  for (const auto &pos : positions)
+  for (const SelectionArea &area : areas)
   {
-    positionsWithSelection.erase(pos);
+    positionsWithSelection.insert(mapView.getMap()->selectArea(area.from, area.to));
   }
+
+  areas.clear();
 }
 
-bool Selection::contains(const Position pos) const
+void Selection::materialize(const Position pos)
 {
-  return positionsWithSelection.find(pos) != positionsWithSelection.end();
+  auto it = areas.begin();
+  while (it != areas.end())
+  {
+    if (it->contains(pos))
+    {
+      positionsWithSelection.insert(mapView.getMap()->selectArea(it->from, it->to));
+      it = areas.erase(it);
+    }
+    else
+    {
+      ++it;
+    }
+  }
 }
 
 void Selection::select(const Position pos)
 {
   DEBUG_ASSERT(mapView.getTile(pos)->hasSelection(), "The tile does not have a selection.");
 
-  positionsWithSelection.emplace(pos);
+  positionsWithSelection.insert(pos);
 }
 
 void Selection::deselect(const Position pos)
@@ -41,20 +100,39 @@ void Selection::deselect(const Position pos)
   positionsWithSelection.erase(pos);
 }
 
-std::unordered_set<Position, PositionHash> Selection::getPositions() const
+const PositionBitmap &Selection::getPositions() const
 {
   return positionsWithSelection;
 }
 
+std::optional<PositionBitmap::Bounds> Selection::getBounds() const
+{
+  std::optional<PositionBitmap::Bounds> bounds = positionsWithSelection.getBounds();
+  for (const SelectionArea &area : areas)
+  {
+    if (!bounds)
+    {
+      bounds = PositionBitmap::Bounds{area.from, area.to};
+      continue;
+    }
+
+    bounds->from = Position{std::min(bounds->from.x, area.from.x), std::min(bounds->from.y, area.from.y), std::min(bounds->from.z, area.from.z)};
+    bounds->to = Position{std::max(bounds->to.x, area.to.x), std::max(bounds->to.y, area.to.y), std::max(bounds->to.z, area.to.z)};
+  }
+
+  return bounds;
+}
+
 void Selection::clear()
 {
   positionsWithSelection.clear();
+  areas.clear();
 }
 
 void Selection::deselectAll()
 {
   // There is no need to commit an action if there are no selections
-  if (positionsWithSelection.empty())
+  if (empty())
   {
     return;
   }
@@ -62,8 +140,8 @@ void Selection::deselectAll()
   mapView.history.startGroup(ActionGroupType::Selection);
   MapAction action(mapView, MapActionType::Selection);
 
-  action.addChange(Change::deselection(positionsWithSelection));
-  positionsWithSelection.clear();
+  // The areas are deselected without being materialized
+  action.addChange(Change::deselection(positionsWithSelection, areas));
 
   mapView.history.commit(std::move(action));
   mapView.history.endGroup(ActionGroupType::Selection);
@@ -71,5 +149,5 @@ void Selection::deselectAll()
 
 bool Selection::empty() const
 {
-  return positionsWithSelection.empty();
+  return positionsWithSelection.empty() && areas.empty();
 }
@@ -2,12 +2,42 @@
 
 #include <functional>
 #include <optional>
-#include <unordered_set>
+#include <vector>
 
 #include "tile.h"
+#include "position_bitmap.h"
 
 class MapView;
 
+/*
+  A rectangle of tiles between 'from' and 'to' (inclusive, on all floors in
+  between), with from <= to in each dimension.
+*/
+struct SelectionArea
+{
+  SelectionArea(const Position &a, const Position &b);
+
+  Position from;
+  Position to;
+
+  bool contains(const Position &pos) const
+  {
+    return from.x <= pos.x && pos.x <= to.x && from.y <= pos.y && pos.y <= to.y && from.z <= pos.z && pos.z <= to.z;
+  }
+
+  bool operator==(const SelectionArea &other) const
+  {
+    return from == other.from && to == other.to;
+  }
+};
+
+/*
+  The selected tiles. A selected rectangle is kept as a SelectionArea (with all
+  non-empty tiles in it selected) until an operation needs the selected items,
+  so that selecting a large area does not touch its tiles. Such an operation
+  calls materialize(), which selects the items of the areas (see
+  Map::selectArea) and adds their tiles to the positions of the selection.
+*/
 class Selection
 {
 public:
@@ -16,15 +46,51 @@ public:
   std::optional<Position> moveOrigin = {};
   bool moving = false;
 
+  /*
+    True if the tile at the position is selected, including non-empty tiles in
+    areas that have not been materialized.
+  */
   bool contains(const Position pos) const;
+  /*
+    True if the position is in an area that has not been materialized. Does not
+    look at the tile.
+  */
+  bool inArea(const Position pos) const;
   void select(const Position pos);
   void deselect(const Position pos);
-  void deselect(std::unordered_set<Position, PositionHash> &positions);
-  void merge(std::unordered_set<Position, PositionHash> &positions);
+  void deselect(const PositionBitmap &positions);
+  void merge(const PositionBitmap &positions);
+
+  void addArea(const SelectionArea &area);
+  /*
+    Remove an area from the selection. If the area has been materialized, the
+    tiles in it are deselected instead.
+  */
+  void removeArea(const SelectionArea &area);
+
+  /*
+    Select the items of all areas, or of the areas that contain 'pos'.
+  */
+  void materialize();
+  void materialize(const Position pos);
 
   bool empty() const;
 
-  std::unordered_set<Position, PositionHash> getPositions() const;
+  /*
+    Does not include the tiles of areas that have not been materialized.
+  */
+  const PositionBitmap &getPositions() const;
+
+  /*
+    Bounding box of the selected tiles and the areas, or nothing if the
+    selection is empty.
+  */
+  std::optional<PositionBitmap::Bounds> getBounds() const;
+
+  const std::vector<SelectionArea> &getAreas() const
+  {
+    return areas;
+  }
 
   void deselectAll();
 
@@ -36,5 +102,6 @@ public:
 
 private:
   MapView &mapView;
-  std::unordered_set<Position, PositionHash> positionsWithSelection;
+  PositionBitmap positionsWithSelection;
+  std::vector<SelectionArea> areas;
 };
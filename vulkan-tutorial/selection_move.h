@@ -0,0 +1,48 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "position.h"
+#include "position_bitmap.h"
+#include "tile.h"
+
+/*
+	A move of the selected items by 'delta' (see Map::moveSelection), stored
+	compactly enough to be undone. Tiles whose items are all selected are moved
+	whole, so they are only recorded as positions; the only tiles that are kept
+	are the ones that the move replaced or modified, as they were before the move.
+
+	Applying the move again (Map::applySelectionMove) undoes it, and applying it
+	once more redoes it.
+*/
+struct SelectionMove
+{
+	Position delta;
+	// The selected positions before the move
+	PositionBitmap positions;
+	// The positions of the tiles that were moved whole (all items selected)
+	PositionBitmap wholeTiles;
+	/*
+		The tiles at the positions that the move replaced or modified, before the
+		move. nullptr if there was no tile, i.e. the tile at the position is removed
+		when the move is undone.
+	*/
+	std::vector<std::pair<Position, std::unique_ptr<Tile>>> replaced;
+	// True if the map currently has the items at their moved positions
+	bool applied = false;
+
+	size_t getMemoryUsage() const
+	{
+		size_t bytes = positions.getMemoryUsage() + wholeTiles.getMemoryUsage();
+		bytes += replaced.capacity() * sizeof(replaced[0]);
+		for (const auto &[position, tile] : replaced)
+		{
+			if (tile)
+				bytes += sizeof(Tile) + tile->getItems().capacity() * sizeof(Item) + (tile->getGround() ? sizeof(Item) : 0);
+		}
+
+		return bytes;
+	}
+};
@@ -6,12 +6,12 @@
 #include "tile_location.h"
 
 Tile::Tile(TileLocation &tileLocation)
-    : position(tileLocation.position), selectionCount(0)
+    : position(tileLocation.position), selectionCount(0), flags(0)
 {
 }
 
 Tile::Tile(Position position)
-    : position(position), selectionCount(0) {}
+    : position(position), selectionCount(0), flags(0) {}
 
 // TODO BUG? It is possible that entityId from OptionalEntity does not get moved correctly.
 // TODO It should be deleted from "other" and put into the newly constructed Tile.
@@ -19,7 +19,8 @@ Tile::Tile(Tile &&other) noexcept
     : items(std::move(other.items)),
       ground(std::move(other.ground)),
       position(other.position),
-      selectionCount(other.selectionCount)
+      selectionCount(other.selectionCount),
+      flags(other.flags)
 {
 }
 
@@ -29,6 +30,7 @@ Tile &Tile::operator=(Tile &&other) noexcept
   ground = std::move(other.ground);
   position = std::move(other.position);
   selectionCount = other.selectionCount;
+  flags = other.flags;
 
   return *this;
 }
@@ -78,7 +80,8 @@ void Tile::moveSelected(Tile &other)
   if (ground && ground->selected)
   {
     other.items.clear();
-    other.ground = dropGround();
+    other.addItem(std::move(*dropGround()));
+    --selectionCount;
   }
 
   auto it = items.begin();
@@ -115,57 +118,64 @@ void Tile::addItem(Item &&item)
     return;
   }
 
-  std::vector<Item>::iterator cursor;
+  StackPosition stackPosition = getStackPosition(item);
+  if (stackPosition.replace)
+  {
+    // Replace the current item at the position with the new item
+    items[stackPosition.index] = std::move(item);
+    return;
+  }
+
+  if (item.selected)
+  {
+    ++selectionCount;
+  }
+
+  items.insert(items.begin() + stackPosition.index, std::move(item));
+}
+
+Tile::StackPosition Tile::getStackPosition(const Item &item) const
+{
+  if (!item.itemType->alwaysOnTop)
+  {
+    return {items.size(), false};
+  }
 
-  if (item.itemType->alwaysOnTop)
+  auto cursor = items.begin();
+  while (cursor != items.end())
   {
-    cursor = items.begin();
-    while (cursor != items.end())
+    if (cursor->itemType->alwaysOnTop)
     {
-      if (cursor->itemType->alwaysOnTop)
+      if (item.itemType->isGroundBorder())
       {
-        if (item.itemType->isGroundBorder())
+        if (!cursor->itemType->isGroundBorder())
         {
-          if (!cursor->itemType->isGroundBorder())
-          {
-            break;
-          }
+          break;
         }
-        else // New item is not a border
+      }
+      else // New item is not a border
+      {
+        if (cursor->itemType->alwaysOnTop)
         {
-          if (cursor->itemType->alwaysOnTop)
+          if (!cursor->itemType->isGroundBorder())
           {
-            if (!cursor->itemType->isGroundBorder())
-            {
-              // Replace the current item at cursor with the new item
-              *(cursor) = std::move(item);
-              return;
-            }
+            return {static_cast<size_t>(cursor - items.begin()), true};
           }
         }
-        // if (item.getTopOrder() < cursor->getTopOrder())
-        // {
-        //   break;
-        // }
-      }
-      else
-      {
-        break;
       }
-      ++cursor;
+      // if (item.getTopOrder() < cursor->getTopOrder())
+      // {
+      //   break;
+      // }
     }
-  }
-  else
-  {
-    cursor = items.end();
-  }
-
-  if (item.selected)
-  {
-    ++selectionCount;
+    else
+    {
+      break;
+    }
+    ++cursor;
   }
 
-  items.insert(cursor, std::move(item));
+  return {static_cast<size_t>(cursor - items.begin()), false};
 }
 
 void Tile::setGround(std::unique_ptr<Item> ground)
@@ -314,7 +324,7 @@ bool Tile::topItemSelected() const
   return allSelected() || topItem->selected;
 }
 
-size_t Tile::getEntityCount()
+size_t Tile::getEntityCount() const
 {
   size_t result = items.size();
   if (ground)
@@ -373,6 +383,21 @@ bool Tile::isEmpty() const
   return !ground && items.empty();
 }
 
+uint64_t Tile::contentHash() const
+{
+  if (isEmpty() && flags == 0)
+    return 0;
+
+  uint64_t hash = util::mixHash(flags);
+  util::combineHash64(hash, ground ? ground->contentHash() : 0);
+  for (const Item &item : items)
+  {
+    util::combineHash64(hash, item.contentHash());
+  }
+
+  return hash;
+}
+
 bool Tile::allSelected() const
 {
   size_t size = items.size();
@@ -31,7 +31,18 @@ public:
 	bool hasTopItem() const;
 	Item *getGround() const;
 
+	struct StackPosition
+	{
+		size_t index;
+		// The item replaces the item at 'index' instead of being inserted before it
+		bool replace;
+	};
+
 	void addItem(Item &&item);
+	/*
+		Where addItem puts a (non-ground) item in the stack.
+	*/
+	StackPosition getStackPosition(const Item &item) const;
 	void removeItem(size_t index);
 	void removeGround();
 	std::unique_ptr<Item> dropGround();
@@ -41,6 +52,12 @@ public:
 
 	bool isEmpty() const;
 
+	/*
+		Hash of the tile's items and flags (not its position or selection). An empty
+		tile without flags hashes to 0, the same as no tile at all.
+	*/
+	uint64_t contentHash() const;
+
 	int getTopElevation() const;
 
 	const std::vector<Item> &getItems() const
@@ -56,7 +73,7 @@ public:
 	/*
 		Counts all entities (items, creature, spawn, waypoint, etc.).
 	*/
-	size_t getEntityCount();
+	size_t getEntityCount() const;
 
 	uint16_t getMapFlags() const;
 	uint16_t getStatFlags() const;
@@ -70,8 +87,11 @@ public:
 	long getZ() const;
 
 private:
+	friend class Map;
 	friend class MapView;
 	friend class MapAction;
+	friend class TileCodec;
+	friend class HistoryCodec;
 
 	Tile(Position position);
 
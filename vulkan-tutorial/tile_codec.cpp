@@ -0,0 +1,317 @@
+#include "tile_codec.h"
+
+#include <cstring>
+
+#include "tile.h"
+#include "item.h"
+#include "items.h"
+#include "ecs/ecs.h"
+#include "ecs/item_animation.h"
+#include "graphics/appearances.h"
+
+namespace
+{
+  enum class AttributeValueType : uint8_t
+  {
+    Bool = 0,
+    Int = 1,
+    Double = 2,
+    String = 3
+  };
+} // namespace
+
+void TileCodec::writeItem(BinaryWriter &writer, const Item &item)
+{
+  writer.writeU16(static_cast<uint16_t>(item.getId()));
+  writer.writeU16(item.getSubtype());
+  writer.writeU8(static_cast<uint8_t>(item.getAttributes().size()));
+
+  for (const auto &[type, constAttribute] : item.getAttributes())
+  {
+    // ItemAttribute::get is not const
+    ItemAttribute attribute = constAttribute;
+    writer.writeU8(static_cast<uint8_t>(type));
+
+    if (attribute.holds<bool>())
+    {
+      writer.writeU8(to_underlying(AttributeValueType::Bool));
+      writer.writeU8(attribute.get<bool>().value() ? 1 : 0);
+    }
+    else if (attribute.holds<int>())
+    {
+      writer.writeU8(to_underlying(AttributeValueType::Int));
+      writer.writeU32(static_cast<uint32_t>(attribute.get<int>().value()));
+    }
+    else if (attribute.holds<double>())
+    {
+      writer.writeU8(to_underlying(AttributeValueType::Double));
+      double value = attribute.get<double>().value();
+      uint64_t bits;
+      std::memcpy(&bits, &value, sizeof(bits));
+      writer.writeU64(bits);
+    }
+    else
+    {
+      writer.writeU8(to_underlying(AttributeValueType::String));
+      std::string value = attribute.get<std::string>().value();
+      writer.writeU32(static_cast<uint32_t>(value.size()));
+      writer.writeBytes(value.data(), value.size());
+    }
+  }
+}
+
+std::optional<TileCodec::ItemData> TileCodec::readItem(BinaryReader &reader)
+{
+  ItemData item;
+  item.id = reader.readU16();
+  item.subtype = reader.readU16();
+
+  // The data can come from another item set or be corrupt; an unknown id would crash createItem
+  const ItemType *itemType = Items::items.getItemType(item.id);
+  if (itemType == nullptr || !itemType->isValid())
+    return {};
+
+  uint8_t attributeCount = reader.readU8();
+  for (uint8_t i = 0; i < attributeCount && reader.ok(); ++i)
+  {
+    auto type = static_cast<ItemAttribute_t>(reader.readU8());
+    if (type < ItemAttribute_t::UniqueId || type > ItemAttribute_t::Description)
+      return {};
+
+    ItemAttribute attribute(type);
+    switch (static_cast<AttributeValueType>(reader.readU8()))
+    {
+    case AttributeValueType::Bool:
+      attribute.setBool(reader.readU8() != 0);
+      break;
+    case AttributeValueType::Int:
+      attribute.setInt(static_cast<int>(reader.readU32()));
+      break;
+    case AttributeValueType::Double:
+    {
+      uint64_t bits = reader.readU64();
+      double value;
+      std::memcpy(&value, &bits, sizeof(value));
+      attribute.setDouble(value);
+      break;
+    }
+    case AttributeValueType::String:
+    {
+      uint32_t length = reader.readU32();
+      if (length > reader.remaining())
+        return {};
+
+      std::string value(length, '\0');
+      if (!reader.readBytes(value.data(), value.size()))
+        return {};
+      attribute.setString(value);
+      break;
+    }
+    default:
+      return {};
+    }
+
+    item.attributes.emplace_back(std::move(attribute));
+  }
+
+  if (!reader.ok())
+    return {};
+
+  return item;
+}
+
+Item TileCodec::createItem(const ItemData &data)
+{
+  Item item(data.id);
+  item.setSubtype(data.subtype);
+  for (const ItemAttribute &attribute : data.attributes)
+  {
+    item.setAttribute(ItemAttribute(attribute));
+  }
+
+  const SpriteInfo &spriteInfo = item.itemType->appearance->getSpriteInfo();
+  if (spriteInfo.hasAnimation())
+  {
+    ecs::EntityId entityId = item.assignNewEntityId();
+    g_ecs.addComponent(entityId, ItemAnimationComponent(spriteInfo.getAnimation()));
+  }
+
+  return item;
+}
+
+void BinaryWriter::writeU8(uint8_t value)
+{
+  data.emplace_back(value);
+}
+
+void BinaryWriter::writeU16(uint16_t value)
+{
+  writeLittleEndian(value, 2);
+}
+
+void BinaryWriter::writeU32(uint32_t value)
+{
+  writeLittleEndian(value, 4);
+}
+
+void BinaryWriter::writeU64(uint64_t value)
+{
+  writeLittleEndian(value, 8);
+}
+
+void BinaryWriter::writeBytes(const void *source, size_t amount)
+{
+  const uint8_t *bytes = static_cast<const uint8_t *>(source);
+  data.insert(data.end(), bytes, bytes + amount);
+}
+
+void BinaryWriter::writeLittleEndian(uint64_t value, int bytes)
+{
+  for (int i = 0; i < bytes; ++i)
+  {
+    data.emplace_back(static_cast<uint8_t>(value >> (i * 8)));
+  }
+}
+
+BinaryReader::BinaryReader(const std::vector<uint8_t> &data)
+    : data(data) {}
+
+uint8_t BinaryReader::readU8()
+{
+  return static_cast<uint8_t>(readLittleEndian(1));
+}
+
+uint16_t BinaryReader::readU16()
+{
+  return static_cast<uint16_t>(readLittleEndian(2));
+}
+
+uint32_t BinaryReader::readU32()
+{
+  return static_cast<uint32_t>(readLittleEndian(4));
+}
+
+uint64_t BinaryReader::readU64()
+{
+  return readLittleEndian(8);
+}
+
+bool BinaryReader::readBytes(void *destination, size_t amount)
+{
+  if (!require(amount))
+    return false;
+
+  std::memcpy(destination, data.data() + cursor, amount);
+  cursor += amount;
+  return true;
+}
+
+bool BinaryReader::require(size_t amount)
+{
+  if (!valid || data.size() - cursor < amount)
+  {
+    valid = false;
+  }
+
+  return valid;
+}
+
+uint64_t BinaryReader::readLittleEndian(int bytes)
+{
+  if (!require(bytes))
+    return 0;
+
+  uint64_t value = 0;
+  for (int i = 0; i < bytes; ++i)
+  {
+    value |= static_cast<uint64_t>(data[cursor + i]) << (i * 8);
+  }
+  cursor += bytes;
+
+  return value;
+}
+
+void TileCodec::write(BinaryWriter &writer, const Tile &tile)
+{
+  writer.writeU32((static_cast<uint32_t>(tile.getStatFlags()) << 16) | tile.getMapFlags());
+
+  const Item *ground = tile.getGround();
+  writer.writeU8(ground ? 1 : 0);
+  if (ground)
+  {
+    writeItem(writer, *ground);
+  }
+
+  writer.writeU16(static_cast<uint16_t>(tile.getItemCount()));
+  for (const Item &item : tile.getItems())
+  {
+    writeItem(writer, item);
+  }
+}
+
+std::optional<TileCodec::TileData> TileCodec::read(BinaryReader &reader)
+{
+  TileData tile;
+  tile.flags = reader.readU32();
+
+  if (reader.readU8() != 0)
+  {
+    tile.ground = readItem(reader);
+    if (!tile.ground)
+      return {};
+  }
+
+  uint16_t itemCount = reader.readU16();
+  for (uint16_t i = 0; i < itemCount; ++i)
+  {
+    std::optional<ItemData> item = readItem(reader);
+    if (!item)
+      return {};
+
+    tile.items.emplace_back(std::move(item.value()));
+  }
+
+  if (!reader.ok())
+    return {};
+
+  return tile;
+}
+
+std::unique_ptr<Tile> TileCodec::createTile(TileLocation &location, const TileData &data)
+{
+  auto tile = std::make_unique<Tile>(location);
+  tile->flags = data.flags;
+
+  if (data.ground)
+  {
+    tile->ground = std::make_unique<Item>(createItem(data.ground.value()));
+  }
+
+  // Keep the stored order instead of letting Tile::addItem sort the items
+  tile->items.reserve(data.items.size());
+  for (const ItemData &item : data.items)
+  {
+    tile->items.emplace_back(createItem(item));
+  }
+
+  return tile;
+}
+
+Tile TileCodec::createTile(const Position &position, const TileData &data)
+{
+  Tile tile(position);
+  tile.flags = data.flags;
+
+  if (data.ground)
+  {
+    tile.ground = std::make_unique<Item>(createItem(data.ground.value()));
+  }
+
+  tile.items.reserve(data.items.size());
+  for (const ItemData &item : data.items)
+  {
+    tile.items.emplace_back(createItem(item));
+  }
+
+  return tile;
+}
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <optional>
+#include <vector>
+
+#include "item_attribute.h"
+#include "position.h"
+
+class Item;
+class Tile;
+class TileLocation;
+
+/*
+	Little endian binary output.
+*/
+class BinaryWriter
+{
+public:
+	std::vector<uint8_t> data;
+
+	void writeU8(uint8_t value);
+	void writeU16(uint16_t value);
+	void writeU32(uint32_t value);
+	void writeU64(uint64_t value);
+	void writeBytes(const void *source, size_t amount);
+
+private:
+	void writeLittleEndian(uint64_t value, int bytes);
+};
+
+/*
+	Little endian binary input. Every read checks the bounds; after a failed read,
+	ok() is false and all further reads return 0.
+*/
+class BinaryReader
+{
+public:
+	BinaryReader(const std::vector<uint8_t> &data);
+
+	bool ok() const
+	{
+		return valid;
+	}
+
+	bool atEnd() const
+	{
+		return cursor == data.size();
+	}
+
+	size_t remaining() const
+	{
+		return data.size() - cursor;
+	}
+
+	uint8_t readU8();
+	uint16_t readU16();
+	uint32_t readU32();
+	uint64_t readU64();
+	bool readBytes(void *destination, size_t amount);
+
+private:
+	const std::vector<uint8_t> &data;
+	size_t cursor = 0;
+	bool valid = true;
+
+	bool require(size_t amount);
+	uint64_t readLittleEndian(int bytes);
+};
+
+/*
+	Binary encoding of the contents of a tile (flags, ground and items), shared by
+	map patches and compressed chunks. Positions are not part of the encoding.
+
+	Tile:
+		u32 flags, u8 hasGround, [ground item], u16 item count, items
+	Item:
+		u16 id, u16 subtype, u8 attribute count, attributes
+	Attribute:
+		u8 type, u8 value type (0 bool, 1 int, 2 double, 3 string), value
+		(u8, u32, 8 raw bytes, u32 length + bytes respectively)
+*/
+class TileCodec
+{
+public:
+	struct ItemData
+	{
+		uint16_t id;
+		uint16_t subtype;
+		std::vector<ItemAttribute> attributes;
+	};
+
+	struct TileData
+	{
+		uint32_t flags;
+		std::optional<ItemData> ground;
+		std::vector<ItemData> items;
+	};
+
+	static void write(BinaryWriter &writer, const Tile &tile);
+
+	/*
+		Returns nothing if the data is malformed or has an item id that is not a
+		valid item type (see readItem). Reading does not create any items,
+		so a malformed input has no side effects.
+	*/
+	static std::optional<TileData> read(BinaryReader &reader);
+
+	/*
+		Create a tile at the location. Items with animations get new ECS entities.
+	*/
+	static std::unique_ptr<Tile> createTile(TileLocation &location, const TileData &data);
+
+	/*
+		Create a tile that is not part of the map (for example, one that is kept
+		for undo).
+	*/
+	static Tile createTile(const Position &position, const TileData &data);
+
+	static void writeItem(BinaryWriter &writer, const Item &item);
+	/*
+		Returns nothing if the data is malformed or the item id is not a valid item
+		type.
+	*/
+	static std::optional<ItemData> readItem(BinaryReader &reader);
+	/*
+		Items with animations get new ECS entities.
+	*/
+	static Item createItem(const ItemData &data);
+};
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+#include "item.h"
+#include "position.h"
+
+/*
+	An edit of a single tile, stored as the operations that make up the edit
+	instead of as a copy of the tile, so that an undo record only holds what
+	changed: the inserted and removed items, the ground and the flags.
+
+	Applying an edit (Map::applyTileEdit) performs the steps in order and turns
+	the edit into its own inverse: every step is replaced by its opposite
+	(an insertion by a removal, and the other way around), and the order of the
+	steps is reversed. The same data is therefore used for undo and redo.
+*/
+struct TileEdit
+{
+	enum class Operation : uint8_t
+	{
+		InsertItem,
+		RemoveItem,
+		// Swap the ground of the tile with 'item'
+		SetGround,
+		// Swap the flags of the tile with 'flags'
+		SetFlags
+	};
+
+	struct Step
+	{
+		Operation operation;
+		// Stack index of the item to insert or remove
+		uint16_t index;
+		uint32_t flags;
+		// The item to insert, or the ground to set. Empty for a removal.
+		std::unique_ptr<Item> item;
+	};
+
+	Position position;
+	std::vector<Step> steps;
+
+	TileEdit(Position position)
+			: position(position) {}
+
+	void insertItem(size_t index, Item &&item)
+	{
+		steps.push_back({Operation::InsertItem, static_cast<uint16_t>(index), 0, std::make_unique<Item>(std::move(item))});
+	}
+
+	void removeItem(size_t index)
+	{
+		steps.push_back({Operation::RemoveItem, static_cast<uint16_t>(index), 0, nullptr});
+	}
+
+	/*
+		A null ground removes the ground.
+	*/
+	void setGround(std::unique_ptr<Item> ground)
+	{
+		steps.push_back({Operation::SetGround, 0, 0, std::move(ground)});
+	}
+
+	void setFlags(uint32_t flags)
+	{
+		steps.push_back({Operation::SetFlags, 0, flags, nullptr});
+	}
+
+	bool empty() const
+	{
+		return steps.empty();
+	}
+
+	size_t getMemoryUsage() const
+	{
+		size_t bytes = steps.capacity() * sizeof(Step);
+		for (const Step &step : steps)
+		{
+			if (step.item)
+				bytes += sizeof(Item);
+		}
+
+		return bytes;
+	}
+};
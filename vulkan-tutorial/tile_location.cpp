@@ -18,17 +18,42 @@ TileLocation::~TileLocation()
 
 void TileLocation::setTile(std::unique_ptr<Tile> tile)
 {
+  this->sharedTile.reset();
   this->tile = std::move(tile);
   this->tile->setLocation(*this);
 }
-Tile *TileLocation::getTile() const
+
+const Tile *TileLocation::getTile() const
+{
+  return tile ? tile.get() : sharedTile.get();
+}
+
+Tile *TileLocation::getMutableTile()
 {
+  if (sharedTile)
+  {
+    setTile(std::make_unique<Tile>(sharedTile->deepCopy()));
+  }
+
   return tile ? tile.get() : nullptr;
 }
 
+bool TileLocation::isShared() const
+{
+  return sharedTile != nullptr;
+}
+
+void TileLocation::setSharedTile(std::shared_ptr<const Tile> tile)
+{
+  DEBUG_ASSERT(tile != nullptr, "A shared tile can not be null.");
+
+  this->tile.reset();
+  this->sharedTile = std::move(tile);
+}
+
 bool TileLocation::hasTile() const
 {
-  if (tile)
+  if (tile || sharedTile)
   {
     return true;
   }
@@ -40,7 +65,7 @@ bool TileLocation::hasTile() const
 
 bool TileLocation::hasGround() const
 {
-  return tile && tile->getGround();
+  return hasTile() && getTile()->getGround();
 }
 
 void TileLocation::setEmptyTile()
@@ -50,19 +75,21 @@ void TileLocation::setEmptyTile()
 
 Item *TileLocation::getGround() const
 {
-  if (!tile)
+  if (!hasTile())
     return nullptr;
 
-  return tile->getGround();
+  return getTile()->getGround();
 }
 
 void TileLocation::removeTile()
 {
   this->tile.reset();
+  this->sharedTile.reset();
 }
 
 std::unique_ptr<Tile> TileLocation::dropTile()
 {
+  getMutableTile();
   std::unique_ptr<Tile> result = std::move(this->tile);
   this->tile.reset();
   return result;
@@ -70,6 +97,8 @@ std::unique_ptr<Tile> TileLocation::dropTile()
 
 std::unique_ptr<Tile> TileLocation::replaceTile(Tile &&newTile)
 {
+  // The old tile is returned, so it can not stay shared
+  getMutableTile();
   DEBUG_ASSERT(!this->tile || (newTile.getPosition() == this->tile->getPosition()), "The new tile must have the same position as the old tile.");
 
   std::unique_ptr<Tile> old = std::move(this->tile);
@@ -18,11 +18,24 @@ public:
 
 	std::unique_ptr<Tile> replaceTile(Tile &&tile);
 
-	Tile *getTile() const;
+	/*
+		The tile can be shared with other locations (see TilePool), so it must not be
+		modified through this pointer. The position of a shared tile is not the
+		position of this location; use getPosition() instead.
+	*/
+	const Tile *getTile() const;
+	/*
+		Returns the tile for modification. A shared tile is first replaced by a copy
+		that is owned by this location (copy-on-write).
+	*/
+	Tile *getMutableTile();
 	Item *getGround() const;
 	bool hasTile() const;
 	bool hasGround() const;
 
+	bool isShared() const;
+	void setSharedTile(std::shared_ptr<const Tile> tile);
+
 	void setEmptyTile();
 	void removeTile();
 	std::unique_ptr<Tile> dropTile();
@@ -39,5 +52,7 @@ public:
 
 protected:
 	std::unique_ptr<Tile> tile{};
+	// Set instead of 'tile' when the tile is shared
+	std::shared_ptr<const Tile> sharedTile{};
 	Position position;
 };
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "tile_pool.h"
+
+#include "tile.h"
+#include "item.h"
+#include "debug.h"
+
+namespace
+{
+  bool sameItem(const Item &a, const Item &b)
+  {
+    // The content hash covers the attributes, which have no equality operator.
+    return a.getId() == b.getId() && a.getSubtype() == b.getSubtype() && a.contentHash() == b.contentHash();
+  }
+
+  bool sameContent(const Tile &a, const Tile &b)
+  {
+    if (a.getMapFlags() != b.getMapFlags() || a.getStatFlags() != b.getStatFlags())
+      return false;
+
+    const Item *groundA = a.getGround();
+    const Item *groundB = b.getGround();
+    if ((groundA == nullptr) != (groundB == nullptr) || (groundA && !sameItem(*groundA, *groundB)))
+      return false;
+
+    const std::vector<Item> &itemsA = a.getItems();
+    const std::vector<Item> &itemsB = b.getItems();
+    if (itemsA.size() != itemsB.size())
+      return false;
+
+    for (size_t i = 0; i < itemsA.size(); ++i)
+    {
+      if (!sameItem(itemsA[i], itemsB[i]))
+        return false;
+    }
+
+    return true;
+  }
+
+  size_t tileBytes(const Tile &tile)
+  {
+    size_t bytes = sizeof(Tile) + tile.getItems().capacity() * sizeof(Item);
+    if (tile.getGround())
+      bytes += sizeof(Item);
+
+    return bytes;
+  }
+} // namespace
+
+bool TilePool::canShare(const Tile &tile)
+{
+  if (tile.hasSelection())
+    return false;
+
+  const Item *ground = tile.getGround();
+  if (ground && ground->isEntity())
+    return false;
+
+  for (const Item &item : tile.getItems())
+  {
+    if (item.isEntity())
+      return false;
+  }
+
+  return true;
+}
+
+std::shared_ptr<const Tile> TilePool::intern(const Tile &tile)
+{
+  DEBUG_ASSERT(canShare(tile), "The tile can not be shared.");
+
+  uint64_t hash = tile.contentHash();
+
+  auto [begin, end] = tiles.equal_range(hash);
+  for (auto it = begin; it != end; ++it)
+  {
+    std::shared_ptr<const Tile> shared = it->second.lock();
+    if (shared && sameContent(*shared, tile))
+    {
+      return shared;
+    }
+  }
+
+  auto shared = std::make_shared<const Tile>(tile.deepCopy());
+  tiles.emplace(hash, shared);
+
+  return shared;
+}
+
+size_t TilePool::size() const
+{
+  size_t count = 0;
+  for (const auto &entry : tiles)
+  {
+    if (!entry.second.expired())
+      ++count;
+  }
+
+  return count;
+}
+
+size_t TilePool::getMemoryUsage() const
+{
+  using Entry = std::pair<const uint64_t, std::weak_ptr<const Tile>>;
+  size_t bytes = sizeof(TilePool) + tiles.bucket_count() * sizeof(void *) + tiles.size() * (sizeof(Entry) + sizeof(void *));
+
+  for (const auto &entry : tiles)
+  {
+    if (std::shared_ptr<const Tile> shared = entry.second.lock())
+    {
+      bytes += tileBytes(*shared);
+    }
+  }
+
+  return bytes;
+}
+
+void TilePool::prune()
+{
+  for (auto it = tiles.begin(); it != tiles.end();)
+  {
+    if (it->second.expired())
+      it = tiles.erase(it);
+    else
+      ++it;
+  }
+}
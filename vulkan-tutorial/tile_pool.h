@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <unordered_map>
+
+class Tile;
+
+/*
+	Interns immutable tile contents so that identical tiles (e.g. plain grass or
+	water) can be shared by many TileLocations (flyweight). A shared tile is never
+	modified; TileLocation::getMutableTile() replaces it with an owned copy first.
+	The pool does not keep tiles alive, it only refers to the tiles that are still
+	in use by some location.
+*/
+class TilePool
+{
+public:
+	/*
+		Returns a shared tile with the same content as 'tile'. The tile must be shareable (see canShare).
+	*/
+	std::shared_ptr<const Tile> intern(const Tile &tile);
+
+	/*
+		Tiles with a selection or with items that are ECS entities (e.g. animated
+		items) have per-location state and can not be shared.
+	*/
+	static bool canShare(const Tile &tile);
+
+	/*
+		Number of distinct tile contents that are currently shared.
+	*/
+	size_t size() const;
+
+	/*
+		Approximate number of bytes used by the pool and the shared tiles.
+	*/
+	size_t getMemoryUsage() const;
+
+	/*
+		Forget the tiles that are no longer used by any location.
+	*/
+	void prune();
+
+private:
+	std::unordered_multimap<uint64_t, std::weak_ptr<const Tile>> tiles;
+};
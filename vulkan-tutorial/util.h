@@ -1,5 +1,6 @@
 #pragma once
 
+#include <stdint.h>
 #include <type_traits>
 #include <variant>
 #include <string>
@@ -73,4 +74,34 @@ namespace util
 		std::hash<T> hasher;
 		seed ^= hasher(v) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
 	}
+
+	/*
+		64-bit hashing that does not depend on the standard library's std::hash, so
+		that content hashes can be compared between builds and platforms.
+	*/
+	inline uint64_t mixHash(uint64_t x)
+	{
+		// splitmix64 finalizer
+		x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+		return x ^ (x >> 31);
+	}
+
+	inline void combineHash64(uint64_t &seed, uint64_t value)
+	{
+		seed = mixHash(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+	}
+
+	inline uint64_t hashBytes(const void *data, size_t size)
+	{
+		// FNV-1a
+		const unsigned char *bytes = static_cast<const unsigned char *>(data);
+		uint64_t hash = 0xcbf29ce484222325ULL;
+		for (size_t i = 0; i < size; ++i)
+		{
+			hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+		}
+
+		return hash;
+	}
 } // namespace util